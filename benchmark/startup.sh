@@ -0,0 +1,34 @@
+#!/bin/bash
+
+# time vips startup: run a trivial command many times and report the mean 
+# time per run in milliseconds
+#
+# usage: ./startup.sh [number-of-runs]
+#
+# can be run from any directory
+
+runs=${1:-100}
+
+# sample2.v lives next to this script
+sample=$(dirname "$0")/sample2.v
+
+vips --version
+
+time_runs() {
+  start=$(date +%s%N)
+  for ((i = 0; i < runs; i++)); do
+    "$@" > /dev/null
+  done
+  end=$(date +%s%N)
+
+  # date gives nanoseconds, print ms with three decimal places
+  per_run=$(( (end - start) / runs / 1000 ))
+  printf "%s: %d.%03dms per run\n" "$*" $(( per_run / 1000 )) \
+    $(( per_run % 1000 ))
+}
+
+# init only, no operations looked up
+time_runs vips --version
+
+# init, plus one operation lookup and a small computation
+time_runs vips avg "$sample"
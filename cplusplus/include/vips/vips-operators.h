@@ -507,6 +507,13 @@ double deviate( VOption *options = 0 ) const;
  */
 VImage divide( VImage right, VOption *options = 0 ) const;
 
+/**
+ * Draw many rects, lines and circles on an image.
+ * @param ink Color for pixels.
+ * @param options Optional options.
+ */
+void draw_batch( std::vector<double> ink, VOption *options = 0 ) const;
+
 /**
  * Draw a circle on an image.
  * @param ink Color for pixels.
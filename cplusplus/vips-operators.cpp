@@ -826,6 +826,14 @@ VImage VImage::divide( VImage right, VOption *options ) const
     return( out );
 }
 
+void VImage::draw_batch( std::vector<double> ink, VOption *options ) const
+{
+    call( "draw_batch",
+        (options ? options : VImage::option())->
+            set( "image", *this )->
+            set( "ink", ink ) );
+}
+
 void VImage::draw_circle( std::vector<double> ink, int cx, int cy, int radius, VOption *options ) const
 {
     call( "draw_circle",
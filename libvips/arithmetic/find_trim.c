@@ -5,6 +5,9 @@
  * 18/9/17 kleisauke 
  * 	- missing bandor
  * 	- only flatten if there is an alpha
+ * 18/10/20
+ * 	- scan in from the edges and stop early, if we can
+ * 	- fall back to vips_project() if the margins are large
  */
 
 /*
@@ -66,6 +69,198 @@ typedef VipsOperationClass VipsFindTrimClass;
 
 G_DEFINE_TYPE( VipsFindTrim, vips_find_trim, VIPS_TYPE_OPERATION );
 
+/* Scan the mask in strips this many pixels deep.
+ */
+#define VIPS_FIND_TRIM_STRIP (16)
+
+/* The edge scan is single-threaded, so once it has looked at this fraction 
+ * of the image (a blank image, or very wide margins) we give up and use the
+ * threaded vips_project() search instead.
+ */
+#define VIPS_FIND_TRIM_SCAN_FRACTION (4)
+
+/* Set @found to this if we ran out of @budget.
+ */
+#define VIPS_FIND_TRIM_GAVE_UP (-2)
+
+/* Search rows @top to @top + @height - 1 of @region for the first row, or 
+ * the last if @reverse is set, with any pixel set in columns @left to 
+ * @left + @width - 1. Set @found to -1 if there is none.
+ *
+ * @budget is the number of pixels we may still examine. 
+ */
+static int
+vips_find_trim_rows( VipsRegion *region, 
+	int left, int top, int width, int height, gboolean reverse, 
+	gint64 *budget, int *found )
+{
+	VipsRect rect;
+	int i, j, x;
+
+	for( i = 0; i < height; i += VIPS_FIND_TRIM_STRIP ) {
+		int n = VIPS_MIN( VIPS_FIND_TRIM_STRIP, height - i );
+
+		if( *budget <= 0 ) {
+			*found = VIPS_FIND_TRIM_GAVE_UP;
+			return( 0 );
+		}
+		*budget -= (gint64) n * width;
+
+		rect.left = left;
+		rect.top = reverse ? top + height - i - n : top + i;
+		rect.width = width;
+		rect.height = n;
+		if( vips_region_prepare( region, &rect ) )
+			return( -1 );
+
+		for( j = 0; j < n; j++ ) {
+			int y = reverse ? rect.top + n - 1 - j : rect.top + j;
+			VipsPel *p = VIPS_REGION_ADDR( region, left, y );
+
+			for( x = 0; x < width; x++ )
+				if( p[x] ) {
+					*found = y;
+					return( 0 );
+				}
+		}
+	}
+
+	*found = -1;
+
+	return( 0 );
+}
+
+/* As above, but search columns.
+ */
+static int
+vips_find_trim_columns( VipsRegion *region, 
+	int left, int top, int width, int height, gboolean reverse, 
+	gint64 *budget, int *found )
+{
+	VipsRect rect;
+	int i, j, y;
+
+	for( i = 0; i < width; i += VIPS_FIND_TRIM_STRIP ) {
+		int n = VIPS_MIN( VIPS_FIND_TRIM_STRIP, width - i );
+
+		if( *budget <= 0 ) {
+			*found = VIPS_FIND_TRIM_GAVE_UP;
+			return( 0 );
+		}
+		*budget -= (gint64) n * height;
+
+		rect.left = reverse ? left + width - i - n : left + i;
+		rect.top = top;
+		rect.width = n;
+		rect.height = height;
+		if( vips_region_prepare( region, &rect ) )
+			return( -1 );
+
+		for( j = 0; j < n; j++ ) {
+			int x = reverse ? rect.left + n - 1 - j : rect.left + j;
+
+			for( y = 0; y < height; y++ ) 
+				if( *VIPS_REGION_ADDR( region, x, top + y ) ) {
+					*found = x;
+					return( 0 );
+				}
+		}
+	}
+
+	*found = -1;
+
+	return( 0 );
+}
+
+/* Search inward from each edge of the mask and stop at the first set line, 
+ * so we only compute the margins and not the whole image. 
+ *
+ * Set @done to FALSE if the margins are too large for this to be worthwhile.
+ */
+static int
+vips_find_trim_scan( VipsImage *mask, 
+	int *left, int *top, int *width, int *height, gboolean *done )
+{
+	VipsRegion *region;
+	gint64 budget;
+	int x0, y0, x1, y1;
+
+	if( !(region = vips_region_new( mask )) )
+		return( -1 );
+
+	budget = VIPS_IMAGE_N_PELS( mask ) / VIPS_FIND_TRIM_SCAN_FRACTION;
+	*done = FALSE;
+
+	if( vips_find_trim_rows( region, 
+		0, 0, mask->Xsize, mask->Ysize, FALSE, &budget, &y0 ) ) {
+		g_object_unref( region );
+		return( -1 );
+	}
+
+	if( y0 == VIPS_FIND_TRIM_GAVE_UP ) {
+		g_object_unref( region );
+		return( 0 );
+	}
+
+	if( y0 < 0 ) {
+		/* Nothing found, same result as the projection search.
+		 */
+		*left = mask->Xsize;
+		*top = mask->Ysize;
+		*width = 0;
+		*height = 0;
+		*done = TRUE;
+		g_object_unref( region );
+
+		return( 0 );
+	}
+
+	/* There must be a set pixel somewhere in rows y0 to y1, so these 
+	 * searches always succeed.
+	 */
+	if( vips_find_trim_rows( region, 
+		0, y0, mask->Xsize, mask->Ysize - y0, TRUE, 
+		&budget, &y1 ) ) {
+		g_object_unref( region );
+		return( -1 );
+	}
+	if( y1 == VIPS_FIND_TRIM_GAVE_UP ) {
+		g_object_unref( region );
+		return( 0 );
+	}
+
+	if( vips_find_trim_columns( region, 
+		0, y0, mask->Xsize, y1 - y0 + 1, FALSE, 
+		&budget, &x0 ) ) {
+		g_object_unref( region );
+		return( -1 );
+	}
+	if( x0 == VIPS_FIND_TRIM_GAVE_UP ) {
+		g_object_unref( region );
+		return( 0 );
+	}
+
+	if( vips_find_trim_columns( region, 
+		x0, y0, mask->Xsize - x0, y1 - y0 + 1, TRUE, 
+		&budget, &x1 ) ) {
+		g_object_unref( region );
+		return( -1 );
+	}
+	if( x1 == VIPS_FIND_TRIM_GAVE_UP ) {
+		g_object_unref( region );
+		return( 0 );
+	}
+
+	g_object_unref( region );
+
+	*left = x0;
+	*top = y0;
+	*width = x1 - x0 + 1;
+	*height = y1 - y0 + 1;
+
+	return( 0 );
+}
+
 static int
 vips_find_trim_build( VipsObject *object )
 {
@@ -129,6 +324,29 @@ vips_find_trim_build( VipsObject *object )
 		return( -1 ); 
 	in = t[5];
 
+	/* Scan in from the edges, unless the source can only be read 
+	 * top-to-bottom. If the margins turn out to be large, fall back to 
+	 * the threaded projection search.
+	 */
+	if( !vips_image_is_sequential( find_trim->in ) ) {
+		int x, y, w, h;
+		gboolean done;
+
+		if( vips_find_trim_scan( in, &x, &y, &w, &h, &done ) )
+			return( -1 );
+
+		if( done ) {
+			g_object_set( find_trim,
+				"left", x,
+				"top", y,
+				"width", w,
+				"height", h,
+				NULL ); 
+
+			return( 0 );
+		}
+	}
+
 	/* t[6] == column sums, t[7] == row sums. 
 	 */
 	if( vips_project( in, &t[6], &t[7], NULL ) )
@@ -252,12 +470,14 @@ vips_find_trim_init( VipsFindTrim *find_trim )
  *
  * Search @in for the bounding box of the non-background area. 
  *
- * Any alpha is flattened out, then the image is median-filtered, all the row 
- * and column sums of the absolute
- * difference from @background are calculated in a
- * single pass, then the first row or column in each of the
- * four directions where the sum is greater than @threshold gives the bounding
- * box.
+ * Any alpha is flattened out, then the image is median-filtered and pixels
+ * where the absolute difference from @background is greater than 
+ * @threshold are marked. The first row or column in each of the four 
+ * directions with a marked pixel gives the bounding box. 
+ *
+ * The search works in from each edge and stops as soon as it finds a marked
+ * line, so only the margins are computed. Sequential images are searched 
+ * with a single pass over the whole image instead.
  *
  * If the image is entirely background, vips_find_trim() returns @width == 0
  * and @height == 0.
@@ -709,6 +709,7 @@ void
 vips_colour_operation_init( void )
 {
 	extern GType vips_colourspace_get_type( void ); 
+	extern GType vips_colour_fused_get_type( void ); 
 	extern GType vips_Lab2XYZ_get_type( void ); 
 	extern GType vips_XYZ2Lab_get_type( void ); 
 	extern GType vips_Lab2LCh_get_type( void ); 
@@ -747,6 +748,7 @@ vips_colour_operation_init( void )
 	extern GType vips_dECMC_get_type( void ); 
 
 	vips_colourspace_get_type();
+	vips_colour_fused_get_type();
 	vips_Lab2XYZ_get_type();
 	vips_XYZ2Lab_get_type();
 	vips_Lab2LCh_get_type();
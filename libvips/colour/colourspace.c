@@ -21,6 +21,8 @@
  * 	  https://github.com/lovell/sharp/issues/193
  * 27/12/18
  * 	- add CMYK conversions
+ * 18/10/20
+ * 	- fuse runs of float -> float steps into a single pass
  */
 
 /*
@@ -517,6 +519,220 @@ vips_colourspace_issupported( const VipsImage *image )
 	return( FALSE );
 }
 
+/* These route steps are plain 3-band float -> 3-band float VipsColourTransform
+ * subclasses whose default state matches the vips_XYZ2Lab() etc. calls the
+ * route table makes, so runs of them can be executed in a single pass.
+ */
+typedef struct _VipsColourFusable {
+	VipsColourTransformFn fn;
+	const char *nickname;
+} VipsColourFusable;
+
+static VipsColourFusable vips_colour_fusable[] = {
+	{ vips_scRGB2XYZ, "scRGB2XYZ" },
+	{ vips_XYZ2scRGB, "XYZ2scRGB" },
+	{ vips_XYZ2Lab, "XYZ2Lab" },
+	{ vips_Lab2XYZ, "Lab2XYZ" },
+	{ vips_Lab2LCh, "Lab2LCh" },
+	{ vips_LCh2Lab, "LCh2Lab" },
+	{ vips_LCh2CMC, "LCh2CMC" },
+	{ vips_CMC2LCh, "CMC2LCh" },
+	{ vips_XYZ2Yxy, "XYZ2Yxy" },
+	{ vips_Yxy2XYZ, "Yxy2XYZ" }
+};
+
+static const char *
+vips_colour_fusable_nickname( VipsColourTransformFn fn )
+{
+	int i;
+
+	for( i = 0; i < VIPS_NUMBER( vips_colour_fusable ); i++ )
+		if( vips_colour_fusable[i].fn == fn )
+			return( vips_colour_fusable[i].nickname );
+
+	return( NULL );
+}
+
+/* Process pixels in chunks this large, so intermediates stay in cache.
+ */
+#define VIPS_COLOUR_FUSED_CHUNK (128)
+
+/* Run steps @first to @first + @n - 1 of route @route as one operation. Each
+ * step's line processor is applied in turn to a small chunk of pixels, so we
+ * skip the intermediate images and region buffers of a chain of operations.
+ */
+typedef struct _VipsColourFused {
+	VipsColourTransform parent_instance;
+
+	int route;
+	int first;
+	int n;
+
+	/* An unbuilt instance of each step, holding its default parameters, 
+	 * plus its line processor.
+	 */
+	VipsColour *stage[MAX_STEPS];
+	VipsColourProcessFn process_line[MAX_STEPS];
+} VipsColourFused;
+
+typedef VipsColourTransformClass VipsColourFusedClass;
+
+G_DEFINE_TYPE( VipsColourFused, vips_colour_fused, 
+	VIPS_TYPE_COLOUR_TRANSFORM );
+
+static void
+vips_colour_fused_dispose( GObject *gobject )
+{
+	VipsColourFused *fused = (VipsColourFused *) gobject;
+
+	int i;
+
+	for( i = 0; i < MAX_STEPS; i++ )
+		VIPS_UNREF( fused->stage[i] );
+
+	G_OBJECT_CLASS( vips_colour_fused_parent_class )->dispose( gobject );
+}
+
+static void
+vips_colour_fused_line( VipsColour *colour, 
+	VipsPel *out, VipsPel **in, int width )
+{
+	VipsColourFused *fused = (VipsColourFused *) colour;
+	const int ps = 3 * sizeof( float );
+
+	float buf[2][3 * VIPS_COLOUR_FUSED_CHUNK];
+	int x;
+
+	for( x = 0; x < width; x += VIPS_COLOUR_FUSED_CHUNK ) {
+		int n = VIPS_MIN( VIPS_COLOUR_FUSED_CHUNK, width - x );
+		VipsPel *p = in[0] + x * ps;
+
+		int i;
+
+		for( i = 0; i < fused->n; i++ ) {
+			VipsPel *q = i == fused->n - 1 ? 
+				out + x * ps : (VipsPel *) buf[i & 1];
+
+			fused->process_line[i]( fused->stage[i], q, &p, n );
+			p = q;
+		}
+	}
+}
+
+static int
+vips_colour_fused_build( VipsObject *object )
+{
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( object );
+	VipsColour *colour = VIPS_COLOUR( object );
+	VipsColourFused *fused = (VipsColourFused *) object;
+
+	int i;
+
+	if( fused->route >= VIPS_NUMBER( vips_colour_routes ) ||
+		fused->n > MAX_STEPS ||
+		fused->first + fused->n > MAX_STEPS ) {
+		vips_error( class->nickname, "%s", _( "bad route" ) );
+		return( -1 );
+	}
+
+	for( i = 0; i < fused->n; i++ ) {
+		VipsColourTransformFn fn = 
+			vips_colour_routes[fused->route].route[fused->first + i];
+		const char *nickname;
+
+		if( !fn ||
+			!(nickname = vips_colour_fusable_nickname( fn )) ) {
+			vips_error( class->nickname, 
+				"%s", _( "route step cannot be fused" ) );
+			return( -1 );
+		}
+
+		if( !(fused->stage[i] = (VipsColour *) 
+			vips_operation_new( nickname )) )
+			return( -1 );
+		fused->process_line[i] = 
+			VIPS_COLOUR_GET_CLASS( fused->stage[i] )->process_line;
+	}
+
+	colour->interpretation = 
+		fused->stage[fused->n - 1]->interpretation;
+
+	if( VIPS_OBJECT_CLASS( vips_colour_fused_parent_class )->
+		build( object ) )
+		return( -1 );
+
+	return( 0 );
+}
+
+static void
+vips_colour_fused_class_init( VipsColourFusedClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+	VipsOperationClass *operation_class = VIPS_OPERATION_CLASS( class );
+	VipsColourClass *colour_class = VIPS_COLOUR_CLASS( class );
+
+	gobject_class->dispose = vips_colour_fused_dispose;
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	object_class->nickname = "colourspace_fused";
+	object_class->description = 
+		_( "run several colourspace route steps in one pass" );
+	object_class->build = vips_colour_fused_build;
+
+	/* Only made by vips_colourspace(), hide from the docs and from 
+	 * operation lists. Our arguments are indexes into a private table, 
+	 * so don't cache either: vips_colourspace() itself is cached.
+	 */
+	operation_class->flags |= 
+		VIPS_OPERATION_DEPRECATED | VIPS_OPERATION_NOCACHE;
+
+	colour_class->process_line = vips_colour_fused_line;
+
+	VIPS_ARG_INT( class, "route", 110, 
+		_( "Route" ), 
+		_( "Index of route in the route table" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsColourFused, route ),
+		0, 10000, 0 );
+
+	VIPS_ARG_INT( class, "first", 111, 
+		_( "First" ), 
+		_( "First step to run" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsColourFused, first ),
+		0, MAX_STEPS - 1, 0 );
+
+	VIPS_ARG_INT( class, "n", 112, 
+		_( "n" ), 
+		_( "Number of steps to run" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsColourFused, n ),
+		1, MAX_STEPS, 1 );
+}
+
+static void
+vips_colour_fused_init( VipsColourFused *fused )
+{
+	fused->n = 1;
+}
+
+static int
+vips_colour_fused( VipsImage *in, VipsImage **out, 
+	int route, int first, int n, ... )
+{
+	va_list ap;
+	int result;
+
+	va_start( ap, n );
+	result = vips_call_split( "colourspace_fused", ap, 
+		in, out, route, first, n );
+	va_end( ap );
+
+	return( result );
+}
+
 
 typedef struct _VipsColourspace {
 	VipsOperation parent_instance;
@@ -536,7 +752,7 @@ vips_colourspace_build( VipsObject *object )
 {
 	VipsColourspace *colourspace = (VipsColourspace *) object; 
 
-	int i, j;
+	int i, j, k;
 	VipsImage *x;
 	VipsImage **t = (VipsImage **) 
 		vips_object_local_array( object, 1 );
@@ -595,10 +811,30 @@ vips_colourspace_build( VipsObject *object )
 		return( -1 );
 	}
 
-	for( j = 0; vips_colour_routes[i].route[j]; j++ ) {
-		if( vips_colour_routes[i].route[j]( x, &pipe[j], NULL ) ) 
-			return( -1 );
-		x = pipe[j];
+	/* Runs of two or more simple float steps are fused into a single
+	 * operation.
+	 */
+	for( j = 0, k = 0; vips_colour_routes[i].route[j]; k++ ) {
+		int n;
+
+		for( n = 0; vips_colour_routes[i].route[j + n] &&
+			vips_colour_fusable_nickname( 
+				vips_colour_routes[i].route[j + n] ); n++ )
+			;
+
+		if( n > 1 ) {
+			if( vips_colour_fused( x, &pipe[k], i, j, n, NULL ) )
+				return( -1 );
+			j += n;
+		}
+		else {
+			if( vips_colour_routes[i].route[j]( x, &pipe[k], 
+				NULL ) ) 
+				return( -1 );
+			j += 1;
+		}
+
+		x = pipe[k];
 	}
 
 	g_object_set( colourspace, "out", vips_image_new(), NULL ); 
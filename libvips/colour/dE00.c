@@ -3,6 +3,9 @@
  * Modified:
  * 31/10/12
  * 	- from dE76.c
+ * 18/10/20
+ * 	- compute T from a single sin/cos pair
+ * 	- skip identical and repeated pixel pairs
  */
 
 /*
@@ -44,6 +47,10 @@
 
 #include "pcolour.h"
 
+/* 25 ** 7, used for G and RC.
+ */
+#define VIPS_25_7 (6103515625.0)
+
 typedef struct _VipsdE00 {
 	VipsColourDifference parent_instance;
 
@@ -112,7 +119,7 @@ vips_col_dE00( float L1, float a1, float b1,
 	/* G
 	 */
 	double Cb7 = Cb * Cb * Cb * Cb * Cb * Cb * Cb;
-	double G = 0.5 * (1 - sqrt( Cb7 / (Cb7 + pow( 25, 7 )) ));
+	double G = 0.5 * (1 - sqrt( Cb7 / (Cb7 + VIPS_25_7) ));
 
 	/* L', a', b', C', h'
 	 */
@@ -141,16 +148,34 @@ vips_col_dE00( float L1, float a1, float b1,
 	double hdbd = (hdb - 275) / 25;
 	double dtheta = 30 * exp( -(hdbd * hdbd) );
 	double Cdb7 = Cdb * Cdb * Cdb * Cdb * Cdb * Cdb * Cdb;
-	double RC = 2 * sqrt( Cdb7 / (Cdb7 + pow( 25, 7 )) );
+	double RC = 2 * sqrt( Cdb7 / (Cdb7 + VIPS_25_7) );
 
-	/* RT, T.
+	/* RT.
 	 */
 	double RT = -sin( VIPS_RAD( 2 * dtheta ) ) * RC;
+
+	/* T is
+	 *
+	 * 	1 - 0.17 cos(h - 30) + 0.24 cos(2h) + 
+	 * 		0.32 cos(3h + 6) - 0.20 cos(4h - 63)
+	 *
+	 * Get the multiple angles from one sin/cos pair with the double 
+	 * and triple angle formulae, then expand the offsets with the 
+	 * constant sin/cos of 30, 6 and 63 degrees.
+	 */
+	double c1 = cos( VIPS_RAD( hdb ) );
+	double s1 = sin( VIPS_RAD( hdb ) );
+	double c2 = 2 * c1 * c1 - 1;
+	double s2 = 2 * s1 * c1;
+	double c3 = c2 * c1 - s2 * s1;
+	double s3 = s2 * c1 + c2 * s1;
+	double c4 = 2 * c2 * c2 - 1;
+	double s4 = 2 * s2 * c2;
 	double T = 1 - 
-		0.17 * cos( VIPS_RAD( hdb - 30 ) ) +
-		0.24 * cos( VIPS_RAD( 2 * hdb ) ) +
-		0.32 * cos( VIPS_RAD( 3 * hdb + 6 ) ) -
-		0.20 * cos( VIPS_RAD( 4 * hdb - 63 ) );
+		0.17 * (0.86602540378443865 * c1 + 0.5 * s1) +
+		0.24 * c2 +
+		0.32 * (0.99452189536827329 * c3 - 0.10452846326765347 * s3) -
+		0.20 * (0.45399049973954675 * c4 + 0.89100652418836788 * s4);
 
 	/* SL, SC, SH
 	 */
@@ -217,8 +242,25 @@ vips_dE00_line( VipsColour *colour,
 	int x;
 
 	for( x = 0; x < width; x++ ) {
-		q[x] = vips_col_dE00( p1[0], p1[1], p1[2], 
-			p2[0], p2[1], p2[2] );
+		/* Identical pixels are common in QA images, and runs of 
+		 * repeated pixel pairs are common in flat areas. Both are 
+		 * exact shortcuts.
+		 */
+		if( p1[0] == p2[0] &&
+			p1[1] == p2[1] &&
+			p1[2] == p2[2] )
+			q[x] = 0.0;
+		else if( x > 0 &&
+			p1[0] == p1[-3] &&
+			p1[1] == p1[-2] &&
+			p1[2] == p1[-1] &&
+			p2[0] == p2[-3] &&
+			p2[1] == p2[-2] &&
+			p2[2] == p2[-1] )
+			q[x] = q[x - 1];
+		else
+			q[x] = vips_col_dE00( p1[0], p1[1], p1[2], 
+				p2[0], p2[1], p2[2] );
 
 		p1 += 3;
 		p2 += 3;
@@ -43,6 +43,9 @@
  * 	  they can be triggered under normal circumstances
  * 17/4/19 kleisauke 
  * 	- better rejection of broken embedded profiles
+ * 18/10/20
+ * 	- share transforms between operations with a process-wide cache
+ * 	- free the cache in vips_shutdown()
  */
 
 /*
@@ -80,6 +83,7 @@
 #ifdef HAVE_LCMS2
 
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include <assert.h>
 
@@ -88,6 +92,7 @@
 #include <lcms2.h>
 
 #include <vips/vips.h>
+#include <vips/internal.h>
 
 #include "pcolour.h"
 
@@ -161,6 +166,10 @@ typedef struct _VipsIcc {
 	cmsUInt32Number out_icc_format;
 	cmsHTRANSFORM trans;
 
+	/* trans comes from this shared cache entry.
+	 */
+	struct _VipsIccCacheEntry *entry;
+
 } VipsIcc;
 
 typedef VipsColourCodeClass VipsIccClass;
@@ -176,12 +185,202 @@ icc_error( cmsContext context, cmsUInt32Number code, const char *text )
 	vips_error( "VipsIcc", "%s", text );
 }
 
+/* Keep up to this many unused transforms in the cache.
+ */
+#define VIPS_ICC_CACHE_MAX (100)
+
+/* Transforms are cached process-wide, keyed by the MD5 of the two profiles,
+ * plus the pixel formats, intent and flags. We always make transforms with
+ * cmsFLAGS_NOCACHE, so one transform can be shared between threads. 
+ */
+typedef struct _VipsIccCacheKey {
+	cmsUInt8Number in_id[16];
+	cmsUInt8Number out_id[16];
+	cmsUInt32Number in_format;
+	cmsUInt32Number out_format;
+	cmsUInt32Number intent;
+	cmsUInt32Number flags;
+} VipsIccCacheKey;
+
+typedef struct _VipsIccCacheEntry {
+	VipsIccCacheKey key;
+	cmsHTRANSFORM trans;
+
+	/* Number of operations using this transform.
+	 */
+	int ref_count;
+} VipsIccCacheEntry;
+
+static GMutex *vips_icc_cache_lock = NULL;
+static GHashTable *vips_icc_cache_table = NULL;
+
+static guint
+vips_icc_cache_hash( gconstpointer key )
+{
+	const guint8 *p = (const guint8 *) key;
+
+	guint hash;
+	int i;
+
+	/* FNV-1a.
+	 */
+	hash = 2166136261u;
+	for( i = 0; i < sizeof( VipsIccCacheKey ); i++ ) {
+		hash ^= p[i];
+		hash *= 16777619u;
+	}
+
+	return( hash );
+}
+
+static gboolean
+vips_icc_cache_equal( gconstpointer a, gconstpointer b )
+{
+	return( memcmp( a, b, sizeof( VipsIccCacheKey ) ) == 0 );
+}
+
+static void
+vips_icc_cache_entry_free( VipsIccCacheEntry *entry )
+{
+	VIPS_FREEF( cmsDeleteTransform, entry->trans );
+	g_free( entry );
+}
+
+static gboolean
+vips_icc_cache_unused( gpointer key, gpointer value, gpointer user_data )
+{
+	VipsIccCacheEntry *entry = (VipsIccCacheEntry *) value;
+
+	return( entry->ref_count == 0 );
+}
+
+static int
+vips_icc_cache_key( VipsIcc *icc, VipsIccCacheKey *key, 
+	cmsUInt32Number flags )
+{
+	memset( key, 0, sizeof( VipsIccCacheKey ) );
+
+	/* Don't trust any ID in the profile header, always compute it. A
+	 * missing profile has an all-zeros ID.
+	 */
+	if( icc->in_profile ) {
+		if( !cmsMD5computeID( icc->in_profile ) )
+			return( -1 );
+		cmsGetHeaderProfileID( icc->in_profile, key->in_id );
+	}
+	if( icc->out_profile ) {
+		if( !cmsMD5computeID( icc->out_profile ) )
+			return( -1 );
+		cmsGetHeaderProfileID( icc->out_profile, key->out_id );
+	}
+
+	key->in_format = icc->in_icc_format;
+	key->out_format = icc->out_icc_format;
+	key->intent = icc->intent;
+	key->flags = flags;
+
+	return( 0 );
+}
+
+/* Find or make a transform for @icc. 
+ */
+static VipsIccCacheEntry *
+vips_icc_cache_get( VipsIcc *icc )
+{
+	cmsUInt32Number flags = cmsFLAGS_NOCACHE;
+
+	VipsIccCacheKey key;
+	VipsIccCacheEntry *entry;
+	cmsHTRANSFORM trans;
+
+	if( vips_icc_cache_key( icc, &key, flags ) ) {
+		vips_error( "VipsIcc", "%s", _( "unable to compute profile ID" ) );
+		return( NULL );
+	}
+
+	g_mutex_lock( vips_icc_cache_lock );
+	if( (entry = g_hash_table_lookup( vips_icc_cache_table, &key )) ) 
+		entry->ref_count += 1;
+	g_mutex_unlock( vips_icc_cache_lock );
+
+	if( entry )
+		return( entry );
+
+	/* Making a transform can take a while, do it outside the lock.
+	 */
+	if( !(trans = cmsCreateTransform( 
+		icc->in_profile, icc->in_icc_format,
+		icc->out_profile, icc->out_icc_format, 
+		icc->intent, flags )) )
+		return( NULL );
+
+	g_mutex_lock( vips_icc_cache_lock );
+
+	/* Another thread may have made the same transform meanwhile.
+	 */
+	if( (entry = g_hash_table_lookup( vips_icc_cache_table, &key )) ) 
+		cmsDeleteTransform( trans );
+	else {
+		if( g_hash_table_size( vips_icc_cache_table ) >= 
+			VIPS_ICC_CACHE_MAX )
+			g_hash_table_foreach_remove( vips_icc_cache_table,
+				vips_icc_cache_unused, NULL );
+
+		entry = g_new0( VipsIccCacheEntry, 1 );
+		entry->key = key;
+		entry->trans = trans;
+		g_hash_table_insert( vips_icc_cache_table, &entry->key, entry );
+	}
+	entry->ref_count += 1;
+
+	g_mutex_unlock( vips_icc_cache_lock );
+
+	return( entry );
+}
+
+static void
+vips_icc_cache_release( VipsIccCacheEntry *entry )
+{
+	g_mutex_lock( vips_icc_cache_lock );
+	g_assert( entry->ref_count > 0 );
+	entry->ref_count -= 1;
+	g_mutex_unlock( vips_icc_cache_lock );
+}
+
+/* Free the transform cache, from vips_shutdown(). If some operation is 
+ * still using a transform (a leak), we must keep the table and just drop 
+ * the unused entries.
+ */
+void
+vips__icc_cache_shutdown( void )
+{
+	gboolean empty;
+
+	if( !vips_icc_cache_lock )
+		return;
+
+	g_mutex_lock( vips_icc_cache_lock );
+	g_hash_table_foreach_remove( vips_icc_cache_table,
+		vips_icc_cache_unused, NULL );
+	empty = g_hash_table_size( vips_icc_cache_table ) == 0;
+	if( empty )
+		VIPS_FREEF( g_hash_table_destroy, vips_icc_cache_table );
+	g_mutex_unlock( vips_icc_cache_lock );
+
+	if( empty )
+		VIPS_FREEF( vips_g_mutex_free, vips_icc_cache_lock );
+}
+
 static void
 vips_icc_dispose( GObject *gobject )
 {
 	VipsIcc *icc = (VipsIcc *) gobject;
 
-	VIPS_FREEF( cmsDeleteTransform, icc->trans );
+	if( icc->entry ) {
+		vips_icc_cache_release( icc->entry );
+		icc->entry = NULL;
+		icc->trans = NULL;
+	}
 	VIPS_FREEF( cmsCloseProfile, icc->in_profile );
 	VIPS_FREEF( cmsCloseProfile, icc->out_profile );
 
@@ -350,14 +549,13 @@ vips_icc_build( VipsObject *object )
 		return( -1 );
 	}
 
-	/* Use cmsFLAGS_NOCACHE to disable the 1-pixel cache and make
-	 * calling cmsDoTransform() from multiple threads safe.
+	/* Transforms are made with cmsFLAGS_NOCACHE to disable the 1-pixel 
+	 * cache and make calling cmsDoTransform() from multiple threads 
+	 * safe, so we can share them via the transform cache.
 	 */
-	if( !(icc->trans = cmsCreateTransform( 
-		icc->in_profile, icc->in_icc_format,
-		icc->out_profile, icc->out_icc_format, 
-		icc->intent, cmsFLAGS_NOCACHE )) )
+	if( !(icc->entry = vips_icc_cache_get( icc )) )
 		return( -1 );
+	icc->trans = icc->entry->trans;
 
 	if( VIPS_OBJECT_CLASS( vips_icc_parent_class )->
 		build( object ) )
@@ -395,6 +593,11 @@ vips_icc_class_init( VipsIccClass *class )
 		VIPS_TYPE_PCS, VIPS_PCS_LAB );
 
 	cmsSetLogErrorHandler( icc_error );
+
+	vips_icc_cache_lock = vips_g_mutex_new();
+	vips_icc_cache_table = g_hash_table_new_full( 
+		vips_icc_cache_hash, vips_icc_cache_equal, 
+		NULL, (GDestroyNotify) vips_icc_cache_entry_free );
 }
 
 static void
@@ -1312,6 +1515,12 @@ vips_icc_is_compatible_profile( VipsImage *image,
 #else /*!HAVE_LCMS2*/
 
 #include <vips/vips.h>
+#include <vips/internal.h>
+
+void
+vips__icc_cache_shutdown( void )
+{
+}
 
 int
 vips_icc_present( void )
@@ -2,6 +2,13 @@
  *
  * 11/12/15
  * 	- from join.c
+ * 18/10/20
+ * 	- find the inputs touching a request from the grid layout rather than
+ * 	  searching every input
+ * 	- make input regions on first use
+ * 	- minimise least-recently-used inputs to bound the number of open
+ * 	  files
+ * 	- only rescan for inputs to minimise once more have been opened
  */
 
 /*
@@ -67,37 +74,413 @@ typedef struct _VipsArrayjoin {
 	int down;
 	VipsRect *rects;
 
+	/* The embedded inputs we generate from.
+	 */
+	VipsImage **size;
+
+	/* Inputs which have been read from and not since minimised are 
+	 * @open, and @n_open counts them. @stamp records when each input was 
+	 * last used, from the @clock counter. We only take @lock to open or
+	 * minimise an input, so gen is lock-free while we're under budget.
+	 */
+	GMutex *lock;
+	int *open;
+	int n_open;
+	int *stamp;
+	int clock;
+
+	/* Number of threads currently reading from each input, or -1 while
+	 * an input is being minimised. We never minimise a busy input.
+	 */
+	int *busy;
+
+	/* Scratch for sorting open inputs by age. Protected by @lock.
+	 */
+	int *order;
+
+	/* Minimise inputs once more than this many are open.
+	 */
+	int max_open;
+
+	/* @n_open after the last minimise pass. We don't scan again until
+	 * more inputs have been opened. Protected by @lock.
+	 */
+	int scan_n_open;
+
 } VipsArrayjoin;
 
 typedef VipsConversionClass VipsArrayjoinClass;
 
 G_DEFINE_TYPE( VipsArrayjoin, vips_arrayjoin, VIPS_TYPE_CONVERSION );
 
+/* Keep at least this many inputs open. We also always allow four rows of
+ * the grid, so that even after minimising down to 3/4 of the budget, a strip
+ * across the output never thrashes.
+ */
+#define VIPS_ARRAYJOIN_MAX_OPEN (100)
+
+/* In sequential mode, only minimise inputs when the read point is this far
+ * below them. 256 is too small.
+ */
+#define VIPS_ARRAYJOIN_SEQ_MARGIN (1024)
+
+static void
+vips_arrayjoin_dispose( GObject *gobject )
+{
+	VipsArrayjoin *join = (VipsArrayjoin *) gobject;
+
+	VIPS_FREEF( vips_g_mutex_free, join->lock );
+
+	G_OBJECT_CLASS( vips_arrayjoin_parent_class )->dispose( gobject );
+}
+
+/* Our per-thread state. Input regions are only made when a request first
+ * touches that input, so a sequence on a join of many thousands of tiles
+ * does not need a region for every input.
+ */
+typedef struct {
+	VipsArrayjoin *join;
+
+	/* The set of embedded inputs we make regions on.
+	 */
+	VipsImage **in;
+
+	/* One region per input, NULL until needed.
+	 */
+	VipsRegion **ir;
+
+} VipsArrayjoinSequence;
+
 static int
-vips_arrayjoin_gen( VipsRegion *or, void *seq, 
-	void *a, void *b, gboolean *stop )
+vips_arrayjoin_stop( void *vseq, void *a, void *b )
+{
+	VipsArrayjoinSequence *seq = (VipsArrayjoinSequence *) vseq;
+	int n = VIPS_AREA( seq->join->in )->n;
+
+	if( seq->ir ) {
+		int i;
+
+		for( i = 0; i < n; i++ )
+			VIPS_UNREF( seq->ir[i] );
+		VIPS_FREE( seq->ir );
+	}
+
+	VIPS_FREE( seq );
+
+	return( 0 );
+}
+
+static void *
+vips_arrayjoin_start( VipsImage *out, void *a, void *b )
 {
-	VipsRegion **ir = (VipsRegion **) seq;
+	VipsImage **in = (VipsImage **) a;
 	VipsArrayjoin *join = (VipsArrayjoin *) b;
-	VipsRect *r = &or->valid;
 	int n = VIPS_AREA( join->in )->n;
 
+	VipsArrayjoinSequence *seq;
 	int i;
 
+	if( !(seq = VIPS_NEW( NULL, VipsArrayjoinSequence )) )
+		return( NULL );
+
+	seq->join = join;
+	seq->in = in;
+	seq->ir = NULL;
+
+	if( !(seq->ir = VIPS_ARRAY( NULL, n, VipsRegion * )) ) {
+		vips_arrayjoin_stop( seq, NULL, NULL );
+		return( NULL );
+	}
+	for( i = 0; i < n; i++ )
+		seq->ir[i] = NULL;
+
+	return( seq );
+}
+
+/* Get the region for input i, making it if necessary.
+ */
+static VipsRegion *
+vips_arrayjoin_region( VipsArrayjoinSequence *seq, int i )
+{
+	if( !seq->ir[i] &&
+		!(seq->ir[i] = vips_region_new( seq->in[i] )) )
+		return( NULL );
+
+	return( seq->ir[i] );
+}
+
+/* The range of grid cells, inclusive, touched by a rect. Inputs sit on a 
+ * regular grid, so we can find them directly rather than searching all n.
+ */
+static void
+vips_arrayjoin_cells( VipsArrayjoin *join, VipsRect *r,
+	int *x0, int *y0, int *x1, int *y1 )
+{
+	int hstep = join->hspacing + join->shim;
+	int vstep = join->vspacing + join->shim;
+
+	*x0 = VIPS_CLIP( 0, r->left / hstep, join->across - 1 );
+	*x1 = VIPS_CLIP( 0, (VIPS_RECT_RIGHT( r ) - 1) / hstep, 
+		join->across - 1 );
+	*y0 = VIPS_CLIP( 0, r->top / vstep, join->down - 1 );
+	*y1 = VIPS_CLIP( 0, (VIPS_RECT_BOTTOM( r ) - 1) / vstep, 
+		join->down - 1 );
+}
+
+/* The input at a grid cell. Cells off the end of the final row are covered 
+ * by the stretched final input.
+ */
+static int
+vips_arrayjoin_index( VipsArrayjoin *join, int x, int y )
+{
+	int n = VIPS_AREA( join->in )->n;
+
+	return( VIPS_MIN( n - 1, y * join->across + x ) );
+}
+
+/* Mark input i as in use. If it's being minimised, wait for that to 
+ * finish.
+ */
+static void
+vips_arrayjoin_acquire( VipsArrayjoin *join, int i )
+{
+	for(;;) {
+		int busy = g_atomic_int_get( &join->busy[i] );
+
+		if( busy < 0 ) {
+			/* Minimise runs with the lock held.
+			 */
+			g_mutex_lock( join->lock );
+			g_mutex_unlock( join->lock );
+		}
+		else if( g_atomic_int_compare_and_exchange( &join->busy[i], 
+			busy, busy + 1 ) )
+			break;
+	}
+
+	g_atomic_int_set( &join->stamp[i], 
+		g_atomic_int_add( &join->clock, 1 ) );
+
+	if( !g_atomic_int_get( &join->open[i] ) ) {
+		g_mutex_lock( join->lock );
+		if( !join->open[i] ) {
+			g_atomic_int_set( &join->open[i], TRUE );
+			g_atomic_int_inc( &join->n_open );
+		}
+		g_mutex_unlock( join->lock );
+	}
+}
+
+static void *
+vips_arrayjoin_upstream_cb( VipsImage *image, GHashTable *upstream, void *b )
+{
+	g_hash_table_insert( upstream, image, image );
+
+	return( NULL );
+}
+
+/* TRUE if nothing outside input i's own upstream reads from it, ie. every
+ * downstream link of every image i depends on stays within that set, or 
+ * leads to our output. Minimising an upstream shared with another branch 
+ * of the pipeline could close a file another thread is reading from.
+ *
+ * The pipeline can grow after we're built, so test this at minimise time.
+ */
+static gboolean
+vips_arrayjoin_exclusive( VipsArrayjoin *join, int i )
+{
+	VipsImage *out = VIPS_CONVERSION( join )->out;
+
+	GHashTable *upstream;
+	GHashTableIter iter;
+	gpointer key;
+	gboolean exclusive;
+
+	upstream = g_hash_table_new( g_direct_hash, g_direct_equal );
+	(void) vips__link_map( join->size[i], TRUE,
+		(VipsSListMap2Fn) vips_arrayjoin_upstream_cb, upstream, NULL );
+
+	exclusive = TRUE;
+
+	g_mutex_lock( vips__global_lock );
+	g_hash_table_iter_init( &iter, upstream );
+	while( exclusive &&
+		g_hash_table_iter_next( &iter, &key, NULL ) ) {
+		VipsImage *image = (VipsImage *) key;
+
+		GSList *p;
+
+		for( p = image->downstream; p; p = p->next ) 
+			if( p->data != out &&
+				!g_hash_table_lookup( upstream, p->data ) ) {
+				exclusive = FALSE;
+				break;
+			}
+	}
+	g_mutex_unlock( vips__global_lock );
+
+	g_hash_table_destroy( upstream );
+
+	return( exclusive );
+}
+
+/* Can we minimise input i? @r is the request being computed.
+ */
+static gboolean
+vips_arrayjoin_idle( VipsArrayjoin *join, int i, VipsRect *r )
+{
+	if( g_atomic_int_get( &join->busy[i] ) )
+		return( FALSE );
+
+	/* A sequential input must not be minimised until we're well past it, 
+	 * or it will have to restart.
+	 */
+	if( vips_image_is_sequential( join->size[i] ) &&
+		r->top <= VIPS_RECT_BOTTOM( &join->rects[i] ) + 
+			VIPS_ARRAYJOIN_SEQ_MARGIN )
+		return( FALSE );
+
+	if( !vips_arrayjoin_exclusive( join, i ) )
+		return( FALSE );
+
+	return( TRUE );
+}
+
+static int
+vips_arrayjoin_stamp_sortfn( const void *a, const void *b, void *user_data )
+{
+	VipsArrayjoin *join = (VipsArrayjoin *) user_data;
+	int i = *((int *) a);
+	int j = *((int *) b);
+
+	if( join->stamp[i] < join->stamp[j] )
+		return( -1 );
+	else if( join->stamp[i] > join->stamp[j] )
+		return( 1 );
+	else
+		return( 0 );
+}
+
+/* Finished with input i. If too many inputs are open, minimise the
+ * least-recently-used idle ones. This closes their files and frees any
+ * caches, they will be reopened on demand if they are needed again.
+ *
+ * We minimise down to 3/4 of the budget, so the sort is not repeated for 
+ * every newly opened input. If a pass can't get that low (every input is 
+ * busy, say), we don't try again until another input has been opened.
+ */
+static void
+vips_arrayjoin_release( VipsArrayjoin *join, int i, VipsRect *r )
+{
+	int n = VIPS_AREA( join->in )->n;
+	int low_water = 3 * join->max_open / 4;
+
+	int n_order;
+	int j;
+
+	g_atomic_int_add( &join->busy[i], -1 );
+
+	if( g_atomic_int_get( &join->n_open ) <= join->max_open )
+		return;
+
+	g_mutex_lock( join->lock );
+
+	if( g_atomic_int_get( &join->n_open ) <= join->scan_n_open ) {
+		g_mutex_unlock( join->lock );
+		return;
+	}
+
+	n_order = 0;
+	for( j = 0; j < n; j++ )
+		if( join->open[j] )
+			join->order[n_order++] = j;
+	g_qsort_with_data( join->order, n_order, sizeof( int ),
+		vips_arrayjoin_stamp_sortfn, join );
+
+	for( j = 0; j < n_order && join->n_open > low_water; j++ ) {
+		int k = join->order[j];
+
+		/* Setting busy to -1 makes acquire wait for us.
+		 */
+		if( vips_arrayjoin_idle( join, k, r ) &&
+			g_atomic_int_compare_and_exchange( &join->busy[k], 
+				0, -1 ) ) {
+			VIPS_DEBUG_MSG( "vips_arrayjoin_release: "
+				"minimising input %d\n", k );
+
+			vips_image_minimise_all( join->size[k] );
+			g_atomic_int_set( &join->open[k], FALSE );
+			g_atomic_int_add( &join->n_open, -1 );
+			g_atomic_int_set( &join->busy[k], 0 );
+		}
+	}
+
+	join->scan_n_open = g_atomic_int_get( &join->n_open );
+
+	g_mutex_unlock( join->lock );
+}
+
+static int
+vips_arrayjoin_gen( VipsRegion *or, void *vseq, 
+	void *a, void *b, gboolean *stop )
+{
+	VipsArrayjoinSequence *seq = (VipsArrayjoinSequence *) vseq;
+	VipsArrayjoin *join = (VipsArrayjoin *) b;
+	VipsRect *r = &or->valid;
+
+	int x0, y0, x1, y1;
+	int x, y, i;
+	VipsRegion *ir;
+
+	vips_arrayjoin_cells( join, r, &x0, &y0, &x1, &y1 );
+
 	/* Does this rect fit within one of our inputs? If it does, we
 	 * can pass just the request on.
 	 */
-	for( i = 0; i < n; i++ ) 
-		if( vips_rect_includesrect( &join->rects[i], r ) ) 
-			return( vips__insert_just_one( or, ir[i],
-				join->rects[i].left, join->rects[i].top ) ); 
+	i = vips_arrayjoin_index( join, x0, y0 );
+	if( vips_rect_includesrect( &join->rects[i], r ) ) {
+		int result;
+
+		if( !(ir = vips_arrayjoin_region( seq, i )) )
+			return( -1 );
+
+		vips_arrayjoin_acquire( join, i );
+		result = vips__insert_just_one( or, ir,
+			join->rects[i].left, join->rects[i].top ); 
+		vips_arrayjoin_release( join, i, r );
+
+		return( result );
+	}
 
 	/* Output requires more than one input. Paste all touching inputs into
 	 * the output.
 	 */
-	for( i = 0; i < n; i++ ) 
-		if( vips__insert_paste_region( or, ir[i], &join->rects[i] ) )
-			return( -1 );
+	for( y = y0; y <= y1; y++ ) {
+		int last = -1;
+
+		for( x = x0; x <= x1; x++ ) {
+			int result;
+
+			i = vips_arrayjoin_index( join, x, y );
+
+			/* Several cells can share the stretched final input.
+			 */
+			if( i == last )
+				continue;
+			last = i;
+
+			if( !(ir = vips_arrayjoin_region( seq, i )) )
+				return( -1 );
+
+			vips_arrayjoin_acquire( join, i );
+			result = vips__insert_paste_region( or, 
+				ir, &join->rects[i] );
+			vips_arrayjoin_release( join, i, r );
+
+			if( result )
+				return( -1 );
+		}
+	}
 
 	return( 0 );
 }
@@ -267,6 +650,24 @@ vips_arrayjoin_build( VipsObject *object )
 			return( -1 );
 	}
 
+	join->size = size;
+	join->open = VIPS_ARRAY( join, n, int ); 
+	join->stamp = VIPS_ARRAY( join, n, int ); 
+	join->busy = VIPS_ARRAY( join, n, int ); 
+	join->order = VIPS_ARRAY( join, n, int ); 
+	if( !join->open ||
+		!join->stamp ||
+		!join->busy ||
+		!join->order )
+		return( -1 );
+	for( i = 0; i < n; i++ ) {
+		join->open[i] = FALSE;
+		join->stamp[i] = 0;
+		join->busy[i] = 0;
+	}
+	join->max_open = VIPS_MAX( VIPS_ARRAYJOIN_MAX_OPEN, 4 * join->across );
+	join->scan_n_open = 0;
+
 	if( vips_image_pipeline_array( conversion->out, 
 		VIPS_DEMAND_STYLE_THINSTRIP, size ) )
 		return( -1 );
@@ -275,7 +676,7 @@ vips_arrayjoin_build( VipsObject *object )
 	conversion->out->Ysize = output_height;
 
 	if( vips_image_generate( conversion->out,
-		vips_start_many, vips_arrayjoin_gen, vips_stop_many, 
+		vips_arrayjoin_start, vips_arrayjoin_gen, vips_arrayjoin_stop, 
 		size, join ) )
 		return( -1 );
 
@@ -291,6 +692,7 @@ vips_arrayjoin_class_init( VipsArrayjoinClass *class )
 
 	VIPS_DEBUG_MSG( "vips_arrayjoin_class_init\n" );
 
+	gobject_class->dispose = vips_arrayjoin_dispose;
 	gobject_class->set_property = vips_object_set_property;
 	gobject_class->get_property = vips_object_get_property;
 
@@ -363,6 +765,7 @@ vips_arrayjoin_init( VipsArrayjoin *join )
 {
 	/* Init our instance fields.
 	 */
+	join->lock = vips_g_mutex_new();
 	join->background = 
 		vips_area_new_array( G_TYPE_DOUBLE, sizeof( double ), 1 ); 
 	((double *) (join->background->data))[0] = 0.0;
@@ -415,6 +818,11 @@ vips_arrayjoinv( VipsImage **in, VipsImage **out, int n, va_list ap )
  *
  * Boxes are joined and separated by @shim pixels. This defaults to 0.
  *
+ * Inputs are only opened when a request first touches them. When many
+ * inputs have been read from, the least-recently-used ones are minimised,
+ * see vips_image_minimise_all(), so that joining thousands of files does 
+ * not hold thousands of file descriptors open.
+ *
  * If the number of bands in the input images differs, all but one of the 
  * images must have one band. In this case, an n-band image is formed from the 
  * one-band image by joining n copies of the one-band image together, and then
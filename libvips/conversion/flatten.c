@@ -9,6 +9,8 @@
  * 	- add max_alpha to match vips_premultiply() etc.
  * 25/5/16
  * 	- max_alpha defaults to 65535 for RGB16/GREY16
+ * 18/10/20
+ * 	- fixed-point path for 8 and 16-bit images
  */
 
 /*
@@ -118,6 +120,45 @@ G_DEFINE_TYPE( VipsFlatten, vips_flatten, VIPS_TYPE_CONVERSION );
 	} \
 }
 
+/* Fixed-point flatten for uchar / ushort images with the standard max_alpha.
+ * MAX is a constant, so the divide becomes a multiply and shift, and the
+ * result is identical to the double path. p * alpha + bg * (MAX - alpha)
+ * can't be larger than MAX * MAX, so 32 bits are always enough.
+ */
+#define VIPS_FLATTEN_BLACK_FIXED( TYPE, MAX ) { \
+	TYPE * restrict p = (TYPE *) in; \
+	TYPE * restrict q = (TYPE *) out; \
+	\
+	for( x = 0; x < width; x++ ) { \
+		guint32 alpha = p[bands - 1]; \
+		int b; \
+		\
+		for( b = 0; b < bands - 1; b++ ) \
+			q[b] = (p[b] * alpha) / MAX; \
+		\
+		p += bands; \
+		q += bands - 1; \
+	} \
+}
+
+#define VIPS_FLATTEN_FIXED( TYPE, MAX ) { \
+	TYPE * restrict p = (TYPE *) in; \
+	TYPE * restrict q = (TYPE *) out; \
+	TYPE * restrict bg = (TYPE *) flatten->ink; \
+	\
+	for( x = 0; x < width; x++ ) { \
+		guint32 alpha = p[bands - 1]; \
+		guint32 nalpha = MAX - alpha; \
+		int b; \
+		\
+		for( b = 0; b < bands - 1; b++ ) \
+			q[b] = (p[b] * alpha + bg[b] * nalpha) / MAX; \
+		\
+		p += bands; \
+		q += bands - 1; \
+	} \
+}
+
 /* Flatten with any background.
  */
 #define VIPS_FLATTEN( TYPE ) { \
@@ -179,7 +220,12 @@ vips_flatten_black_gen( VipsRegion *or, void *vseq, void *a, void *b,
 
 		switch( flatten->in->BandFmt ) { 
 		case VIPS_FORMAT_UCHAR: 
-			VIPS_FLATTEN_BLACK( unsigned char ); 
+			if( max_alpha == 255 ) {
+				VIPS_FLATTEN_BLACK_FIXED( unsigned char, 255 );
+			}
+			else {
+				VIPS_FLATTEN_BLACK( unsigned char );
+			}
 			break; 
 
 		case VIPS_FORMAT_CHAR: 
@@ -187,7 +233,12 @@ vips_flatten_black_gen( VipsRegion *or, void *vseq, void *a, void *b,
 			break; 
 
 		case VIPS_FORMAT_USHORT: 
-			VIPS_FLATTEN_BLACK_FLOAT( unsigned short ); 
+			if( max_alpha == 65535 ) {
+				VIPS_FLATTEN_BLACK_FIXED( unsigned short, 65535 );
+			}
+			else {
+				VIPS_FLATTEN_BLACK_FLOAT( unsigned short );
+			}
 			break; 
 
 		case VIPS_FORMAT_SHORT: 
@@ -244,7 +295,12 @@ vips_flatten_gen( VipsRegion *or, void *vseq, void *a, void *b,
 
 		switch( flatten->in->BandFmt ) { 
 		case VIPS_FORMAT_UCHAR: 
-			VIPS_FLATTEN( unsigned char ); 
+			if( max_alpha == 255 ) {
+				VIPS_FLATTEN_FIXED( unsigned char, 255 );
+			}
+			else {
+				VIPS_FLATTEN( unsigned char );
+			}
 			break; 
 
 		case VIPS_FORMAT_CHAR: 
@@ -252,7 +308,12 @@ vips_flatten_gen( VipsRegion *or, void *vseq, void *a, void *b,
 			break; 
 
 		case VIPS_FORMAT_USHORT: 
-			VIPS_FLATTEN_FLOAT( unsigned short ); 
+			if( max_alpha == 65535 ) {
+				VIPS_FLATTEN_FIXED( unsigned short, 65535 );
+			}
+			else {
+				VIPS_FLATTEN_FLOAT( unsigned short );
+			}
 			break; 
 
 		case VIPS_FORMAT_SHORT: 
@@ -28,6 +28,8 @@
  * 29/9/11
  * 	- rewrite as a class
  * 	- add expand, bg options
+ * 18/10/20
+ * 	- minimise sub once a sequential read is well past it
  */
 
 /*
@@ -215,6 +217,19 @@ vips_insert_gen( VipsRegion *or, void *seq, void *a, void *b, gboolean *stop )
 			return( -1 );
 	}
 
+	/* In sequential mode, we can minimise sub once our generate point
+	 * is well past the end of it. This closes its file and frees any
+	 * caches, which matters for mosaics built from many insert operations.
+	 *
+	 * minimise_all is quite expensive, so only trigger once.
+	 */
+	if( !insert->sub_minimised &&
+		vips_image_is_sequential( insert->sub_processed ) &&
+		r->top > VIPS_RECT_BOTTOM( &insert->rsub ) + 1024 ) {
+		insert->sub_minimised = TRUE;
+		vips_image_minimise_all( insert->sub_processed );
+	}
+
 	return( 0 );
 }
 
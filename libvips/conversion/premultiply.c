@@ -9,6 +9,10 @@
  * 	- max_alpha defaults to 65535 for RGB16/GREY16
  * 24/11/17 lovell
  * 	- match normalised alpha to output type
+ * 18/10/20
+ * 	- table lookup for uchar alpha
+ * 	- add @format, with a fixed-point path for uchar and ushort
+ * 	- other @format and @max_alpha combinations premultiply then cast
  */
 
 /*
@@ -51,6 +55,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
+#include <limits.h>
 
 #include <vips/vips.h>
 #include <vips/internal.h>
@@ -64,6 +69,12 @@ typedef struct _VipsPremultiply {
 	VipsImage *in;
 
 	double max_alpha;
+	VipsBandFormat format;
+
+	/* For uchar images, the normalised alpha for each possible alpha
+	 * value. This saves a clip and a divide per pixel.
+	 */
+	float nalpha[256];
 
 } VipsPremultiply;
 
@@ -112,6 +123,67 @@ G_DEFINE_TYPE( VipsPremultiply, vips_premultiply, VIPS_TYPE_CONVERSION );
 	} \
 }
 
+/* uchar RGBA, with normalised alpha from the table.
+ */
+#define PRE_RGBA_TABLE { \
+	unsigned char * restrict p = (unsigned char *) in; \
+	float * restrict q = (float *) out; \
+	\
+	for( x = 0; x < width; x++ ) { \
+		unsigned char alpha = p[3]; \
+		float nalpha = premultiply->nalpha[alpha]; \
+		\
+		q[0] = p[0] * nalpha; \
+		q[1] = p[1] * nalpha; \
+		q[2] = p[2] * nalpha; \
+		q[3] = alpha; \
+		\
+		p += 4; \
+		q += 4; \
+	} \
+}
+
+/* Fixed-point premultiply of a uchar or ushort image, rounding to nearest.
+ * @max_alpha is the maximum of the format. TEMP must hold MAX * MAX.
+ */
+#define PRE_FIXED( TYPE, TEMP, MAX ) { \
+	TYPE * restrict p = (TYPE *) in; \
+	TYPE * restrict q = (TYPE *) out; \
+	\
+	for( x = 0; x < width; x++ ) { \
+		TEMP alpha = p[bands - 1]; \
+		\
+		for( i = 0; i < bands - 1; i++ ) \
+			q[i] = (p[i] * alpha + MAX / 2) / MAX; \
+		q[i] = alpha; \
+		\
+		p += bands; \
+		q += bands; \
+	} \
+}
+
+/* uchar is the common case: use a shift for the divide by 255. This is 
+ * exact for products up to 255 * 255.
+ */
+#define PRE_FIXED_UCHAR { \
+	unsigned char * restrict p = (unsigned char *) in; \
+	unsigned char * restrict q = (unsigned char *) out; \
+	\
+	for( x = 0; x < width; x++ ) { \
+		unsigned int alpha = p[bands - 1]; \
+		\
+		for( i = 0; i < bands - 1; i++ ) { \
+			unsigned int t = p[i] * alpha + 128; \
+			\
+			q[i] = (t + (t >> 8)) >> 8; \
+		} \
+		q[i] = alpha; \
+		\
+		p += bands; \
+		q += bands; \
+	} \
+}
+
 #define PRE( IN, OUT ) { \
 	if( bands == 4 ) { \
 		PRE_RGBA( IN, OUT ); \
@@ -142,9 +214,31 @@ vips_premultiply_gen( VipsRegion *or, void *vseq, void *a, void *b,
 		VipsPel *in = VIPS_REGION_ADDR( ir, r->left, r->top + y ); 
 		VipsPel *out = VIPS_REGION_ADDR( or, r->left, r->top + y ); 
 
+		/* Same-format fixed point. Build only lets this through
+		 * for the standard max_alpha.
+		 */
+		if( or->im->BandFmt == im->BandFmt &&
+			(im->BandFmt == VIPS_FORMAT_UCHAR ||
+			 im->BandFmt == VIPS_FORMAT_USHORT) ) {
+			if( im->BandFmt == VIPS_FORMAT_UCHAR ) {
+				PRE_FIXED_UCHAR;
+			}
+			else {
+				PRE_FIXED( unsigned short, 
+					unsigned int, USHRT_MAX );
+			}
+
+			continue;
+		}
+
 		switch( im->BandFmt ) { 
 		case VIPS_FORMAT_UCHAR: 
-			PRE( unsigned char, float ); 
+			if( bands == 4 ) {
+				PRE_RGBA_TABLE;
+			}
+			else {
+				PRE( unsigned char, float ); 
+			}
 			break; 
 
 		case VIPS_FORMAT_CHAR: 
@@ -192,7 +286,7 @@ vips_premultiply_build( VipsObject *object )
 	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( object );
 	VipsConversion *conversion = VIPS_CONVERSION( object );
 	VipsPremultiply *premultiply = (VipsPremultiply *) object;
-	VipsImage **t = (VipsImage **) vips_object_local_array( object, 1 );
+	VipsImage **t = (VipsImage **) vips_object_local_array( object, 3 );
 
 	VipsImage *in;
 
@@ -206,18 +300,21 @@ vips_premultiply_build( VipsObject *object )
 		return( -1 );
 	in = t[0]; 
 
-	/* Trivial case: fall back to copy().
+	/* Trivial case: fall back to copy(), or cast().
 	 */
-	if( in->Bands == 1 )
+	if( in->Bands == 1 ) {
+		if( vips_object_argument_isset( object, "format" ) ) {
+			if( vips_cast( in, &t[1], premultiply->format, NULL ) )
+				return( -1 );
+			in = t[1];
+		}
+
 		return( vips_image_write( in, conversion->out ) );
+	}
 
 	if( vips_check_noncomplex( class->nickname, in ) )
 		return( -1 );
 
-	if( vips_image_pipelinev( conversion->out, 
-		VIPS_DEMAND_STYLE_THINSTRIP, in, NULL ) )
-		return( -1 );
-
 	/* Is max-alpha unset? Default to the correct value for this
 	 * interpretation.
 	 */
@@ -226,7 +323,52 @@ vips_premultiply_build( VipsObject *object )
 			in->Type == VIPS_INTERPRETATION_RGB16 )
 			premultiply->max_alpha = 65535;
 
-	if( in->BandFmt == VIPS_FORMAT_DOUBLE )
+	if( vips_object_argument_isset( object, "format" ) ) {
+		VipsBandFormat format = premultiply->format;
+		double max_alpha = premultiply->max_alpha;
+
+		/* We only have a fixed-point path for uchar and ushort with 
+		 * the standard max_alpha. Anything else is premultiply then 
+		 * cast.
+		 */
+		gboolean fixed = in->BandFmt == format &&
+			((format == VIPS_FORMAT_UCHAR && 
+			  max_alpha == UCHAR_MAX) ||
+			 (format == VIPS_FORMAT_USHORT && 
+			  max_alpha == USHRT_MAX));
+
+		if( !fixed ) {
+			if( vips_premultiply( in, &t[1], 
+					"max_alpha", max_alpha,
+					NULL ) ||
+				vips_cast( t[1], &t[2], format, NULL ) ||
+				vips_image_write( t[2], conversion->out ) )
+				return( -1 );
+
+			return( 0 );
+		}
+	}
+
+	if( vips_image_pipelinev( conversion->out, 
+		VIPS_DEMAND_STYLE_THINSTRIP, in, NULL ) )
+		return( -1 );
+
+	/* Must match the (float) clip_alpha / max_alpha in PRE_MANY.
+	 */
+	if( in->BandFmt == VIPS_FORMAT_UCHAR ) {
+		double max_alpha = premultiply->max_alpha;
+		int i;
+
+		for( i = 0; i < 256; i++ ) {
+			unsigned char clip_alpha = VIPS_CLIP( 0, i, max_alpha );
+
+			premultiply->nalpha[i] = (float) clip_alpha / max_alpha;
+		}
+	}
+
+	if( vips_object_argument_isset( object, "format" ) )
+		conversion->out->BandFmt = premultiply->format;
+	else if( in->BandFmt == VIPS_FORMAT_DOUBLE )
 		conversion->out->BandFmt = VIPS_FORMAT_DOUBLE;
 	else
 		conversion->out->BandFmt = VIPS_FORMAT_FLOAT;
@@ -269,12 +411,20 @@ vips_premultiply_class_init( VipsPremultiplyClass *class )
 		VIPS_ARGUMENT_OPTIONAL_INPUT,
 		G_STRUCT_OFFSET( VipsPremultiply, max_alpha ),
 		0, 100000000, 255 );
+
+	VIPS_ARG_ENUM( class, "format", 116, 
+		_( "Format" ), 
+		_( "Format for output" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsPremultiply, format ),
+		VIPS_TYPE_BAND_FORMAT, VIPS_FORMAT_FLOAT ); 
 }
 
 static void
 vips_premultiply_init( VipsPremultiply *premultiply )
 {
 	premultiply->max_alpha = 255.0;
+	premultiply->format = VIPS_FORMAT_FLOAT;
 }
 
 /**
@@ -286,6 +436,7 @@ vips_premultiply_init( VipsPremultiply *premultiply )
  * Optional arguments:
  *
  * * @max_alpha: %gdouble, maximum value for alpha
+ * * @format: #VipsBandFormat, format for output
  *
  * Premultiplies any alpha channel. 
  * The final band is taken to be the alpha
@@ -306,13 +457,18 @@ vips_premultiply_init( VipsPremultiply *premultiply )
  * #VIPS_FORMAT_FLOAT unless the input format is #VIPS_FORMAT_DOUBLE, in which
  * case the output is double as well.
  *
+ * Set @format to pick the output format. This is the same as vips_cast() 
+ * on the output, except that if the input is uchar or ushort, @format is 
+ * the same and @max_alpha is the maximum of that format, a fixed-point path 
+ * is used which rounds to nearest.
+ *
  * @max_alpha has the default value 255, or 65535 for images tagged as
  * #VIPS_INTERPRETATION_RGB16 or
  * #VIPS_INTERPRETATION_GREY16. 
  *
  * Non-complex images only.
  *
- * See also: vips_unpremultiply(), vips_flatten().
+ * See also: vips_unpremultiply(), vips_flatten(), vips_cast().
  *
  * Returns: 0 on success, -1 on error
  */
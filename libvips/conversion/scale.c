@@ -24,6 +24,8 @@
  * 	- round to nearest on uchar output
  * 29/12/18 kleisauke 
  * 	- ... and round to nearest in log mode too 
+ * 18/10/20
+ * 	- only compute @in once
  */
 
 /*
@@ -63,6 +65,7 @@
 #include <math.h>
 
 #include <vips/vips.h>
+#include <vips/internal.h>
 
 #include "pconversion.h"
 
@@ -87,13 +90,21 @@ vips_scale_build( VipsObject *object )
 	VipsScale *scale = (VipsScale *) object;
 	VipsImage **t = (VipsImage **) vips_object_local_array( object, 7 );
 
+	VipsImage *in;
 	double mx;
 	double mn;
 
 	if( VIPS_OBJECT_CLASS( vips_scale_parent_class )->build( object ) )
 		return( -1 );
 
-	if( vips_stats( scale->in, &t[0], NULL ) )
+	/* We scan @in twice, see vips__image_two_pass(). This renders
+	 * a partial @in now, during build, as vips_stats() would anyway.
+	 */
+	if( vips__image_two_pass( scale->in, &t[6] ) )
+		return( -1 );
+	in = t[6];
+
+	if( vips_stats( in, &t[0], NULL ) )
 		return( -1 );
 	mn = *VIPS_MATRIX( t[0], 0, 0 );
 	mx = *VIPS_MATRIX( t[0], 1, 0 );
@@ -101,8 +112,8 @@ vips_scale_build( VipsObject *object )
 	if( mn == mx ) {
 		/* Range of zero: just return black.
 		 */
-		if( vips_black( &t[1], scale->in->Xsize, scale->in->Ysize, 
-			"bands", scale->in->Bands,
+		if( vips_black( &t[1], in->Xsize, in->Ysize, 
+			"bands", in->Bands,
 			NULL ) ||
 			vips_image_write( t[1], conversion->out ) )
 			return( -1 );
@@ -110,7 +121,7 @@ vips_scale_build( VipsObject *object )
 	else if( scale->log ) { 
 		double f = 255.0 / log10( 1.0 + pow( mx, scale->exp ) );
 
-		if( vips_pow_const1( scale->in, &t[2], scale->exp, NULL ) ||
+		if( vips_pow_const1( in, &t[2], scale->exp, NULL ) ||
 			vips_linear1( t[2], &t[3], 1.0, 1.0, NULL ) ||
 			vips_log10( t[3], &t[4], NULL ) ||
 			/* Add 0.5 to get round to nearest.
@@ -128,7 +139,7 @@ vips_scale_build( VipsObject *object )
 		 */
 		double a = -(mn * f) + 0.5;
 
-		if( vips_linear1( scale->in, &t[2], f, a, 
+		if( vips_linear1( in, &t[2], f, a, 
 			"uchar", TRUE, 
 			NULL ) ||
 			vips_image_write( t[2], conversion->out ) )
@@ -23,6 +23,13 @@
  * 	- re-enable skipahead now we have the single-thread-first-tile idea
  * 6/3/17
  * 	- deprecate @trace, @access now seq is much simpler
+ * 18/10/20
+ * 	- track each reader, and size the cache to the distance between the
+ * 	  slowest and fastest
+ * 	- readers more than VIPS_SEQUENTIAL_MAX_WINDOW lines behind no longer
+ * 	  hold the cache, and fail if they read again
+ * 	- stall readers that would leave a live reader more than
+ * 	  VIPS_SEQUENTIAL_MAX_WINDOW lines behind
  */
 
 /*
@@ -72,6 +79,17 @@
 
 #include "pconversion.h"
 
+/* The most lines we hold for a slow reader. A reader that falls further
+ * behind than this (for example, the top half of a vertical join which has
+ * finished) stops holding the cache, so we stream in bounded memory.
+ */
+#define VIPS_SEQUENTIAL_MAX_WINDOW (2048)
+
+/* How long a reader that is too far ahead will wait for a slow reader to 
+ * move before we decide the slow reader is idle.
+ */
+#define STALL_TIME (1.0)
+
 typedef struct _VipsSequential {
 	VipsConversion parent_instance;
 
@@ -84,6 +102,11 @@ typedef struct _VipsSequential {
 	 */
 	GMutex *lock;
 
+	/* Signalled whenever a reader moves, so readers that are too far ahead
+	 * can check again.
+	 */
+	GCond *ready;
+
 	/* The next read from our source will fetch this scanline, ie. it's 0
 	 * when we start.
 	 */
@@ -93,8 +116,32 @@ typedef struct _VipsSequential {
 	 * can stall and never wake.
 	 */
 	int error;
+
+	/* All the VipsSequentialReader on our output, and the largest span
+	 * of lines we've asked the cache to hold.
+	 */
+	GSList *readers;
+	int window;
 } VipsSequential;
 
+/* Every region on our output gets one of these. We use them to find the 
+ * slowest reader, so we can keep all the lines it will need.
+ */
+typedef struct _VipsSequentialReader {
+	VipsSequential *sequential;
+	VipsRegion *ir;
+
+	/* Top of the last request from this reader, or -1 if it has not 
+	 * read anything yet.
+	 */
+	int top;
+
+	/* Set if this reader fell more than VIPS_SEQUENTIAL_MAX_WINDOW lines
+	 * behind and we stopped keeping lines for it.
+	 */
+	gboolean expired;
+} VipsSequentialReader;
+
 typedef VipsConversionClass VipsSequentialClass;
 
 G_DEFINE_TYPE( VipsSequential, vips_sequential, VIPS_TYPE_CONVERSION );
@@ -105,17 +152,205 @@ vips_sequential_dispose( GObject *gobject )
 	VipsSequential *sequential = (VipsSequential *) gobject;
 
 	VIPS_FREEF( vips_g_mutex_free, sequential->lock );
+	VIPS_FREEF( vips_g_cond_free, sequential->ready );
+	VIPS_FREEF( g_slist_free, sequential->readers );
 
 	G_OBJECT_CLASS( vips_sequential_parent_class )->dispose( gobject );
 }
 
+static void *
+vips_sequential_start( VipsImage *out, void *a, void *b )
+{
+	VipsImage *in = (VipsImage *) a;
+	VipsSequential *sequential = (VipsSequential *) b;
+
+	VipsSequentialReader *reader;
+
+	reader = g_new( VipsSequentialReader, 1 );
+	reader->sequential = sequential;
+	reader->ir = vips_region_new( in );
+	reader->top = -1;
+	reader->expired = FALSE;
+
+	g_mutex_lock( sequential->lock );
+	sequential->readers = g_slist_prepend( sequential->readers, reader );
+	g_mutex_unlock( sequential->lock );
+
+	return( reader );
+}
+
+static int
+vips_sequential_stop( void *seq, void *a, void *b )
+{
+	VipsSequentialReader *reader = (VipsSequentialReader *) seq;
+	VipsSequential *sequential = reader->sequential;
+
+	g_mutex_lock( sequential->lock );
+	sequential->readers = g_slist_remove( sequential->readers, reader );
+	g_cond_broadcast( sequential->ready );
+	g_mutex_unlock( sequential->lock );
+
+	VIPS_UNREF( reader->ir );
+	g_free( reader );
+
+	return( 0 );
+}
+
+/* Before we read past y_pos for @r, make sure the cache will hold every line 
+ * from the slowest reader down. Several readers can share one sequential
+ * source (two savers on one decode, or an image used twice at different
+ * offsets), and memory is then bounded by the distance between the slowest 
+ * and the fastest.
+ *
+ * The linecache sizes itself to the tallest request, so we ask for a
+ * one-pixel-wide column over the whole span. The lines the slow reader needs
+ * are still in cache, so this only reads new lines.
+ *
+ * Readers more than VIPS_SEQUENTIAL_MAX_WINDOW lines behind are probably
+ * idle (their region is still open, but they've read all they need), so 
+ * we stop holding lines for them.
+ */
+static int
+vips_sequential_window( VipsSequential *sequential, 
+	VipsRegion *ir, VipsRect *r )
+{
+	int slowest;
+	int span;
+	GSList *p;
+
+	slowest = r->top;
+	for( p = sequential->readers; p; p = p->next ) {
+		VipsSequentialReader *reader = (VipsSequentialReader *) p->data;
+
+		if( reader->top < 0 ||
+			reader->expired )
+			continue;
+
+		if( reader->top < 
+			VIPS_RECT_BOTTOM( r ) - VIPS_SEQUENTIAL_MAX_WINDOW ) {
+			if( sequential->trace )
+				printf( "vips_sequential_window %p: "
+					"reader at line %d expired\n", 
+					sequential, reader->top );
+
+			reader->expired = TRUE;
+			continue;
+		}
+
+		slowest = VIPS_MIN( slowest, reader->top );
+	}
+
+	span = VIPS_RECT_BOTTOM( r ) - slowest;
+	if( slowest < sequential->y_pos &&
+		VIPS_RECT_BOTTOM( r ) > sequential->y_pos &&
+		span > sequential->window ) {
+		VipsRect area;
+
+		if( sequential->trace )
+			printf( "vips_sequential_window %p: "
+				"holding %d lines from line %d\n", 
+				sequential, span, slowest );
+
+		area.left = 0;
+		area.top = slowest;
+		area.width = 1;
+		area.height = span;
+		if( vips_region_prepare( ir, &area ) )
+			return( -1 );
+
+		sequential->window = span;
+		sequential->y_pos = VIPS_RECT_BOTTOM( &area );
+	}
+
+	return( 0 );
+}
+
+/* Is there a reader other than @reader which we would drop if we read @r?
+ */
+static gboolean
+vips_sequential_laggard( VipsSequential *sequential, 
+	VipsSequentialReader *reader, VipsRect *r )
+{
+	GSList *p;
+
+	for( p = sequential->readers; p; p = p->next ) {
+		VipsSequentialReader *other = (VipsSequentialReader *) p->data;
+
+		if( other != reader &&
+			other->top >= 0 &&
+			!other->expired &&
+			other->top < 
+				VIPS_RECT_BOTTOM( r ) - 
+					VIPS_SEQUENTIAL_MAX_WINDOW )
+			return( TRUE );
+	}
+
+	return( FALSE );
+}
+
+/* Stall a reader which would read so far ahead that another reader must be
+ * dropped. This applies backpressure when two sinks (eg. 
+ * vips_image_write_to_files()) pull one source at different speeds. 
+ *
+ * If nothing moves for STALL_TIME, the slow reader is probably idle and we 
+ * let vips_sequential_window() expire it. 
+ *
+ * Return non-zero if another thread has failed while we waited.
+ */
+static int
+vips_sequential_stall( VipsSequential *sequential, 
+	VipsSequentialReader *reader, VipsRect *r )
+{
+	while( VIPS_RECT_BOTTOM( r ) > sequential->y_pos &&
+		vips_sequential_laggard( sequential, reader, r ) ) {
+		gboolean got_time;
+
+		if( sequential->trace )
+			printf( "vips_sequential_stall %p: "
+				"stalling reader at line %d\n", 
+				sequential, r->top );
+
+		VIPS_GATE_START( "vips_sequential_stall: wait" );
+
+#ifdef HAVE_COND_INIT
+{
+		gint64 time;
+
+		time = g_get_monotonic_time() + STALL_TIME * 1000000; 
+		got_time = g_cond_wait_until( sequential->ready, 
+			sequential->lock, time );
+}
+#else
+{
+		GTimeVal time;
+
+		g_get_current_time( &time );
+		g_time_val_add( &time, STALL_TIME * 1000000 );
+		got_time = g_cond_timed_wait( sequential->ready, 
+			sequential->lock, &time );
+}
+#endif
+
+		VIPS_GATE_STOP( "vips_sequential_stall: wait" );
+
+		if( !got_time )
+			break;
+
+		if( sequential->error )
+			return( -1 );
+	}
+
+	return( sequential->error );
+}
+
 static int
 vips_sequential_generate( VipsRegion *or, 
 	void *seq, void *a, void *b, gboolean *stop )
 {
 	VipsSequential *sequential = (VipsSequential *) b;
         VipsRect *r = &or->valid;
-	VipsRegion *ir = (VipsRegion *) seq;
+	VipsSequentialReader *reader = (VipsSequentialReader *) seq;
+	VipsRegion *ir = reader->ir;
 
 	if( sequential->trace )
 		printf( "vips_sequential_generate %p: "
@@ -135,6 +370,40 @@ vips_sequential_generate( VipsRegion *or,
 		return( -1 );
 	}
 
+	/* An expired reader has come back for lines we may have dropped. 
+	 * Fail with a clear message rather than an out of order read on the
+	 * source.
+	 */
+	if( reader->expired &&
+		r->top < sequential->y_pos - sequential->window ) {
+		VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( sequential );
+
+		vips_error( class->nickname, 
+			_( "reader more than %d lines behind, "
+				"use random access" ),
+			VIPS_SEQUENTIAL_MAX_WINDOW );
+		sequential->error = -1;
+		g_cond_broadcast( sequential->ready );
+		g_mutex_unlock( sequential->lock );
+		return( -1 );
+	}
+
+	reader->top = r->top;
+	reader->expired = FALSE;
+	g_cond_broadcast( sequential->ready );
+
+	if( vips_sequential_stall( sequential, reader, r ) ) {
+		g_mutex_unlock( sequential->lock );
+		return( -1 );
+	}
+
+	if( vips_sequential_window( sequential, ir, r ) ) {
+		sequential->error = -1;
+		g_cond_broadcast( sequential->ready );
+		g_mutex_unlock( sequential->lock );
+		return( -1 );
+	}
+
 	if( r->top > sequential->y_pos ) {
 		/* This is a request for something some way down the image. 
 		 * Probably the operation is something like extract_area and 
@@ -154,6 +423,7 @@ vips_sequential_generate( VipsRegion *or,
 		area.height = r->top - sequential->y_pos;
 		if( vips_region_prepare( ir, &area ) ) {
 			sequential->error = -1;
+			g_cond_broadcast( sequential->ready );
 			g_mutex_unlock( sequential->lock );
 			return( -1 );
 		}
@@ -167,12 +437,14 @@ vips_sequential_generate( VipsRegion *or,
 	if( vips_region_prepare( ir, r ) ||
 		vips_region_region( or, ir, r, r->left, r->top ) ) {
 		sequential->error = -1;
+		g_cond_broadcast( sequential->ready );
 		g_mutex_unlock( sequential->lock );
 		return( -1 );
 	}
 
 	sequential->y_pos = 
 		VIPS_MAX( sequential->y_pos, VIPS_RECT_BOTTOM( r ) );
+	g_cond_broadcast( sequential->ready );
 
 	g_mutex_unlock( sequential->lock );
 
@@ -209,7 +481,8 @@ vips_sequential_build( VipsObject *object )
 		VIPS_DEMAND_STYLE_THINSTRIP, t, NULL ) )
 		return( -1 );
 	if( vips_image_generate( conversion->out,
-		vips_start_one, vips_sequential_generate, vips_stop_one, 
+		vips_sequential_start, vips_sequential_generate, 
+		vips_sequential_stop, 
 		t, sequential ) )
 		return( -1 );
 
@@ -265,9 +538,12 @@ static void
 vips_sequential_init( VipsSequential *sequential )
 {
 	sequential->lock = vips_g_mutex_new();
+	sequential->ready = vips_g_cond_new();
 	sequential->tile_height = 1;
 	sequential->error = 0;
 	sequential->trace = FALSE;
+	sequential->readers = NULL;
+	sequential->window = 0;
 }
 
 /**
@@ -288,6 +564,14 @@ vips_sequential_init( VipsSequential *sequential )
  * @strip_height can be used to set the size of the tiles that
  * vips_sequential() uses. The default value is 1.
  *
+ * Several readers can share the output, for example two savers running
+ * on one decode, or a pipeline that uses @in twice at different offsets. 
+ * vips_sequential() tracks the position of each reader, and keeps every 
+ * line from the slowest reader down, so memory use grows with the distance
+ * between the slowest and fastest reader. A reader which falls more than
+ * 2048 lines behind is assumed to have finished and stops holding lines. If
+ * it reads again, vips_sequential() fails with an error.
+ *
  * See also: vips_cache(), vips_linecache(), vips_tilecache().
  *
  * Returns: 0 on success, -1 on error.
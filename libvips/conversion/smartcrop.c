@@ -14,6 +14,11 @@
  * 	- add low and high
  * 19/3/20 jcupitt
  * 	- add all
+ * 18/10/20
+ * 	- only compute @in once for entropy and attention
+ * 	- entropy scores from a summed-area table of histograms
+ * 	- attention picks the best crop-sized window with a summed-area table
+ * 	- scale 16-bit images with alpha to 8 bits for entropy
  */
 
 /*
@@ -55,8 +60,10 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <math.h>
 
 #include <vips/vips.h>
+#include <vips/internal.h>
 #include <vips/debug.h>
 
 #include "pconversion.h"
@@ -71,38 +78,181 @@ typedef struct _VipsSmartcrop {
 	int height;
 	VipsInteresting interesting;
 
+	/* The format of @in before any premultiply.
+	 */
+	VipsBandFormat format;
+
 } VipsSmartcrop;
 
 typedef VipsConversionClass VipsSmartcropClass;
 
 G_DEFINE_TYPE( VipsSmartcrop, vips_smartcrop, VIPS_TYPE_CONVERSION );
 
+/* Entropy is measured on a copy of the image shrunk to fit this size, with 
+ * this many levels per band. 
+ */
+#define VIPS_SMARTCROP_ENTROPY_SIZE (128)
+#define VIPS_SMARTCROP_ENTROPY_SHIFT (4)
+#define VIPS_SMARTCROP_ENTROPY_LEVELS (256 >> VIPS_SMARTCROP_ENTROPY_SHIFT)
+
+/* A summed-area table of histograms: element (x, y) is the histogram of
+ * the rect from (0, 0) to (x, y), exclusive. The histogram of any area is
+ * then four lookups per bin.
+ */
+typedef struct _VipsSmartcropHist {
+	int width;
+	int height;
+	int n_bins;
+
+	/* Map full-size coordinates to the table.
+	 */
+	double hscale;
+	double vscale;
+
+	guint32 *table;
+} VipsSmartcropHist;
+
+static void
+vips_smartcrop_hist_free( VipsSmartcropHist *hist )
+{
+	VIPS_FREE( hist->table );
+}
+
 static int
-vips_smartcrop_score( VipsSmartcrop *smartcrop, VipsImage *in, 
-	int left, int top, int width, int height, double *score )
+vips_smartcrop_hist_init( VipsSmartcropHist *hist, 
+	VipsSmartcrop *smartcrop, VipsImage *in )
 {
 	VipsImage **t = (VipsImage **) 
-		vips_object_local_array( VIPS_OBJECT( smartcrop ), 2 );
+		vips_object_local_array( VIPS_OBJECT( smartcrop ), 3 );
 
-	if( vips_extract_area( in, &t[0], left, top, width, height, NULL ) ||
-		vips_hist_find( t[0], &t[1], NULL ) ||
-		vips_hist_entropy( t[1], score, NULL ) )
+	double scale;
+	VipsImage *x;
+	int row;
+	int i, j, k, b;
+
+	scale = VIPS_MIN( 1.0, 
+		(double) VIPS_SMARTCROP_ENTROPY_SIZE / 
+			VIPS_MAX( in->Xsize, in->Ysize ) );
+	if( vips_resize( in, &t[0], scale, NULL ) )
 		return( -1 );
+	x = t[0];
+
+	/* Same levels for 8 and 16-bit images. Images with alpha have been
+	 * premultiplied to float by now, so test the original format.
+	 */
+	if( smartcrop->format == VIPS_FORMAT_USHORT ) {
+		if( vips_linear1( x, &t[1], 1.0 / 256, 0.0, NULL ) )
+			return( -1 );
+		x = t[1];
+	}
+	if( vips_cast( x, &t[2], VIPS_FORMAT_UCHAR, NULL ) ||
+		vips_image_wio_input( t[2] ) )
+		return( -1 );
+	x = t[2];
+
+	hist->width = x->Xsize;
+	hist->height = x->Ysize;
+	hist->n_bins = x->Bands * VIPS_SMARTCROP_ENTROPY_LEVELS;
+	hist->hscale = (double) x->Xsize / in->Xsize;
+	hist->vscale = (double) x->Ysize / in->Ysize;
+	row = (hist->width + 1) * hist->n_bins;
+
+	if( !(hist->table = VIPS_ARRAY( NULL, 
+		row * (hist->height + 1), guint32 )) )
+		return( -1 );
+	memset( hist->table, 0, 
+		row * (hist->height + 1) * sizeof( guint32 ) );
+
+	for( j = 0; j < hist->height; j++ ) {
+		VipsPel *p = VIPS_IMAGE_ADDR( x, 0, j );
+		guint32 *above = hist->table + j * row;
+		guint32 *q = above + row;
+
+		for( i = 0; i < hist->width; i++ ) {
+			/* Start from the sum of the areas above and to the
+			 * left, then add this pixel.
+			 */
+			for( b = 0; b < hist->n_bins; b++ ) 
+				q[hist->n_bins + b] = q[b] + 
+					above[hist->n_bins + b] - above[b];
+
+			for( k = 0; k < x->Bands; k++ ) {
+				b = k * VIPS_SMARTCROP_ENTROPY_LEVELS + 
+					(p[k] >> VIPS_SMARTCROP_ENTROPY_SHIFT);
+				q[hist->n_bins + b] += 1;
+			}
+
+			p += x->Bands;
+			q += hist->n_bins;
+			above += hist->n_bins;
+		}
+	}
 
 	return( 0 );
 }
 
-/* Entropy-style smartcrop. Repeatedly discard low interest areas. This should
- * be faster for very large images. 
+/* The entropy of an area of the full-size image.
+ */
+static double
+vips_smartcrop_hist_entropy( VipsSmartcropHist *hist, 
+	int left, int top, int width, int height )
+{
+	const int row = (hist->width + 1) * hist->n_bins;
+
+	int x0, y0, x1, y1;
+	guint32 *p00, *p10, *p01, *p11;
+	double sum;
+	double entropy;
+	int b;
+
+	x0 = VIPS_CLIP( 0, left * hist->hscale, hist->width - 1 );
+	y0 = VIPS_CLIP( 0, top * hist->vscale, hist->height - 1 );
+	x1 = VIPS_CLIP( x0 + 1, 
+		ceil( (left + width) * hist->hscale ), hist->width );
+	y1 = VIPS_CLIP( y0 + 1, 
+		ceil( (top + height) * hist->vscale ), hist->height );
+
+	p00 = hist->table + y0 * row + x0 * hist->n_bins;
+	p10 = hist->table + y0 * row + x1 * hist->n_bins;
+	p01 = hist->table + y1 * row + x0 * hist->n_bins;
+	p11 = hist->table + y1 * row + x1 * hist->n_bins;
+
+	sum = 0.0;
+	for( b = 0; b < hist->n_bins; b++ ) 
+		sum += p11[b] - p10[b] - p01[b] + p00[b];
+
+	entropy = 0.0;
+	for( b = 0; b < hist->n_bins; b++ ) {
+		guint32 n = p11[b] - p10[b] - p01[b] + p00[b];
+
+		if( n > 0 ) {
+			double p = n / sum;
+
+			entropy -= p * log( p );
+		}
+	}
+
+	return( entropy / log( 2.0 ) );
+}
+
+/* Entropy-style smartcrop. Repeatedly discard low interest areas. Scores 
+ * come from a summed-area table of histograms, so each one is constant time 
+ * and we only read the image once.
  */
 static int
 vips_smartcrop_entropy( VipsSmartcrop *smartcrop, 
 	VipsImage *in, int *left, int *top )
 {
+	VipsSmartcropHist hist = { 0 };
 	int max_slice_size;
 	int width;
 	int height;
 
+	if( vips_smartcrop_hist_init( &hist, smartcrop, in ) ) {
+		vips_smartcrop_hist_free( &hist );
+		return( -1 );
+	}
+
 	*left = 0;
 	*top = 0;
 	width = in->Xsize;
@@ -126,18 +276,11 @@ vips_smartcrop_entropy( VipsSmartcrop *smartcrop,
 			VIPS_MIN( height - smartcrop->height, max_slice_size );
 
 		if( slice_width > 0 ) { 
-			double left_score;
-			double right_score;
-
-			if( vips_smartcrop_score( smartcrop, in, 
-				*left, *top, 
-				slice_width, height, &left_score ) )
-				return( -1 );
-
-			if( vips_smartcrop_score( smartcrop, in, 
+			double left_score = vips_smartcrop_hist_entropy( &hist,
+				*left, *top, slice_width, height );
+			double right_score = vips_smartcrop_hist_entropy( &hist,
 				*left + width - slice_width, *top, 
-				slice_width, height, &right_score ) )
-				return( -1 ); 
+				slice_width, height );
 
 			width -= slice_width;
 			if( left_score < right_score ) 
@@ -145,18 +288,11 @@ vips_smartcrop_entropy( VipsSmartcrop *smartcrop,
 		}
 
 		if( slice_height > 0 ) { 
-			double top_score;
-			double bottom_score;
-
-			if( vips_smartcrop_score( smartcrop, in, 
-				*left, *top, 
-				width, slice_height, &top_score ) )
-				return( -1 );
-
-			if( vips_smartcrop_score( smartcrop, in, 
+			double top_score = vips_smartcrop_hist_entropy( &hist,
+				*left, *top, width, slice_height );
+			double bottom_score = vips_smartcrop_hist_entropy( &hist,
 				*left, *top + height - slice_height, 
-				width, slice_height, &bottom_score ) )
-				return( -1 ); 
+				width, slice_height );
 
 			height -= slice_height;
 			if( top_score < bottom_score ) 
@@ -164,6 +300,8 @@ vips_smartcrop_entropy( VipsSmartcrop *smartcrop,
 		}
 	}
 
+	vips_smartcrop_hist_free( &hist );
+
 	return( 0 );
 }
 
@@ -193,6 +331,69 @@ pythagoras( VipsSmartcrop *smartcrop, VipsImage *in, VipsImage **out )
 	return( 0 );
 }
 
+/* Search a one-band double image for the window of size @width x @height 
+ * (rounded, at least 1 x 1) with the largest sum, and return the centre of 
+ * the window.
+ */
+static int
+vips_smartcrop_best_window( VipsImage *in, double width, double height,
+	double *x_pos, double *y_pos )
+{
+	const int ww = VIPS_CLIP( 1, VIPS_RINT( width ), in->Xsize );
+	const int wh = VIPS_CLIP( 1, VIPS_RINT( height ), in->Ysize );
+	const int row = in->Xsize + 1;
+
+	double *sat;
+	gboolean found;
+	double best;
+	int x, y;
+
+	g_assert( in->Bands == 1 );
+	g_assert( in->BandFmt == VIPS_FORMAT_DOUBLE );
+
+	if( !(sat = VIPS_ARRAY( NULL, row * (in->Ysize + 1), double )) )
+		return( -1 );
+
+	for( x = 0; x < row; x++ )
+		sat[x] = 0.0;
+	for( y = 0; y < in->Ysize; y++ ) {
+		double *p = (double *) VIPS_IMAGE_ADDR( in, 0, y );
+		double *above = sat + y * row;
+		double *q = above + row;
+		double sum;
+
+		q[0] = 0.0;
+		sum = 0.0;
+		for( x = 0; x < in->Xsize; x++ ) {
+			sum += p[x];
+			q[x + 1] = above[x + 1] + sum;
+		}
+	}
+
+	found = FALSE;
+	best = 0.0;
+	*x_pos = 0;
+	*y_pos = 0;
+	for( y = 0; y + wh <= in->Ysize; y++ )
+		for( x = 0; x + ww <= in->Xsize; x++ ) {
+			double *p0 = sat + y * row + x;
+			double *p1 = sat + (y + wh) * row + x;
+			double score = p1[ww] - p1[0] - p0[ww] + p0[0];
+
+			if( !found ||
+				score > best ) {
+				found = TRUE;
+				best = score;
+				*x_pos = x + ww / 2.0;
+				*y_pos = y + wh / 2.0;
+			}
+		}
+
+	g_free( sat );
+
+	return( 0 );
+}
+
 static int
 vips_smartcrop_attention( VipsSmartcrop *smartcrop, 
 	VipsImage *in, int *left, int *top )
@@ -207,18 +408,14 @@ vips_smartcrop_attention( VipsSmartcrop *smartcrop,
 
 	double hscale;
 	double vscale;
-	double sigma;
-	double max;
-	int x_pos;
-	int y_pos;
+	double x_pos;
+	double y_pos;
 
 	/* The size we shrink to gives the precision with which we can place
 	 * the crop
 	 */
 	hscale = 32.0 / in->Xsize;
 	vscale = 32.0 / in->Ysize;
-	sigma = VIPS_MAX( sqrt( pow( smartcrop->width * hscale, 2 ) +
-		pow( smartcrop->height * vscale, 2 ) ) / 10, 1.0 );
 	if ( vips_resize( in, &t[17], hscale,
 		"vscale", vscale,
 		NULL ) )
@@ -280,19 +477,20 @@ vips_smartcrop_attention( VipsSmartcrop *smartcrop,
 		vips_ifthenelse( t[10], t[13], t[11], &t[16], NULL ) )
 		return( -1 );
 
-	/* Sum, blur and find maxpos.
-	 *
-	 * The amount of blur is related to the size of the crop
-	 * area: how large an area we want to consider for the scoring
-	 * function.
+	/* Sum the features and find the crop-sized window with the highest
+	 * score. A summed-area table makes each window constant time.
 	 */
-
 	if( vips_sum( &t[14], &t[18], 3, NULL ) ||
-		vips_gaussblur( t[18], &t[19], sigma, NULL ) ||
-		vips_max( t[19], &max, "x", &x_pos, "y", &y_pos, NULL ) )
+		vips_cast( t[18], &t[19], VIPS_FORMAT_DOUBLE, NULL ) ||
+		!(t[20] = vips_image_copy_memory( t[19] )) )
 		return( -1 ); 
 
-	/* Centre the crop over the max.
+	if( vips_smartcrop_best_window( t[20], 
+		smartcrop->width * hscale, smartcrop->height * vscale, 
+		&x_pos, &y_pos ) )
+		return( -1 );
+
+	/* Centre the crop over the best window.
 	 */
 	*left = VIPS_CLIP( 0, 
 		x_pos / hscale - smartcrop->width / 2, 
@@ -310,8 +508,9 @@ vips_smartcrop_build( VipsObject *object )
 	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( object );
 	VipsConversion *conversion = VIPS_CONVERSION( object );
 	VipsSmartcrop *smartcrop = (VipsSmartcrop *) object;
-	VipsImage **t = (VipsImage **) vips_object_local_array( object, 2 );
+	VipsImage **t = (VipsImage **) vips_object_local_array( object, 3 );
 
+	VipsImage *source;
 	VipsImage *in;
 	int left;
 	int top;
@@ -327,7 +526,20 @@ vips_smartcrop_build( VipsObject *object )
 		return( -1 );
 	}
 
-	in = smartcrop->in;
+	/* entropy and attention scan @in before we crop it, so render it 
+	 * once first. This happens now, during build, where the search runs
+	 * too, see vips__image_two_pass().
+	 */
+	source = smartcrop->in;
+	if( smartcrop->interesting == VIPS_INTERESTING_ENTROPY ||
+		smartcrop->interesting == VIPS_INTERESTING_ATTENTION ) {
+		if( vips__image_two_pass( source, &t[2] ) )
+			return( -1 );
+		source = t[2];
+	}
+
+	in = source;
+	smartcrop->format = in->BandFmt;
 
 	/* If there's an alpha, we have to premultiply before searching for
 	 * content. There could be stuff in transparent areas which we don't
@@ -383,7 +595,7 @@ vips_smartcrop_build( VipsObject *object )
 		break;
 	}
 
-	if( vips_extract_area( smartcrop->in, &t[1], 
+	if( vips_extract_area( source, &t[1], 
 			left, top, 
 			smartcrop->width, smartcrop->height, NULL ) ||
 		vips_image_write( t[1], conversion->out ) )
@@ -7,6 +7,9 @@
  * 	- max_alpha defaults to 65535 for RGB16/GREY16
  * 24/11/17 lovell
  * 	- match normalised alpha to output type
+ * 18/10/20
+ * 	- add @format, with fixed-point uchar / ushort and a fused 
+ * 	  unpremultiply and cast from float
  */
 
 /*
@@ -49,6 +52,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
+#include <limits.h>
 
 #include <vips/vips.h>
 #include <vips/internal.h>
@@ -63,6 +67,7 @@ typedef struct _VipsUnpremultiply {
 
 	double max_alpha;
 	int alpha_band;
+	VipsBandFormat format;
 
 } VipsUnpremultiply;
 
@@ -136,6 +141,71 @@ G_DEFINE_TYPE( VipsUnpremultiply, vips_unpremultiply, VIPS_TYPE_CONVERSION );
 	} \
 }
 
+/* Unpremultiply a float image and cast to an int type in one pass. This
+ * must match UNPRE_MANY( float, float ) followed by vips_cast(), so float
+ * values are clipped and truncated.
+ */
+#define UNPRE_CAST( OUT, MAX ) { \
+	float * restrict p = (float *) in; \
+	OUT * restrict q = (OUT *) out; \
+	\
+	for( x = 0; x < width; x++ ) { \
+		float alpha = p[alpha_band]; \
+		float clip_alpha = VIPS_CLIP( 0, alpha, max_alpha ); \
+		float nalpha = (float) clip_alpha / max_alpha; \
+		\
+		if( nalpha == 0 ) \
+			for( i = 0; i < alpha_band + 1; i++ ) \
+				q[i] = 0; \
+		else { \
+			for( i = 0; i < alpha_band; i++ ) { \
+				float v = p[i] / nalpha; \
+				\
+				q[i] = VIPS_CLIP( 0, v, MAX ); \
+			} \
+			q[alpha_band] = VIPS_CLIP( 0, clip_alpha, MAX ); \
+		} \
+		\
+		for( i = alpha_band + 1; i < bands; i++ ) \
+			q[i] = VIPS_CLIP( 0, p[i], MAX ); \
+		\
+		p += bands; \
+		q += bands; \
+	} \
+}
+
+/* Fixed-point unpremultiply of a premultiplied uchar or ushort image, 
+ * rounding to nearest. @max_alpha is the maximum of the format. TEMP must
+ * hold MAX * MAX.
+ */
+#define UNPRE_FIXED( TYPE, TEMP, MAX ) { \
+	TYPE * restrict p = (TYPE *) in; \
+	TYPE * restrict q = (TYPE *) out; \
+	\
+	for( x = 0; x < width; x++ ) { \
+		TEMP alpha = p[alpha_band]; \
+		\
+		if( alpha == 0 ) \
+			for( i = 0; i < alpha_band + 1; i++ ) \
+				q[i] = 0; \
+		else { \
+			for( i = 0; i < alpha_band; i++ ) { \
+				TEMP v = (p[i] * (TEMP) MAX + alpha / 2) / \
+					alpha; \
+				\
+				q[i] = VIPS_MIN( v, MAX ); \
+			} \
+			q[alpha_band] = alpha; \
+		} \
+		\
+		for( i = alpha_band + 1; i < bands; i++ ) \
+			q[i] = p[i]; \
+		\
+		p += bands; \
+		q += bands; \
+	} \
+}
+
 static int
 vips_unpremultiply_gen( VipsRegion *or, void *vseq, void *a, void *b,
 	gboolean *stop )
@@ -158,6 +228,30 @@ vips_unpremultiply_gen( VipsRegion *or, void *vseq, void *a, void *b,
 		VipsPel *in = VIPS_REGION_ADDR( ir, r->left, r->top + y ); 
 		VipsPel *out = VIPS_REGION_ADDR( or, r->left, r->top + y ); 
 
+		/* Fused paths, see build.
+		 */
+		if( or->im->BandFmt != VIPS_FORMAT_FLOAT &&
+			or->im->BandFmt != VIPS_FORMAT_DOUBLE ) {
+			if( im->BandFmt == VIPS_FORMAT_FLOAT ) {
+				if( or->im->BandFmt == VIPS_FORMAT_UCHAR ) {
+					UNPRE_CAST( unsigned char, UCHAR_MAX );
+				}
+				else {
+					UNPRE_CAST( unsigned short, USHRT_MAX );
+				}
+			}
+			else if( im->BandFmt == VIPS_FORMAT_UCHAR ) {
+				UNPRE_FIXED( unsigned char, 
+					unsigned int, UCHAR_MAX );
+			}
+			else {
+				UNPRE_FIXED( unsigned short, 
+					unsigned int, USHRT_MAX );
+			}
+
+			continue;
+		}
+
 		switch( im->BandFmt ) { 
 		case VIPS_FORMAT_UCHAR: 
 			UNPRE( unsigned char, float ); 
@@ -208,7 +302,7 @@ vips_unpremultiply_build( VipsObject *object )
 	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( object );
 	VipsConversion *conversion = VIPS_CONVERSION( object );
 	VipsUnpremultiply *unpremultiply = (VipsUnpremultiply *) object;
-	VipsImage **t = (VipsImage **) vips_object_local_array( object, 1 );
+	VipsImage **t = (VipsImage **) vips_object_local_array( object, 3 );
 
 	VipsImage *in;
 
@@ -222,18 +316,21 @@ vips_unpremultiply_build( VipsObject *object )
 		return( -1 );
 	in = t[0]; 
 
-	/* Trivial case: fall back to copy().
+	/* Trivial case: fall back to copy(), or cast().
 	 */
-	if( in->Bands == 1 )
+	if( in->Bands == 1 ) {
+		if( vips_object_argument_isset( object, "format" ) ) {
+			if( vips_cast( in, &t[1], unpremultiply->format, NULL ) )
+				return( -1 );
+			in = t[1];
+		}
+
 		return( vips_image_write( in, conversion->out ) );
+	}
 
 	if( vips_check_noncomplex( class->nickname, in ) )
 		return( -1 );
 
-	if( vips_image_pipelinev( conversion->out, 
-		VIPS_DEMAND_STYLE_THINSTRIP, in, NULL ) )
-		return( -1 );
-
 	/* Is max-alpha unset? Default to the correct value for this
 	 * interpretation.
 	 */
@@ -247,7 +344,49 @@ vips_unpremultiply_build( VipsObject *object )
 	if( !vips_object_argument_isset( object, "alpha_band" ) ) 
 		unpremultiply->alpha_band = in->Bands - 1;
 
-	if( in->BandFmt == VIPS_FORMAT_DOUBLE )
+	if( vips_object_argument_isset( object, "format" ) ) {
+		VipsBandFormat format = unpremultiply->format;
+		double max_alpha = unpremultiply->max_alpha;
+
+		/* We have a fused path for float to uchar / ushort, and a
+		 * fixed-point path for uchar and ushort with the standard
+		 * max_alpha. Anything else is unpremultiply then cast.
+		 *
+		 * UNPRE_RGBA always takes alpha from band 3, so the fused
+		 * path only matches it if that's the alpha band.
+		 */
+		gboolean fused = in->BandFmt == VIPS_FORMAT_FLOAT &&
+			(format == VIPS_FORMAT_UCHAR ||
+			 format == VIPS_FORMAT_USHORT) &&
+			(in->Bands != 4 ||
+			 unpremultiply->alpha_band == 3);
+		gboolean fixed = in->BandFmt == format &&
+			((format == VIPS_FORMAT_UCHAR && 
+			  max_alpha == UCHAR_MAX) ||
+			 (format == VIPS_FORMAT_USHORT && 
+			  max_alpha == USHRT_MAX));
+
+		if( !fused &&
+			!fixed ) {
+			if( vips_unpremultiply( in, &t[1], 
+					"max_alpha", max_alpha,
+					"alpha_band", unpremultiply->alpha_band,
+					NULL ) ||
+				vips_cast( t[1], &t[2], format, NULL ) ||
+				vips_image_write( t[2], conversion->out ) )
+				return( -1 );
+
+			return( 0 );
+		}
+	}
+
+	if( vips_image_pipelinev( conversion->out, 
+		VIPS_DEMAND_STYLE_THINSTRIP, in, NULL ) )
+		return( -1 );
+
+	if( vips_object_argument_isset( object, "format" ) )
+		conversion->out->BandFmt = unpremultiply->format;
+	else if( in->BandFmt == VIPS_FORMAT_DOUBLE )
 		conversion->out->BandFmt = VIPS_FORMAT_DOUBLE;
 	else
 		conversion->out->BandFmt = VIPS_FORMAT_FLOAT;
@@ -298,12 +437,20 @@ vips_unpremultiply_class_init( VipsUnpremultiplyClass *class )
 		G_STRUCT_OFFSET( VipsUnpremultiply, alpha_band ),
 		0, 100000000, 3 );
 
+	VIPS_ARG_ENUM( class, "format", 117, 
+		_( "Format" ), 
+		_( "Format for output" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsUnpremultiply, format ),
+		VIPS_TYPE_BAND_FORMAT, VIPS_FORMAT_FLOAT ); 
+
 }
 
 static void
 vips_unpremultiply_init( VipsUnpremultiply *unpremultiply )
 {
 	unpremultiply->max_alpha = 255.0;
+	unpremultiply->format = VIPS_FORMAT_FLOAT;
 }
 
 /**
@@ -316,6 +463,7 @@ vips_unpremultiply_init( VipsUnpremultiply *unpremultiply )
  *
  * * @max_alpha: %gdouble, maximum value for alpha
  * * @alpha_band: %gint, band containing alpha data
+ * * @format: #VipsBandFormat, format for output
  *
  * Unpremultiplies any alpha channel. 
  * Band @alpha_band (by default the final band) contains the alpha and all 
@@ -338,13 +486,19 @@ vips_unpremultiply_init( VipsUnpremultiply *unpremultiply )
  * #VIPS_FORMAT_FLOAT unless the input format is #VIPS_FORMAT_DOUBLE, in which
  * case the output is double as well.
  *
+ * Set @format to pick the output format. This gives the same result as 
+ * vips_cast() on the output, but float input to uchar or ushort output is
+ * done in one pass. If the input is uchar or ushort, @format is the same and
+ * @max_alpha is the maximum of that format, a fixed-point path is used 
+ * which rounds to nearest. 
+ *
  * @max_alpha has the default value 255, or 65535 for images tagged as
  * #VIPS_INTERPRETATION_RGB16 or
  * #VIPS_INTERPRETATION_GREY16. 
  *
  * Non-complex images only.
  *
- * See also: vips_premultiply(), vips_flatten().
+ * See also: vips_premultiply(), vips_flatten(), vips_cast().
  *
  * Returns: 0 on success, -1 on error
  */
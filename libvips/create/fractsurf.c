@@ -10,6 +10,8 @@
  * 	- gtkdoc
  * 4/1/14
  * 	- redo as a class
+ * 18/10/20
+ * 	- add "seed"
  */
 
 /*
@@ -57,6 +59,7 @@ typedef struct _VipsFractsurf {
 	int width;
 	int height;
 	double fractal_dimension;
+	int seed;
 
 } VipsFractsurf;
 
@@ -74,8 +77,17 @@ vips_fractsurf_build( VipsObject *object )
 	if( VIPS_OBJECT_CLASS( vips_fractsurf_parent_class )->build( object ) )
 		return( -1 );
 
+	/* Pass any seed on, so the surface is reproducible.
+	 */
+	if( !vips_object_argument_isset( object, "seed" ) )
+		fractsurf->seed = g_random_int();
+
 	if( vips_gaussnoise( &t[0], 
-		fractsurf->width, fractsurf->height, 0.0, 1.0, NULL ) || 
+		fractsurf->width, fractsurf->height, 
+		"mean", 0.0, 
+		"sigma", 1.0,
+		"seed", fractsurf->seed,
+		NULL ) || 
 		vips_mask_fractal( &t[1], fractsurf->width, fractsurf->height, 
 			fractsurf->fractal_dimension, NULL ) ||
 		vips_freqmult( t[0], t[1], &t[2], NULL ) ||
@@ -119,6 +131,13 @@ vips_fractsurf_class_init( VipsFractsurfClass *class )
 		G_STRUCT_OFFSET( VipsFractsurf, fractal_dimension ),
 		2.0, 3.0, 2.5 );
 
+	VIPS_ARG_INT( class, "seed", 9, 
+		_( "Seed" ), 
+		_( "Random number seed" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsFractsurf, seed ),
+		INT_MIN, INT_MAX, 0 );
+
 }
 
 static void
@@ -137,9 +156,15 @@ vips_fractsurf_init( VipsFractsurf *fractsurf )
  * @fractal_dimension: fractal dimension
  * @...: %NULL-terminated list of optional named arguments
  *
+ * Optional arguments:
+ *
+ * * @seed: %gint, random number seed
+ *
  * Generate an image of size @width by @height and fractal dimension 
  * @fractal_dimension. The dimension should be between 2 and 3.
  *
+ * Set @seed to make the output reproducible between runs. 
+ *
  * See also: vips_gaussnoise(), vips_mask_fractal().
  *
  * Returns: 0 on success, -1 on error
@@ -1,6 +1,9 @@
 /* Perlin noise generator.
  *
  * 24/7/16
+ * 18/10/20
+ * 	- add "seed"
+ * 	- generate a cell-width span at a time
  */
 
 /*
@@ -61,7 +64,7 @@ typedef struct _VipsPerlin {
 
 	/* Use this to seed this call of our rng.
 	 */
-	guint32 seed;
+	int seed;
 } VipsPerlin;
 
 typedef struct _VipsPerlinClass {
@@ -170,6 +173,31 @@ smootherstep( float x )
     return( x * x * x * (x * (x * 6 - 15) + 10) );
 }
 
+/* Compute a span of pixels within one cell.
+ */
+#define PERLIN_SPAN( OUT ) { \
+	for( ; x < x_end; x++ ) { \
+		float dx = (x + r->left - cell_x * cs) * scale; \
+		float sx = smootherstep( dx ); \
+		\
+		float n0, n1; \
+		float ix0, ix1; \
+		float p; \
+		\
+		n0 = -dx * gx0 + a0; \
+		n1 = (1 - dx) * gx1 + a1; \
+		ix0 = n0 + sx * (n1 - n0); \
+		\
+		n0 = -dx * gx2 + a2; \
+		n1 = (1 - dx) * gx3 + a3; \
+		ix1 = n0 + sx * (n1 - n0); \
+		\
+		p = ix0 + sy * (ix1 - ix0); \
+		\
+		OUT; \
+	} \
+}
+
 static int
 vips_perlin_gen( VipsRegion *or, void *vseq, void *a, void *b,
 	gboolean *stop )
@@ -177,6 +205,8 @@ vips_perlin_gen( VipsRegion *or, void *vseq, void *a, void *b,
 	VipsPerlin *perlin = (VipsPerlin *) a;
 	VipsRect *r = &or->valid;
 	Sequence *seq = (Sequence *) vseq;
+	int cs = perlin->cell_size;
+	float scale = 1.0 / cs;
 
 	int x, y;
 
@@ -184,19 +214,21 @@ vips_perlin_gen( VipsRegion *or, void *vseq, void *a, void *b,
 		float *fq = (float *) 
 			VIPS_REGION_ADDR( or, r->left, r->top + y );
 		VipsPel *q = (VipsPel *) fq;
-
-		for( x = 0; x < r->width; x++ ) {
-			int cs = perlin->cell_size;
+		int cell_y = (r->top + y) / cs;
+		float dy = (y + r->top - cell_y * cs) * scale;
+		float sy = smootherstep( dy );
+
+		/* Work along the line a cell at a time. Within a span, the
+		 * gradients and all the y terms are fixed, so the inner loops 
+		 * are straight-line float arithmetic.
+		 */
+		for( x = 0; x < r->width; ) {
 			int cell_x = (r->left + x) / cs;
-			int cell_y = (r->top + y) / cs;
-			float dx = (x + r->left - cell_x * cs) / (float) cs;
-			float dy = (y + r->top - cell_y * cs) / (float) cs;
-			float sx = smootherstep( dx );
-			float sy = smootherstep( dy );
+			int x_end = VIPS_MIN( r->width, 
+				(cell_x + 1) * cs - r->left );
 
-			float n0, n1;
-			float ix0, ix1;
-			float p;
+			float a0, a1, a2, a3;
+			float gx0, gx1, gx2, gx3;
 
 			if( cell_x != seq->cell_x ||
 				cell_y != seq->cell_y ) {
@@ -206,20 +238,19 @@ vips_perlin_gen( VipsRegion *or, void *vseq, void *a, void *b,
 				seq->cell_y = cell_y;
 			}
 
-			n0 = -dx * seq->gx[0] + -dy * seq->gy[0];
-			n1 = (1 - dx) * seq->gx[1] + -dy * seq->gy[1];
-			ix0 = n0 + sx * (n1 - n0);
-
-			n0 = -dx * seq->gx[2] + (1 - dy) * seq->gy[2];
-			n1 = (1 - dx) * seq->gx[3] + (1 - dy) * seq->gy[3];
-			ix1 = n0 + sx * (n1 - n0);
-
-			p = ix0 + sy * (ix1 - ix0);
+			gx0 = seq->gx[0];
+			gx1 = seq->gx[1];
+			gx2 = seq->gx[2];
+			gx3 = seq->gx[3];
+			a0 = -dy * seq->gy[0];
+			a1 = -dy * seq->gy[1];
+			a2 = (1 - dy) * seq->gy[2];
+			a3 = (1 - dy) * seq->gy[3];
 
 			if( perlin->uchar )
-				q[x] = 128 * p + 128;
+				PERLIN_SPAN( q[x] = 128 * p + 128 )
 			else
-				fq[x] = p;
+				PERLIN_SPAN( fq[x] = p )
 		}
 	}
 
@@ -244,7 +275,8 @@ vips_perlin_build( VipsObject *object )
 		VIPS_ROUND_UP( perlin->height, perlin->cell_size ) / 
 		perlin->cell_size;
 
-	perlin->seed = g_random_double() * 0xffffffffu;
+	if( !vips_object_argument_isset( object, "seed" ) )
+		perlin->seed = g_random_int();
 
 	vips_image_init_fields( create->out,
 		perlin->width, perlin->height, 1,
@@ -321,6 +353,13 @@ vips_perlin_class_init( VipsPerlinClass *class )
 		G_STRUCT_OFFSET( VipsPerlin, uchar ),
 		FALSE );
 
+	VIPS_ARG_INT( class, "seed", 5, 
+		_( "Seed" ), 
+		_( "Random number seed" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsPerlin, seed ),
+		INT_MIN, INT_MAX, 0 );
+
 }
 
 static void
@@ -340,6 +379,7 @@ vips_perlin_init( VipsPerlin *perlin )
  *
  * * @cell_size: %gint, size of Perlin cells
  * * @uchar: output a uchar image
+ * * @seed: %gint, random number seed
  *
  * Create a one-band float image of Perlin noise. See:
  *
@@ -353,6 +393,8 @@ vips_perlin_init( VipsPerlin *perlin )
  * Normally, output pixels are #VIPS_FORMAT_FLOAT in the range [-1, +1]. Set 
  * @uchar to output a uchar image with pixels in [0, 255]. 
  *
+ * Set @seed to make the output reproducible between runs. 
+ *
  * See also: vips_worley(), vips_fractsurf(), vips_gaussnoise().
  *
  * Returns: 0 on success, -1 on error
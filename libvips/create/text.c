@@ -32,6 +32,8 @@
  * 	- fitting could occasionally terminate early [levmorozov]
  * 16/5/20 [keiviv]
  * 	- don't add fontfiles repeatedly
+ * 18/10/20
+ * 	- use a pool of font maps rather than single-threading through one
  */
 
 /*
@@ -96,6 +98,7 @@ typedef struct _VipsText {
 	char *fontfile;
 
 	FT_Bitmap bitmap;
+	PangoFontMap *fontmap;
 	PangoContext *context;
 	PangoLayout *layout;
 
@@ -105,17 +108,19 @@ typedef VipsCreateClass VipsTextClass;
 
 G_DEFINE_TYPE( VipsText, vips_text, VIPS_TYPE_CREATE );
 
-/* ... single-thread the body of vips_text() with this.
+/* Protect the font map pool and the set of loaded fontfiles.
  */
 static GMutex *vips_text_lock = NULL; 
 
-/* Just have one of these and reuse it.
+/* Idle font maps. 
  *
- * This does not unref cleanly on many platforms, so we will leak horribly
- * unless we reuse it. Sadly this means vips_text() needs to use a lock 
- * internally to single-thread text rendering.
+ * Font maps are not threadsafe, and they do not unref cleanly on many 
+ * platforms, so we will leak horribly unless we reuse them. Each vips_text()
+ * takes a font map from this pool, or makes a new one if the pool is empty,
+ * and returns it when it's done. The pool only grows to the number of
+ * concurrent calls, and text rendering can run in parallel.
  */
-static PangoFontMap *vips_text_fontmap = NULL;
+static GSList *vips_text_fontmaps = NULL;
 
 /* All the fontfiles we've loaded. fontconfig lets you add a fontfile
  * repeatedly, and we obviously don't want that.
@@ -134,6 +139,36 @@ vips_text_dispose( GObject *gobject )
 	G_OBJECT_CLASS( vips_text_parent_class )->dispose( gobject );
 }
 
+static PangoFontMap *
+vips_text_fontmap_get( void )
+{
+	PangoFontMap *fontmap;
+
+	g_mutex_lock( vips_text_lock ); 
+
+	if( vips_text_fontmaps ) {
+		fontmap = (PangoFontMap *) vips_text_fontmaps->data;
+		vips_text_fontmaps = g_slist_delete_link( vips_text_fontmaps, 
+			vips_text_fontmaps );
+	}
+	else
+		fontmap = pango_ft2_font_map_new();
+
+	g_mutex_unlock( vips_text_lock ); 
+
+	return( fontmap );
+}
+
+static void
+vips_text_fontmap_put( PangoFontMap *fontmap )
+{
+	g_mutex_lock( vips_text_lock ); 
+
+	vips_text_fontmaps = g_slist_prepend( vips_text_fontmaps, fontmap );
+
+	g_mutex_unlock( vips_text_lock ); 
+}
+
 static PangoLayout *
 text_layout_new( PangoContext *context, 
 	const char *text, const char *font, int width, int spacing,
@@ -187,7 +222,7 @@ vips_text_get_extents( VipsText *text, VipsRect *extents )
 	PangoRectangle logical_rect;
 
 	pango_ft2_font_map_set_resolution( 
-		PANGO_FT2_FONT_MAP( vips_text_fontmap ), text->dpi, text->dpi );
+		PANGO_FT2_FONT_MAP( text->fontmap ), text->dpi, text->dpi );
 
 	VIPS_UNREF( text->layout );
 	if( !(text->layout = text_layout_new( text->context, 
@@ -334,38 +369,20 @@ vips_text_autofit( VipsText *text )
 	return( 0 ); 
 }
 
+/* Load a fontfile, if we've not loaded it before.
+ */
 static int
-vips_text_build( VipsObject *object )
+vips_text_add_fontfile( VipsText *text )
 {
-	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( object );
-	VipsCreate *create = VIPS_CREATE( object );
-	VipsText *text = (VipsText *) object;
-
-	VipsRect extents;
-	int y;
-
-	if( VIPS_OBJECT_CLASS( vips_text_parent_class )->build( object ) )
-		return( -1 );
-
-	if( !pango_parse_markup( text->text, -1, 0, NULL, NULL, NULL, NULL ) ) {
-		vips_error( class->nickname, 
-			"%s", _( "invalid markup in text" ) );
-		return( -1 );
-	}
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( text );
 
 	g_mutex_lock( vips_text_lock ); 
 
-	if( !vips_text_fontmap )
-		vips_text_fontmap = pango_ft2_font_map_new();
 	if( !vips_text_fontfiles )
 		vips_text_fontfiles = 
 			g_hash_table_new( g_str_hash, g_str_equal );
 
-	text->context = pango_font_map_create_context( 
-		PANGO_FONT_MAP( vips_text_fontmap ) );
-
-	if( text->fontfile &&
-		!g_hash_table_lookup( vips_text_fontfiles, text->fontfile ) ) {
+	if( !g_hash_table_lookup( vips_text_fontfiles, text->fontfile ) ) {
 		if( !FcConfigAppFontAddFile( NULL, 
 			(const FcChar8 *) text->fontfile ) ) {
 			vips_error( class->nickname, 
@@ -379,6 +396,21 @@ vips_text_build( VipsObject *object )
 			g_strdup( text->fontfile ) );
 	}
 
+	g_mutex_unlock( vips_text_lock ); 
+
+	return( 0 );
+}
+
+/* Fit, lay out and render to text->bitmap. We must have a font map.
+ */
+static int
+vips_text_render( VipsText *text, VipsRect *extents )
+{
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( text );
+	VipsObject *object = VIPS_OBJECT( text );
+
+	text->context = pango_font_map_create_context( text->fontmap );
+
 	/* If our caller set height and not dpi, we adjust dpi until 
 	 * we get a fit.
 	 */
@@ -390,33 +422,70 @@ vips_text_build( VipsObject *object )
 
 	/* Layout. Can fail for "", for example.
 	 */
-	if( vips_text_get_extents( text, &extents ) )
+	if( vips_text_get_extents( text, extents ) )
 		return( -1 );
-	if( extents.width == 0 || 
-		extents.height == 0 ) {
+	if( extents->width == 0 || 
+		extents->height == 0 ) {
 		vips_error( class->nickname, "%s", _( "no text to render" ) );
-		g_mutex_unlock( vips_text_lock ); 
 		return( -1 );
 	}
 
-	text->bitmap.width = extents.width;
+	text->bitmap.width = extents->width;
 	text->bitmap.pitch = (text->bitmap.width + 3) & ~3;
-	text->bitmap.rows = extents.height;
+	text->bitmap.rows = extents->height;
 	if( !(text->bitmap.buffer = 
 		VIPS_ARRAY( NULL, 
-			text->bitmap.pitch * text->bitmap.rows, VipsPel )) ) {
-		g_mutex_unlock( vips_text_lock ); 
+			text->bitmap.pitch * text->bitmap.rows, VipsPel )) ) 
 		return( -1 );
-	}
 	text->bitmap.num_grays = 256;
 	text->bitmap.pixel_mode = ft_pixel_mode_grays;
 	memset( text->bitmap.buffer, 0x00, 
 		text->bitmap.pitch * text->bitmap.rows );
 
 	pango_ft2_render_layout( &text->bitmap, text->layout, 
-		-extents.left, -extents.top );
+		-extents->left, -extents->top );
 
-	g_mutex_unlock( vips_text_lock ); 
+	return( 0 );
+}
+
+static int
+vips_text_build( VipsObject *object )
+{
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( object );
+	VipsCreate *create = VIPS_CREATE( object );
+	VipsText *text = (VipsText *) object;
+
+	VipsRect extents;
+	int result;
+	int y;
+
+	if( VIPS_OBJECT_CLASS( vips_text_parent_class )->build( object ) )
+		return( -1 );
+
+	if( !pango_parse_markup( text->text, -1, 0, NULL, NULL, NULL, NULL ) ) {
+		vips_error( class->nickname, 
+			"%s", _( "invalid markup in text" ) );
+		return( -1 );
+	}
+
+	if( text->fontfile &&
+		vips_text_add_fontfile( text ) )
+		return( -1 );
+
+	/* We have this font map to ourselves until we put it back, so 
+	 * there's no need to lock during render. 
+	 *
+	 * Repeated calls with the same arguments, for example a watermark, 
+	 * are found in the operation cache and skip this completely.
+	 */
+	text->fontmap = vips_text_fontmap_get();
+	result = vips_text_render( text, &extents );
+	VIPS_UNREF( text->layout ); 
+	VIPS_UNREF( text->context ); 
+	vips_text_fontmap_put( text->fontmap );
+	text->fontmap = NULL;
+	if( result )
+		return( -1 );
 
 	vips_image_init_fields( create->out,
 		text->bitmap.width, text->bitmap.rows, 1, 
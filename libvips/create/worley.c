@@ -4,6 +4,9 @@
  *
  * 11/8/16
  * 	- float output
+ * 18/10/20
+ * 	- add "seed"
+ * 	- search on squared distance, one sqrt per pixel
  */
 
 /*
@@ -63,7 +66,7 @@ typedef struct _VipsWorley {
 
 	/* Use this to seed this call of our rng.
 	 */
-	guint32 seed;
+	int seed;
 } VipsWorley;
 
 typedef struct _VipsWorleyClass {
@@ -194,14 +197,6 @@ vips_worley_start( VipsImage *out, void *a, void *b )
 	return( seq );
 }
 
-static float
-vips_hypot( int x, int y )
-{
-	/* Faster than hypot() for int args.
-	 */
-	return( sqrt( x * x + y * y ) );
-}
-
 static float
 vips_worley_distance( VipsWorley *worley, Cell cells[9], int x, int y )
 {
@@ -209,21 +204,24 @@ vips_worley_distance( VipsWorley *worley, Cell cells[9], int x, int y )
 
 	int i, j;
 
+	/* Search on squared distance and take a single sqrt at the end.
+	 */
 	distance = worley->cell_size * 1.5;
+	distance *= distance;
 
 	for( i = 0; i < 9; i++ ) {
 		Cell *cell = &cells[i];
 
 		for( j = 0; j < cell->n_features; j++ ) {
-			float d = vips_hypot( 
-				x - cell->feature_x[j], 
-				y - cell->feature_y[j] );
+			float dx = x - cell->feature_x[j];
+			float dy = y - cell->feature_y[j];
+			float d = dx * dx + dy * dy;
 
 			distance = VIPS_MIN( distance, d );
 		}
 	}
 
-	return( distance );
+	return( sqrt( distance ) );
 }
 
 static int
@@ -277,7 +275,8 @@ vips_worley_build( VipsObject *object )
 		VIPS_ROUND_UP( worley->height, worley->cell_size ) / 
 		worley->cell_size;
 
-	worley->seed = g_random_double() * 0xffffffffu;
+	if( !vips_object_argument_isset( object, "seed" ) )
+		worley->seed = g_random_int();
 
 	vips_image_init_fields( create->out,
 		worley->width, worley->height, 1,
@@ -328,6 +327,13 @@ vips_worley_class_init( VipsWorleyClass *class )
 		G_STRUCT_OFFSET( VipsWorley, cell_size ),
 		1, VIPS_MAX_COORD, 256 );
 
+	VIPS_ARG_INT( class, "seed", 4, 
+		_( "Seed" ), 
+		_( "Random number seed" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsWorley, seed ),
+		INT_MIN, INT_MAX, 0 );
+
 }
 
 static void
@@ -346,6 +352,7 @@ vips_worley_init( VipsWorley *worley )
  * Optional arguments:
  *
  * * @cell_size: %gint, size of Worley cells
+ * * @seed: %gint, random number seed
  *
  * Create a one-band float image of Worley noise. See:
  *
@@ -356,6 +363,8 @@ vips_worley_init( VipsWorley *worley )
  *
  * If @width and @height are multiples of @cell_size, the image will tessellate.
  *
+ * Set @seed to make the output reproducible between runs. 
+ *
  * See also: vips_perlin(), vips_fractsurf(), vips_gaussnoise().
  *
  * Returns: 0 on success, -1 on error
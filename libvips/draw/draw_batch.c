@@ -0,0 +1,510 @@
+/* draw many rects, lines and circles in a single operation
+ *
+ * 18/10/20
+ * 	- from draw_rect.c, draw_line.c and draw_circle.c
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vips/vips.h>
+#include <vips/internal.h>
+
+#include "drawink.h"
+
+typedef struct _VipsDrawBatch {
+	VipsDrawink parent_object;
+
+	/* Parameters.
+	 */
+	VipsArrayInt *rects;
+	VipsArrayInt *lines;
+	VipsArrayInt *circles;
+	gboolean fill;
+
+} VipsDrawBatch;
+
+typedef struct _VipsDrawBatchClass {
+	VipsDrawinkClass parent_class;
+
+} VipsDrawBatchClass;
+
+G_DEFINE_TYPE( VipsDrawBatch, vips_draw_batch, VIPS_TYPE_DRAWINK );
+
+typedef enum {
+	VIPS_DRAW_BATCH_RECT,
+	VIPS_DRAW_BATCH_LINE,
+	VIPS_DRAW_BATCH_CIRCLE
+} VipsDrawBatchType;
+
+/* One primitive, pointing into one of the argument arrays.
+ */
+typedef struct _VipsDrawBatchItem {
+	VipsDrawBatchType type;
+
+	/* The first line this item touches. We paint in this order.
+	 */
+	int top;
+
+	int *args;
+} VipsDrawBatchItem;
+
+static int
+vips_draw_batch_item_compare( const void *a, const void *b )
+{
+	const VipsDrawBatchItem *i1 = (const VipsDrawBatchItem *) a;
+	const VipsDrawBatchItem *i2 = (const VipsDrawBatchItem *) b;
+
+	if( i1->top < i2->top )
+		return( -1 );
+	else if( i1->top > i2->top )
+		return( 1 );
+	else
+		return( 0 );
+}
+
+/* Fill a rect, with clip.
+ */
+static void
+vips_draw_batch_fill( VipsDraw *draw, VipsPel *ink,
+	int left, int top, int width, int height )
+{
+	VipsRect image;
+	VipsRect rect;
+	VipsRect clip;
+
+	image.left = 0;
+	image.top = 0;
+	image.width = draw->image->Xsize;
+	image.height = draw->image->Ysize;
+	rect.left = left;
+	rect.top = top;
+	rect.width = width;
+	rect.height = height;
+	vips_rect_intersectrect( &rect, &image, &clip );
+
+	if( !vips_rect_isempty( &clip ) ) {
+		VipsPel *to =
+			VIPS_IMAGE_ADDR( draw->image, clip.left, clip.top );
+
+		VipsPel *q;
+		int x, y, j;
+
+		/* We plot the first line pointwise, then memcpy() it for the
+		 * subsequent lines.
+		 */
+		q = to;
+		for( x = 0; x < clip.width; x++ ) {
+			for( j = 0; j < draw->psize; j++ )
+				q[j] = ink[j];
+			q += draw->psize;
+		}
+
+		q = to + draw->lsize;
+		for( y = 1; y < clip.height; y++ ) {
+			memcpy( q, to, clip.width * draw->psize );
+			q += draw->lsize;
+		}
+	}
+}
+
+static void
+vips_draw_batch_rect( VipsDraw *draw, VipsPel *ink, gboolean fill,
+	int left, int top, int width, int height )
+{
+	/* Also use a solid fill for very narrow unfilled rects.
+	 */
+	if( !fill &&
+		width > 2 &&
+		height > 2 ) {
+		vips_draw_batch_fill( draw, ink,
+			left, top, width, 1 );
+		vips_draw_batch_fill( draw, ink,
+			left + width - 1, top, 1, height );
+		vips_draw_batch_fill( draw, ink,
+			left, top + height - 1, width, 1 );
+		vips_draw_batch_fill( draw, ink,
+			left, top, 1, height );
+	}
+	else
+		vips_draw_batch_fill( draw, ink, left, top, width, height );
+}
+
+static void
+vips_draw_batch_point( VipsImage *image, int x, int y, void *client )
+{
+	VipsPel *ink = (VipsPel *) client;
+	int psize = VIPS_IMAGE_SIZEOF_PEL( image );
+
+	VipsPel *q;
+	int j;
+
+	if( x < 0 ||
+		x >= image->Xsize ||
+		y < 0 ||
+		y >= image->Ysize )
+		return;
+
+	q = VIPS_IMAGE_ADDR( image, x, y );
+	for( j = 0; j < psize; j++ )
+		q[j] = ink[j];
+}
+
+static void
+vips_draw_batch_endpoints( VipsImage *image,
+	int y, int x1, int x2, int quadrant, void *client )
+{
+	vips_draw_batch_point( image, x1, y, client );
+	vips_draw_batch_point( image, x2, y, client );
+}
+
+static void
+vips_draw_batch_scanline( VipsImage *image,
+	int y, int x1, int x2, int quadrant, void *client )
+{
+	VipsPel *ink = (VipsPel *) client;
+	int psize = VIPS_IMAGE_SIZEOF_PEL( image );
+
+	VipsPel *q;
+	int len;
+	int i, j;
+
+	g_assert( x1 <= x2 );
+
+	if( y < 0 ||
+		y >= image->Ysize )
+		return;
+	if( x1 < 0 &&
+		x2 < 0 )
+		return;
+	if( x1 >= image->Xsize &&
+		x2 >= image->Xsize )
+		return;
+	x1 = VIPS_CLIP( 0, x1, image->Xsize - 1 );
+	x2 = VIPS_CLIP( 0, x2, image->Xsize - 1 );
+
+	q = VIPS_IMAGE_ADDR( image, x1, y );
+	len = x2 - x1 + 1;
+
+	for( i = 0; i < len; i++ ) {
+		for( j = 0; j < psize; j++ )
+			q[j] = ink[j];
+
+		q += psize;
+	}
+}
+
+/* Check an argument array has a multiple of @size elements.
+ */
+static int
+vips_draw_batch_check( VipsDrawBatch *batch, const char *name,
+	VipsArrayInt *array, int size )
+{
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( batch );
+
+	if( array &&
+		VIPS_AREA( array )->n % size != 0 ) {
+		vips_error( class->nickname,
+			_( "%s must have a multiple of %d elements" ),
+			name, size );
+		return( -1 );
+	}
+
+	return( 0 );
+}
+
+/* Add all the primitives in an array to our list of items.
+ */
+static void
+vips_draw_batch_add( VipsDrawBatchItem *items, int *n_items,
+	VipsDrawBatchType type, VipsArrayInt *array, int size )
+{
+	int *args;
+	int n;
+	int i;
+
+	if( !array )
+		return;
+
+	args = vips_array_int_get( array, &n );
+	for( i = 0; i < n; i += size ) {
+		VipsDrawBatchItem *item = &items[*n_items];
+
+		item->type = type;
+		item->args = args + i;
+
+		switch( type ) {
+		case VIPS_DRAW_BATCH_RECT:
+			item->top = args[i + 1];
+			break;
+
+		case VIPS_DRAW_BATCH_LINE:
+			item->top = VIPS_MIN( args[i + 1], args[i + 3] );
+			break;
+
+		case VIPS_DRAW_BATCH_CIRCLE:
+			item->top = args[i + 1] - args[i + 2];
+			break;
+
+		default:
+			g_assert_not_reached();
+		}
+
+		*n_items += 1;
+	}
+}
+
+static int
+vips_draw_batch_build( VipsObject *object )
+{
+	VipsDraw *draw = VIPS_DRAW( object );
+	VipsDrawink *drawink = VIPS_DRAWINK( object );
+	VipsDrawBatch *batch = (VipsDrawBatch *) object;
+	VipsPel *ink = drawink->pixel_ink;
+
+	int n_items;
+	VipsDrawBatchItem *items;
+	int i;
+
+	if( VIPS_OBJECT_CLASS( vips_draw_batch_parent_class )->build( object ) )
+		return( -1 );
+
+	if( vips_draw_batch_check( batch, "rects", batch->rects, 4 ) ||
+		vips_draw_batch_check( batch, "lines", batch->lines, 4 ) ||
+		vips_draw_batch_check( batch, "circles", batch->circles, 3 ) )
+		return( -1 );
+
+	n_items = 0;
+	if( batch->rects )
+		n_items += VIPS_AREA( batch->rects )->n / 4;
+	if( batch->lines )
+		n_items += VIPS_AREA( batch->lines )->n / 4;
+	if( batch->circles )
+		n_items += VIPS_AREA( batch->circles )->n / 3;
+	if( n_items == 0 )
+		return( 0 );
+
+	if( !(items = VIPS_ARRAY( object, n_items, VipsDrawBatchItem )) )
+		return( -1 );
+	n_items = 0;
+	vips_draw_batch_add( items, &n_items,
+		VIPS_DRAW_BATCH_RECT, batch->rects, 4 );
+	vips_draw_batch_add( items, &n_items,
+		VIPS_DRAW_BATCH_LINE, batch->lines, 4 );
+	vips_draw_batch_add( items, &n_items,
+		VIPS_DRAW_BATCH_CIRCLE, batch->circles, 3 );
+
+	/* Paint top to bottom, so we move down the image in order rather
+	 * than jumping about. There's only one ink, so order can't change the
+	 * result.
+	 */
+	qsort( items, n_items, sizeof( VipsDrawBatchItem ),
+		vips_draw_batch_item_compare );
+
+	for( i = 0; i < n_items; i++ ) {
+		int *args = items[i].args;
+
+		switch( items[i].type ) {
+		case VIPS_DRAW_BATCH_RECT:
+			vips_draw_batch_rect( draw, ink, batch->fill,
+				args[0], args[1], args[2], args[3] );
+			break;
+
+		case VIPS_DRAW_BATCH_LINE:
+			vips__draw_line_direct( draw->image,
+				args[0], args[1], args[2], args[3],
+				vips_draw_batch_point, ink );
+			break;
+
+		case VIPS_DRAW_BATCH_CIRCLE:
+			if( args[2] < 0 )
+				break;
+
+			vips__draw_circle_direct( draw->image,
+				args[0], args[1], args[2],
+				batch->fill ?
+					vips_draw_batch_scanline :
+					vips_draw_batch_endpoints,
+				ink );
+			break;
+
+		default:
+			g_assert_not_reached();
+		}
+	}
+
+	return( 0 );
+}
+
+static void
+vips_draw_batch_class_init( VipsDrawBatchClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *vobject_class = VIPS_OBJECT_CLASS( class );
+
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	vobject_class->nickname = "draw_batch";
+	vobject_class->description =
+		_( "draw many rects, lines and circles on an image" );
+	vobject_class->build = vips_draw_batch_build;
+
+	VIPS_ARG_BOXED( class, "rects", 6,
+		_( "Rects" ),
+		_( "Array of left, top, width, height for each rect" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsDrawBatch, rects ),
+		VIPS_TYPE_ARRAY_INT );
+
+	VIPS_ARG_BOXED( class, "lines", 7,
+		_( "Lines" ),
+		_( "Array of x1, y1, x2, y2 for each line" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsDrawBatch, lines ),
+		VIPS_TYPE_ARRAY_INT );
+
+	VIPS_ARG_BOXED( class, "circles", 8,
+		_( "Circles" ),
+		_( "Array of cx, cy, radius for each circle" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsDrawBatch, circles ),
+		VIPS_TYPE_ARRAY_INT );
+
+	VIPS_ARG_BOOL( class, "fill", 9,
+		_( "Fill" ),
+		_( "Draw solid objects" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsDrawBatch, fill ),
+		FALSE );
+
+}
+
+static void
+vips_draw_batch_init( VipsDrawBatch *batch )
+{
+}
+
+static int
+vips_draw_batchv( VipsImage *image, double *ink, int n, va_list ap )
+{
+	VipsArea *area_ink;
+	int result;
+
+	area_ink = VIPS_AREA( vips_array_double_new( ink, n ) );
+	result = vips_call_split( "draw_batch", ap, image, area_ink );
+	vips_area_unref( area_ink );
+
+	return( result );
+}
+
+/**
+ * vips_draw_batch: (method)
+ * @image: image to draw on
+ * @ink: (array length=n): value to draw
+ * @n: length of ink array
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Optional arguments:
+ *
+ * * @rects: #VipsArrayInt, left, top, width, height for each rect
+ * * @lines: #VipsArrayInt, x1, y1, x2, y2 for each line
+ * * @circles: #VipsArrayInt, cx, cy, radius for each circle
+ * * @fill: fill rects and circles
+ *
+ * Draw many rects, lines and circles on @image with @ink in a single
+ * operation. This is much faster than calling vips_draw_rect(),
+ * vips_draw_line() and vips_draw_circle() once for each primitive, since
+ * argument handling and ink conversion only happen once.
+ *
+ * Every primitive is drawn with the same @ink, so the result is the same as 
+ * drawing them one at a time, in any order. They are drawn sorted by their 
+ * top edge, so a large batch moves down @image in order rather than 
+ * jumping about.
+ *
+ * If @fill is zero, rects and circles are drawn as 1-pixel-wide outlines.
+ *
+ * See also: vips_draw_rect(), vips_draw_line(), vips_draw_circle().
+ *
+ * Returns: 0 on success, or -1 on error.
+ */
+int
+vips_draw_batch( VipsImage *image, double *ink, int n, ... )
+{
+	va_list ap;
+	int result;
+
+	va_start( ap, n );
+	result = vips_draw_batchv( image, ink, n, ap );
+	va_end( ap );
+
+	return( result );
+}
+
+/**
+ * vips_draw_batch1: (method)
+ * @image: image to draw on
+ * @ink: value to draw
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Optional arguments:
+ *
+ * * @rects: #VipsArrayInt, left, top, width, height for each rect
+ * * @lines: #VipsArrayInt, x1, y1, x2, y2 for each line
+ * * @circles: #VipsArrayInt, cx, cy, radius for each circle
+ * * @fill: fill rects and circles
+ *
+ * As vips_draw_batch(), but just take a single double for @ink.
+ *
+ * See also: vips_draw_batch().
+ *
+ * Returns: 0 on success, or -1 on error.
+ */
+int
+vips_draw_batch1( VipsImage *image, double ink, ... )
+{
+	double array_ink[1];
+	va_list ap;
+	int result;
+
+	array_ink[0] = ink;
+
+	va_start( ap, ink );
+	result = vips_draw_batchv( image, array_ink, 1, ap );
+	va_end( ap );
+
+	return( result );
+}
@@ -419,8 +419,12 @@ vips_foreign_map( const char *base, VipsSListMap2Fn fn, void *a, void *b )
 	GSList *files;
 	void *result;
 
+	/* We only need the file formats.
+	 */
+	vips__init_package( "foreign" );
+
 	files = NULL;
-	(void) vips_class_map_all( g_type_from_name( base ), 
+	(void) vips__class_map_registered( g_type_from_name( base ), 
 		(VipsClassMapFn) file_add_class, (void *) &files );
 
 	files = g_slist_sort( files, (GCompareFunc) file_compare );
@@ -2135,6 +2139,9 @@ vips_foreign_operation_init( void )
 	extern GType vips_foreign_load_gif_file_get_type( void ); 
 	extern GType vips_foreign_load_gif_buffer_get_type( void ); 
 	extern GType vips_foreign_load_gif_source_get_type( void ); 
+	extern GType vips_foreign_save_gif_file_get_type( void ); 
+	extern GType vips_foreign_save_gif_buffer_get_type( void ); 
+	extern GType vips_foreign_save_gif_target_get_type( void ); 
 
 	vips_foreign_load_csv_file_get_type(); 
 	vips_foreign_load_csv_source_get_type(); 
@@ -2192,6 +2199,12 @@ vips_foreign_operation_init( void )
 	vips_foreign_load_gif_source_get_type(); 
 #endif /*HAVE_GIFLIB*/
 
+#if defined(HAVE_GIFLIB) && defined(HAVE_IMAGEQUANT)
+	vips_foreign_save_gif_file_get_type(); 
+	vips_foreign_save_gif_buffer_get_type(); 
+	vips_foreign_save_gif_target_get_type(); 
+#endif /*defined(HAVE_GIFLIB) && defined(HAVE_IMAGEQUANT)*/
+
 #ifdef HAVE_GSF
 	vips_foreign_save_dz_file_get_type(); 
 	vips_foreign_save_dz_buffer_get_type(); 
@@ -39,6 +39,11 @@
  * 	- add gifload_source
  * 5/2/20 alon-ne
  * 	- fix DISPOSE_BACKGROUND and DISPOSE_PREVIOUS
+ * 18/10/20
+ * 	- build a frame index during header scan and seek to the nearest
+ * 	  restart point, rather than decoding every earlier frame
+ * 	- keep keyframe snapshots once we see out of order page requests
+ * 	- limit keyframe memory by canvas size
  */
 
 /*
@@ -119,6 +124,17 @@
 #define DISPOSE_MASK              0x07
 #define DISPOSE_SHIFT             2
 
+/* Once we see out of order page requests, we keep a snapshot of the render
+ * state every few pages. There are at most this many, spaced at least
+ * GIF_KEYFRAME_INTERVAL pages apart.
+ *
+ * Each keyframe is two canvases, so we also limit the total size. 
+ * Keyframes are memory images, so they show up in vips_tracked_get_mem().
+ */
+#define GIF_MAX_KEYFRAMES         8
+#define GIF_KEYFRAME_INTERVAL     16
+#define GIF_KEYFRAME_MAX_MEMORY   (64 * 1024 * 1024)
+
 #define VIPS_TYPE_FOREIGN_LOAD_GIF (vips_foreign_load_gif_get_type())
 #define VIPS_FOREIGN_LOAD_GIF( obj ) \
 	(G_TYPE_CHECK_INSTANCE_CAST( (obj), \
@@ -130,6 +146,26 @@
 	(G_TYPE_INSTANCE_GET_CLASS( (obj), \
 	VIPS_TYPE_FOREIGN_LOAD_GIF, VipsForeignLoadGifClass ))
 
+/* What the header scan finds out about each frame.
+ */
+typedef struct _VipsForeignLoadGifFrame {
+	/* Source offset of the first record for this frame, or -1 if we
+	 * couldn't find it.
+	 */
+	gint64 offset;
+
+	/* From the graphics control extension, if any.
+	 */
+	int dispose;
+	int transparent_index;
+
+	/* This frame covers the whole canvas, has no transparency and doesn't
+	 * need the previous frame, so earlier frames have no effect on it or
+	 * on anything after it. We can start decoding here.
+	 */
+	gboolean independent;
+} VipsForeignLoadGifFrame;
+
 typedef struct _VipsForeignLoadGif {
 	VipsForeignLoad parent_object;
 
@@ -160,6 +196,11 @@ typedef struct _VipsForeignLoadGif {
 	int *delays;
 	int delays_length;
 
+	/* The frame index, built during header scan. This is allocated
+	 * alongside delays, so it's also delays_length long.
+	 */
+	VipsForeignLoadGifFrame *frames;
+
 	/* Number of times to loop the animation.
 	 */
 	int loop;
@@ -189,6 +230,16 @@ typedef struct _VipsForeignLoadGif {
 	 */
 	int current_page;
 
+	/* Snapshots of @scratch and @previous just before page 
+	 * (i + 1) * keyframe_interval, or NULL. We only start making these
+	 * after the first out of order page request.
+	 */
+	gboolean keyframes_enabled;
+	int max_keyframes;
+	int keyframe_interval;
+	VipsImage *key_scratch[GIF_MAX_KEYFRAMES];
+	VipsImage *key_previous[GIF_MAX_KEYFRAMES];
+
 	/* Decompress lines of the gif file to here.
 	 */
 	GifPixelType *line;
@@ -409,6 +460,8 @@ vips_foreign_load_gif_dispose( GObject *gobject )
 {
 	VipsForeignLoadGif *gif = (VipsForeignLoadGif *) gobject;
 
+	int i;
+
 	VIPS_DEBUG_MSG( "vips_foreign_load_gif_dispose:\n" );
 
 	vips_foreign_load_gif_close_giflib( gif );
@@ -417,9 +470,14 @@ vips_foreign_load_gif_dispose( GObject *gobject )
 	VIPS_UNREF( gif->frame );
 	VIPS_UNREF( gif->scratch );
 	VIPS_UNREF( gif->previous );
+	for( i = 0; i < GIF_MAX_KEYFRAMES; i++ ) {
+		VIPS_UNREF( gif->key_scratch[i] );
+		VIPS_UNREF( gif->key_previous[i] );
+	}
 	VIPS_FREE( gif->comment );
 	VIPS_FREE( gif->line );
 	VIPS_FREE( gif->delays );
+	VIPS_FREE( gif->frames );
 
 	G_OBJECT_CLASS( vips_foreign_load_gif_parent_class )->
 		dispose( gobject );
@@ -452,7 +510,7 @@ vips_foreign_load_gif_is_a_source( VipsSource *source )
 	return( FALSE );
 }
 
-/* Make sure delays is allocated and large enough.
+/* Make sure delays and the frame index are allocated and large enough.
  */
 static void
 vips_foreign_load_gif_allocate_delays( VipsForeignLoadGif *gif )
@@ -464,11 +522,28 @@ vips_foreign_load_gif_allocate_delays( VipsForeignLoadGif *gif )
 		gif->delays_length = gif->delays_length + gif->n_pages + 64;
 		gif->delays = (int *) g_realloc( gif->delays,
 			gif->delays_length * sizeof( int ) );
-		for( i = old; i < gif->delays_length; i++ )
+		gif->frames = (VipsForeignLoadGifFrame *) g_realloc( 
+			gif->frames,
+			gif->delays_length * sizeof( VipsForeignLoadGifFrame ) );
+		for( i = old; i < gif->delays_length; i++ ) {
 			gif->delays[i] = 40;
+			gif->frames[i].offset = -1;
+			gif->frames[i].dispose = DISPOSAL_UNSPECIFIED;
+			gif->frames[i].transparent_index = 
+				NO_TRANSPARENT_INDEX;
+			gif->frames[i].independent = FALSE;
+		}
 	}
 }
 
+/* The current read position in the source, or -1 for error.
+ */
+static gint64
+vips_foreign_load_gif_tell( VipsForeignLoadGif *gif )
+{
+	return( vips_source_seek( gif->source, 0, SEEK_CUR ) );
+}
+
 static int
 vips_foreign_load_gif_ext_next( VipsForeignLoadGif *gif,
 	GifByteType **extension )
@@ -506,6 +581,7 @@ vips_foreign_load_gif_scan_image( VipsForeignLoadGif *gif )
 {
 	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( gif );
 	GifFileType *file = gif->file;
+	VipsForeignLoadGifFrame *frame = &gif->frames[gif->n_pages];
 
 	ColorMapObject *map;
 	GifByteType *extension;
@@ -545,6 +621,17 @@ vips_foreign_load_gif_scan_image( VipsForeignLoadGif *gif )
 			}
 	}
 
+	/* A frame which paints every pixel and which won't be restored over
+	 * hides everything before it.
+	 */
+	frame->independent = file->Image.Left == 0 &&
+		file->Image.Top == 0 &&
+		file->Image.Width == file->SWidth &&
+		file->Image.Height == file->SHeight &&
+		frame->transparent_index == NO_TRANSPARENT_INDEX &&
+		(frame->dispose == DISPOSAL_UNSPECIFIED ||
+		 frame->dispose == DISPOSE_DO_NOT);
+
 	/* Step over compressed image data.
 	 */
 	do {
@@ -632,6 +719,21 @@ vips_foreign_load_gif_scan_extension( VipsForeignLoadGif *gif )
 				gif->has_transparency = TRUE;
 			}
 
+			/* Record dispose and transparency in the frame index.
+			 */
+			if( extension[0] == 4 ) {
+				VipsForeignLoadGifFrame *frame = 
+					&gif->frames[gif->n_pages];
+				int flags = extension[1];
+
+				frame->transparent_index = 
+					(flags & TRANSPARENT_MASK) ?
+						extension[4] : 
+						NO_TRANSPARENT_INDEX;
+				frame->dispose = 
+					(flags >> DISPOSE_SHIFT) & DISPOSE_MASK;
+			}
+
 			/* giflib uses centiseconds, we use ms.
 			 */
 			gif->delays[gif->n_pages] =
@@ -723,20 +825,28 @@ vips_foreign_load_gif_scan( VipsForeignLoadGif *gif )
 	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( gif );
 
 	GifRecordType record;
+	gint64 frame_start;
 
 	VIPS_DEBUG_MSG( "vips_foreign_load_gif_scan:\n" );
 
 	gif->n_pages = 0;
 
+	/* Each frame starts after the end of the previous image, so that
+	 * seeking to it will also read any extensions for that frame.
+	 */
+	frame_start = vips_foreign_load_gif_tell( gif );
+
 	do {
 		if( DGifGetRecordType( gif->file, &record ) == GIF_ERROR )
 			continue;
 
 		switch( record ) {
 		case IMAGE_DESC_RECORD_TYPE:
+			gif->frames[gif->n_pages].offset = frame_start;
 			(void) vips_foreign_load_gif_scan_image( gif );
 			gif->n_pages += 1;
 			vips_foreign_load_gif_allocate_delays( gif );
+			frame_start = vips_foreign_load_gif_tell( gif );
 			break;
 
 		case EXTENSION_RECORD_TYPE:
@@ -1126,6 +1236,175 @@ vips_foreign_load_gif_next_page( VipsForeignLoadGif *gif )
 	return( 0 );
 }
 
+static VipsImage *
+vips_foreign_load_gif_temp( VipsForeignLoadGif *gif )
+{
+	VipsImage *temp;
+
+	temp = vips_image_new_memory();
+	vips_image_init_fields( temp,
+		gif->file->SWidth, gif->file->SHeight, 4, VIPS_FORMAT_UCHAR,
+		VIPS_CODING_NONE, VIPS_INTERPRETATION_sRGB, 1.0, 1.0 );
+	if( vips_image_write_prepare( temp ) ) {
+		VIPS_UNREF( temp );
+		return( NULL );
+	}
+
+	return( temp );
+}
+
+/* Snapshot the render state, if we've just reached a keyframe.
+ */
+static int
+vips_foreign_load_gif_snapshot( VipsForeignLoadGif *gif )
+{
+	int i;
+
+	if( !gif->keyframes_enabled ||
+		gif->max_keyframes == 0 ||
+		gif->current_page % gif->keyframe_interval != 0 ||
+		gif->current_page >= gif->n_pages )
+		return( 0 );
+
+	i = gif->current_page / gif->keyframe_interval - 1;
+	if( i < 0 ||
+		i >= gif->max_keyframes ||
+		gif->key_scratch[i] )
+		return( 0 );
+
+	VIPS_DEBUG_MSG( "vips_foreign_load_gif_snapshot: "
+		"keyframe before page %d\n", gif->current_page );
+
+	if( !(gif->key_scratch[i] = vips_foreign_load_gif_temp( gif )) ||
+		!(gif->key_previous[i] = vips_foreign_load_gif_temp( gif )) ) {
+		VIPS_UNREF( gif->key_scratch[i] );
+		return( -1 );
+	}
+
+	memcpy( VIPS_IMAGE_ADDR( gif->key_scratch[i], 0, 0 ),
+		VIPS_IMAGE_ADDR( gif->scratch, 0, 0 ),
+		VIPS_IMAGE_SIZEOF_IMAGE( gif->scratch ) );
+	memcpy( VIPS_IMAGE_ADDR( gif->key_previous[i], 0, 0 ),
+		VIPS_IMAGE_ADDR( gif->previous, 0, 0 ),
+		VIPS_IMAGE_SIZEOF_IMAGE( gif->previous ) );
+
+	return( 0 );
+}
+
+/* Move the decoder to the start of @page with the render state set correctly
+ * for that point.
+ */
+static int
+vips_foreign_load_gif_restart( VipsForeignLoadGif *gif, int page )
+{
+	VIPS_DEBUG_MSG( "vips_foreign_load_gif_restart: page %d\n", page );
+
+	/* Going backwards, reopen giflib. This resets the decoder, and giflib5
+	 * keeps state for every image descriptor it sees, so we don't want
+	 * to make it read the same frames again and again.
+	 */
+	if( page < gif->current_page ) {
+		if( vips_foreign_load_gif_close_giflib( gif ) ||
+			vips_foreign_load_gif_open_giflib( gif ) )
+			return( -1 );
+	}
+
+	if( page > 0 ) {
+		if( vips_source_seek( gif->source, 
+			gif->frames[page].offset, SEEK_SET ) == -1 )
+			return( -1 );
+	}
+
+	if( page == 0 ) {
+		/* The first frame renders over a clear canvas.
+		 */
+		memset( VIPS_IMAGE_ADDR( gif->scratch, 0, 0 ), 0,
+			VIPS_IMAGE_SIZEOF_IMAGE( gif->scratch ) );
+		memset( VIPS_IMAGE_ADDR( gif->previous, 0, 0 ), 0,
+			VIPS_IMAGE_SIZEOF_IMAGE( gif->previous ) );
+	}
+	else if( !gif->frames[page].independent ) {
+		int i = page / gif->keyframe_interval - 1;
+
+		g_assert( page % gif->keyframe_interval == 0 );
+		g_assert( i >= 0 && i < gif->max_keyframes );
+		g_assert( gif->key_scratch[i] );
+
+		memcpy( VIPS_IMAGE_ADDR( gif->scratch, 0, 0 ),
+			VIPS_IMAGE_ADDR( gif->key_scratch[i], 0, 0 ),
+			VIPS_IMAGE_SIZEOF_IMAGE( gif->scratch ) );
+		memcpy( VIPS_IMAGE_ADDR( gif->previous, 0, 0 ),
+			VIPS_IMAGE_ADDR( gif->key_previous[i], 0, 0 ),
+			VIPS_IMAGE_SIZEOF_IMAGE( gif->previous ) );
+	}
+
+	gif->current_page = page;
+	gif->eof = FALSE;
+	gif->dispose = DISPOSAL_UNSPECIFIED;
+	gif->transparent_index = NO_TRANSPARENT_INDEX;
+
+	return( 0 );
+}
+
+/* Get @frame to hold @page. We decode forward from the nearest point we can
+ * restart from: where we are now, an independent frame, or a keyframe.
+ */
+static int
+vips_foreign_load_gif_goto_page( VipsForeignLoadGif *gif, int page )
+{
+	int start;
+	int i;
+
+	/* current_page == 0 means we've not loaded any pages yet. So
+	 * we need to have loaded the page beyond the page we want.
+	 */
+	if( gif->current_page == page + 1 )
+		return( 0 );
+
+	if( gif->current_page <= page ) 
+		start = gif->current_page;
+	else {
+		/* Out of order ... start keeping keyframes so the next one
+		 * is cheaper.
+		 */
+		start = 0;
+		gif->keyframes_enabled = TRUE;
+	}
+
+	for( i = page; i > start; i-- ) {
+		int k = i / gif->keyframe_interval - 1;
+
+		if( gif->frames[i].offset == -1 )
+			continue;
+
+		if( gif->frames[i].independent ||
+			(i % gif->keyframe_interval == 0 &&
+			 k >= 0 && 
+			 k < gif->max_keyframes &&
+			 gif->key_scratch[k]) ) {
+			start = i;
+			break;
+		}
+	}
+
+	if( start != gif->current_page ||
+		start == 0 ) 
+		if( vips_foreign_load_gif_restart( gif, start ) )
+			return( -1 );
+
+	while( gif->current_page <= page ) {
+		if( vips_foreign_load_gif_next_page( gif ) )
+			return( -1 );
+
+		gif->current_page += 1;
+
+		if( vips_foreign_load_gif_snapshot( gif ) )
+			return( -1 );
+	}
+
+	return( 0 );
+}
+
 static int
 vips_foreign_load_gif_generate( VipsRegion *or,
 	void *seq, void *a, void *b, gboolean *stop )
@@ -1154,15 +1433,8 @@ vips_foreign_load_gif_generate( VipsRegion *or,
 		g_assert( line >= 0 && line < gif->frame->Ysize );
 		g_assert( page >= 0 && page < gif->n_pages );
 
-		/* current_page == 0 means we've not loaded any pages yet. So
-		 * we need to have loaded the page beyond the page we want.
-		 */
-		while( gif->current_page <= page ) {
-			if( vips_foreign_load_gif_next_page( gif ) )
-				return( -1 );
-
-			gif->current_page += 1;
-		}
+		if( vips_foreign_load_gif_goto_page( gif, page ) )
+			return( -1 );
 
 		/* @frame is always RGBA, but or may be G, GA, RGB or RGBA.
 		 * We have to pick out the values we want.
@@ -1219,23 +1491,6 @@ vips_foreign_load_gif_minimise( VipsObject *object, VipsForeignLoadGif *gif )
 	vips_source_minimise( gif->source );
 }
 
-static VipsImage *
-vips_foreign_load_gif_temp( VipsForeignLoadGif *gif )
-{
-	VipsImage *temp;
-
-	temp = vips_image_new_memory();
-	vips_image_init_fields( temp,
-		gif->file->SWidth, gif->file->SHeight, 4, VIPS_FORMAT_UCHAR,
-		VIPS_CODING_NONE, VIPS_INTERPRETATION_sRGB, 1.0, 1.0 );
-	if( vips_image_write_prepare( temp ) ) {
-		VIPS_UNREF( temp );
-		return( NULL );
-	}
-
-	return( temp );
-}
-
 static int
 vips_foreign_load_gif_load( VipsForeignLoad *load )
 {
@@ -1248,6 +1503,20 @@ vips_foreign_load_gif_load( VipsForeignLoad *load )
 	if( vips_foreign_load_gif_open_giflib( gif ) )
 		return( -1 );
 
+	/* Keyframes are spaced so that we never keep more than
+	 * max_keyframes, and they never take more than 
+	 * GIF_KEYFRAME_MAX_MEMORY. Huge canvases get no keyframes, and 
+	 * restart from the first page, or the nearest independent page.
+	 */
+	gif->max_keyframes = VIPS_MIN( GIF_MAX_KEYFRAMES,
+		GIF_KEYFRAME_MAX_MEMORY / 
+			(2 * 4 * (guint64) gif->file->SWidth * 
+				gif->file->SHeight) );
+	gif->keyframe_interval = VIPS_MAX( GIF_KEYFRAME_INTERVAL,
+		VIPS_ROUND_UP( gif->n_pages, 
+			VIPS_MAX( 1, gif->max_keyframes ) ) / 
+			VIPS_MAX( 1, gif->max_keyframes ) );
+
 	/* Set of temp images we use during rendering.
 	 */
 	if( !(gif->frame = vips_foreign_load_gif_temp( gif )) ||
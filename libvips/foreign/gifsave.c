@@ -0,0 +1,1331 @@
+/* save as GIF with giflib and libimagequant
+ *
+ * 18/10/20
+ * 	- from ppmsave.c
+ * 	- quantise with a fixed set of workers, not a thread per page
+ * 	- quantise with vips__quantise_rgba()
+ * 	- reuse the global palette for pages with nearly the same colours
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/*
+#define DEBUG_VERBOSE
+#define DEBUG
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vips/vips.h>
+#include <vips/internal.h>
+#include <vips/debug.h>
+
+#include "pforeign.h"
+
+#if defined(HAVE_GIFLIB) && defined(HAVE_IMAGEQUANT)
+
+#include <gif_lib.h>
+
+/* See gifload.c.
+ */
+#ifdef GIFLIB_MAJOR
+#  if GIFLIB_MAJOR > 4
+#    define HAVE_GIFLIB_5
+#  endif
+#endif
+
+#ifndef HAVE_GIFLIB_5
+#define DISPOSE_BACKGROUND        2
+#endif
+
+/* The most frames we quantise at once. Each one holds an RGBA and an index
+ * copy of a page.
+ */
+#define GIF_MAX_QUEUE             (8)
+
+typedef struct _VipsForeignSaveGif VipsForeignSaveGif;
+
+/* A page on its way to the file. We quantise in a background thread, then
+ * write from the main save thread in page order.
+ */
+typedef struct _VipsForeignSaveGifFrame {
+	VipsForeignSaveGif *gif;
+
+	/* Page number, and the number of lines we've filled so far.
+	 */
+	int page;
+	int lines;
+
+	VipsPel *rgba;
+	VipsPel *index;
+
+	/* The palette for index, and the transparent pixel, or -1.
+	 */
+	GifColorType colours[256];
+	int n_colours;
+	int transparent;
+
+	/* Set if the palette holds every colour in the page exactly.
+	 */
+	gboolean exact;
+
+	/* Set by the worker that quantises this frame, under gif->lock.
+	 */
+	gboolean started;
+	gboolean done;
+	int result;
+} VipsForeignSaveGifFrame;
+
+struct _VipsForeignSaveGif {
+	VipsForeignSave parent_object;
+
+	VipsTarget *target;
+
+	/* Quantisation params, as pngsave.
+	 */
+	int colours;
+	int Q;
+	double dither;
+
+	/* save->ready with an alpha added, if necessary.
+	 */
+	VipsImage *ready;
+
+	GifFileType *file;
+	int page_height;
+	int n_pages;
+
+	/* Delays in ms, and number of times to play, from metadata.
+	 */
+	int *delays;
+	int delays_length;
+	int loop;
+
+	/* The global palette, from the first page.
+	 */
+	GifColorType global[256];
+	int n_global;
+	int global_transparent;
+
+	/* The page being filled by sink_disc.
+	 */
+	VipsForeignSaveGifFrame *frame;
+
+	/* Pages being quantised, oldest first.
+	 */
+	VipsForeignSaveGifFrame *queue[GIF_MAX_QUEUE];
+	int n_queue;
+	int max_queue;
+
+	/* A fixed set of workers quantise the queued pages. The queue and the
+	 * frame state are locked by @lock, and changes are signalled on 
+	 * @cond.
+	 */
+	GThread *workers[GIF_MAX_QUEUE];
+	int n_workers;
+	GMutex *lock;
+	GCond *cond;
+	gboolean stop;
+};
+
+typedef VipsForeignSaveClass VipsForeignSaveGifClass;
+
+G_DEFINE_ABSTRACT_TYPE( VipsForeignSaveGif, vips_foreign_save_gif,
+	VIPS_TYPE_FOREIGN_SAVE );
+
+static void
+vips_foreign_save_gif_error( VipsForeignSaveGif *gif, int error )
+{
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( gif );
+
+#ifdef HAVE_GIFLIB_5
+	const char *message;
+
+	if( !(message = GifErrorString( error )) )
+		message = _( "unknown error" );
+	vips_error( class->nickname, "%s", message );
+#else /*!HAVE_GIFLIB_5*/
+	vips_error( class->nickname, _( "giflib error %d" ), error );
+#endif /*HAVE_GIFLIB_5*/
+}
+
+static int
+vips_foreign_save_gif_last_error( VipsForeignSaveGif *gif )
+{
+#ifdef HAVE_GIFLIB_5
+	return( gif->file ? gif->file->Error : 0 );
+#else /*!HAVE_GIFLIB_5*/
+	return( GifLastError() );
+#endif /*HAVE_GIFLIB_5*/
+}
+
+static void
+vips_foreign_save_gif_frame_free( VipsForeignSaveGifFrame *frame )
+{
+	VIPS_FREEF( vips_tracked_free, frame->rgba );
+	VIPS_FREEF( vips_tracked_free, frame->index );
+	VIPS_FREE( frame );
+}
+
+static VipsForeignSaveGifFrame *
+vips_foreign_save_gif_frame_new( VipsForeignSaveGif *gif, int page )
+{
+	VipsImage *ready = gif->ready;
+	size_t n_pels = (size_t) ready->Xsize * gif->page_height;
+
+	VipsForeignSaveGifFrame *frame;
+
+	if( !(frame = VIPS_NEW( NULL, VipsForeignSaveGifFrame )) )
+		return( NULL );
+	frame->gif = gif;
+	frame->page = page;
+	frame->lines = 0;
+	frame->rgba = NULL;
+	frame->index = NULL;
+	frame->n_colours = 0;
+	frame->transparent = -1;
+	frame->started = FALSE;
+	frame->done = FALSE;
+	frame->result = 0;
+	frame->exact = FALSE;
+
+	if( !(frame->rgba = vips_tracked_malloc( 4 * n_pels )) ||
+		!(frame->index = vips_tracked_malloc( n_pels )) ) {
+		vips_foreign_save_gif_frame_free( frame );
+		return( NULL );
+	}
+
+	return( frame );
+}
+
+/* Stop the workers. Any frames being quantised are finished first.
+ */
+static void
+vips_foreign_save_gif_stop_workers( VipsForeignSaveGif *gif )
+{
+	int i;
+
+	g_mutex_lock( gif->lock );
+	gif->stop = TRUE;
+	g_cond_broadcast( gif->cond );
+	g_mutex_unlock( gif->lock );
+
+	for( i = 0; i < gif->n_workers; i++ ) 
+		(void) vips_g_thread_join( gif->workers[i] );
+	gif->n_workers = 0;
+}
+
+static void
+vips_foreign_save_gif_dispose( GObject *gobject )
+{
+	VipsForeignSaveGif *gif = (VipsForeignSaveGif *) gobject;
+
+	int i;
+
+	/* We can get here on an error with frames still being quantised.
+	 */
+	if( gif->lock )
+		vips_foreign_save_gif_stop_workers( gif );
+	for( i = 0; i < gif->n_queue; i++ )
+		VIPS_FREEF( vips_foreign_save_gif_frame_free, gif->queue[i] );
+	gif->n_queue = 0;
+	VIPS_FREEF( vips_foreign_save_gif_frame_free, gif->frame );
+
+	if( gif->file ) {
+#ifdef HAVE_GIFLIB_5
+		int error;
+
+		(void) EGifCloseFile( gif->file, &error );
+#else /*!HAVE_GIFLIB_5*/
+		(void) EGifCloseFile( gif->file );
+#endif /*HAVE_GIFLIB_5*/
+		gif->file = NULL;
+	}
+
+	if( gif->target )
+		vips_target_finish( gif->target );
+	VIPS_UNREF( gif->target );
+
+	VIPS_FREEF( vips_g_mutex_free, gif->lock );
+	VIPS_FREEF( vips_g_cond_free, gif->cond );
+
+	G_OBJECT_CLASS( vips_foreign_save_gif_parent_class )->
+		dispose( gobject );
+}
+
+/* GIF can only have one transparent colour, so we threshold alpha and make
+ * all transparent pixels the same.
+ */
+static void
+vips_foreign_save_gif_threshold( VipsForeignSaveGifFrame *frame,
+	size_t n_pels )
+{
+	guint32 *p = (guint32 *) frame->rgba;
+
+	size_t i;
+
+	for( i = 0; i < n_pels; i++ ) {
+		VipsPel *q = (VipsPel *) &p[i];
+
+		if( q[3] < 128 )
+			p[i] = 0;
+		else
+			q[3] = 255;
+	}
+}
+
+/* If a page has no more than colours distinct values, we can palettise it
+ * exactly and skip quantisation. This is common for GIF to GIF processing.
+ */
+static gboolean
+vips_foreign_save_gif_exact( VipsForeignSaveGifFrame *frame, size_t n_pels )
+{
+	VipsForeignSaveGif *gif = frame->gif;
+	guint32 *p = (guint32 *) frame->rgba;
+
+	GHashTable *table;
+	guint32 last_pixel;
+	int last_index;
+	size_t i;
+
+	table = g_hash_table_new( g_direct_hash, g_direct_equal );
+	frame->n_colours = 0;
+	frame->transparent = -1;
+	last_pixel = 0;
+	last_index = -1;
+
+	for( i = 0; i < n_pels; i++ ) {
+		int index;
+
+		if( p[i] == last_pixel &&
+			last_index != -1 )
+			index = last_index;
+		else {
+			gpointer value;
+
+			if( (value = g_hash_table_lookup( table,
+				GUINT_TO_POINTER( p[i] ) )) )
+				index = GPOINTER_TO_INT( value ) - 1;
+			else {
+				VipsPel *q = (VipsPel *) &p[i];
+
+				if( frame->n_colours >= gif->colours ) {
+					g_hash_table_destroy( table );
+					return( FALSE );
+				}
+
+				index = frame->n_colours;
+				frame->n_colours += 1;
+				frame->colours[index].Red = q[0];
+				frame->colours[index].Green = q[1];
+				frame->colours[index].Blue = q[2];
+				if( q[3] == 0 )
+					frame->transparent = index;
+
+				g_hash_table_insert( table,
+					GUINT_TO_POINTER( p[i] ),
+					GINT_TO_POINTER( index + 1 ) );
+			}
+
+			last_pixel = p[i];
+			last_index = index;
+		}
+
+		frame->index[i] = index;
+	}
+
+	g_hash_table_destroy( table );
+
+	return( TRUE );
+}
+
+static int
+vips_foreign_save_gif_quantise( VipsForeignSaveGifFrame *frame,
+	int width, int height )
+{
+	VipsForeignSaveGif *gif = frame->gif;
+	size_t n_pels = (size_t) width * height;
+
+	VipsPel palette[256 * 4];
+	int n_palette;
+	int i;
+
+	if( vips__quantise_rgba( frame->rgba, width, height,
+		gif->colours, gif->Q, gif->dither,
+		frame->index, palette, &n_palette ) )
+		return( -1 );
+
+	frame->n_colours = n_palette;
+	frame->transparent = -1;
+	for( i = 0; i < n_palette; i++ ) {
+		VipsPel *p = palette + i * 4;
+
+		frame->colours[i].Red = p[0];
+		frame->colours[i].Green = p[1];
+		frame->colours[i].Blue = p[2];
+
+		if( p[3] < 128 &&
+			frame->transparent == -1 )
+			frame->transparent = i;
+	}
+
+	/* There can be only one transparent index. Remap any others to it.
+	 */
+	if( frame->transparent != -1 ) {
+		VipsPel lut[256];
+		size_t j;
+
+		for( i = 0; i < 256; i++ )
+			lut[i] = i < n_palette && palette[i * 4 + 3] < 128 ?
+				frame->transparent : i;
+		for( j = 0; j < n_pels; j++ )
+			frame->index[j] = lut[frame->index[j]];
+	}
+
+	return( 0 );
+}
+
+/* Palettise a page. Run from one of the workers.
+ */
+static void
+vips_foreign_save_gif_quantise_frame( VipsForeignSaveGifFrame *frame )
+{
+	VipsForeignSaveGif *gif = frame->gif;
+	VipsImage *ready = gif->ready;
+	size_t n_pels = (size_t) ready->Xsize * gif->page_height;
+
+	VIPS_DEBUG_MSG( "vips_foreign_save_gif_quantise_frame: page %d\n",
+		frame->page );
+
+	vips_foreign_save_gif_threshold( frame, n_pels );
+
+	frame->exact = vips_foreign_save_gif_exact( frame, n_pels );
+	if( !frame->exact &&
+		vips_foreign_save_gif_quantise( frame,
+			ready->Xsize, gif->page_height ) )
+		frame->result = -1;
+
+	/* We don't need the RGBA any more.
+	 */
+	VIPS_FREEF( vips_tracked_free, frame->rgba );
+}
+
+/* A worker: quantise queued frames until we're told to stop.
+ */
+static void *
+vips_foreign_save_gif_worker( void *a )
+{
+	VipsForeignSaveGif *gif = (VipsForeignSaveGif *) a;
+
+	g_mutex_lock( gif->lock );
+
+	while( !gif->stop ) {
+		VipsForeignSaveGifFrame *frame;
+		int i;
+
+		frame = NULL;
+		for( i = 0; i < gif->n_queue; i++ )
+			if( !gif->queue[i]->started ) {
+				frame = gif->queue[i];
+				break;
+			}
+
+		if( !frame ) {
+			g_cond_wait( gif->cond, gif->lock );
+			continue;
+		}
+
+		frame->started = TRUE;
+		g_mutex_unlock( gif->lock );
+
+		vips_foreign_save_gif_quantise_frame( frame );
+
+		g_mutex_lock( gif->lock );
+		frame->done = TRUE;
+		g_cond_broadcast( gif->cond );
+	}
+
+	g_mutex_unlock( gif->lock );
+
+	return( NULL );
+}
+
+static ColorMapObject *
+vips_foreign_save_gif_map( GifColorType *colours, int n_colours )
+{
+	ColorMapObject *map;
+	int size;
+	int i;
+
+	/* giflib wants a power of two, and at least two entries.
+	 */
+	for( size = 2; size < n_colours; size *= 2 )
+		;
+
+#ifdef HAVE_GIFLIB_5
+	if( !(map = GifMakeMapObject( size, NULL )) ) {
+#else /*!HAVE_GIFLIB_5*/
+	if( !(map = MakeMapObject( size, NULL )) ) {
+#endif /*HAVE_GIFLIB_5*/
+		vips_error( "gifsave", "%s", _( "out of memory" ) );
+		return( NULL );
+	}
+
+	for( i = 0; i < size; i++ )
+		if( i < n_colours )
+			map->Colors[i] = colours[i];
+		else {
+			map->Colors[i].Red = 0;
+			map->Colors[i].Green = 0;
+			map->Colors[i].Blue = 0;
+		}
+
+	return( map );
+}
+
+static void
+vips_foreign_save_gif_map_free( ColorMapObject *map )
+{
+#ifdef HAVE_GIFLIB_5
+	GifFreeMapObject( map );
+#else /*!HAVE_GIFLIB_5*/
+	FreeMapObject( map );
+#endif /*HAVE_GIFLIB_5*/
+}
+
+/* Can we write @frame with the global palette? Every colour it uses must be 
+ * within this squared RGB distance of a global colour. Palettes from 
+ * libimagequant for similar pages are often a few levels apart, so an exact 
+ * match alone would rarely succeed.
+ */
+#define GIF_REUSE_DISTANCE (3 * 4 * 4)
+
+/* Set @lut to map frame indexes to the nearest global ones, or FALSE if 
+ * some colour has no close enough match. Pages we palettised exactly must 
+ * match exactly too.
+ */
+static gboolean
+vips_foreign_save_gif_reuse( VipsForeignSaveGif *gif,
+	VipsForeignSaveGifFrame *frame, VipsPel *lut )
+{
+	int max_distance = frame->exact ? 0 : GIF_REUSE_DISTANCE;
+
+	int i, j;
+
+	if( frame->transparent != -1 &&
+		gif->global_transparent == -1 )
+		return( FALSE );
+
+	for( i = 0; i < frame->n_colours; i++ ) {
+		GifColorType *colour = &frame->colours[i];
+
+		int best;
+		int best_distance;
+
+		if( i == frame->transparent ) {
+			lut[i] = gif->global_transparent;
+			continue;
+		}
+
+		best = -1;
+		best_distance = max_distance + 1;
+		for( j = 0; j < gif->n_global; j++ ) {
+			int dr = colour->Red - gif->global[j].Red;
+			int dg = colour->Green - gif->global[j].Green;
+			int db = colour->Blue - gif->global[j].Blue;
+			int distance = dr * dr + dg * dg + db * db;
+
+			if( j != gif->global_transparent &&
+				distance < best_distance ) {
+				best = j;
+				best_distance = distance;
+			}
+		}
+		if( best == -1 )
+			return( FALSE );
+
+		lut[i] = best;
+	}
+
+	return( TRUE );
+}
+
+/* The screen descriptor and any whole-file extensions. We write this when
+ * the first page is ready, since that's where the global palette comes from.
+ */
+static int
+vips_foreign_save_gif_write_header( VipsForeignSaveGif *gif,
+	VipsForeignSaveGifFrame *frame )
+{
+	VipsForeignSave *save = (VipsForeignSave *) gif;
+	VipsImage *ready = gif->ready;
+
+	ColorMapObject *map;
+	const char *comment;
+
+	memcpy( gif->global, frame->colours,
+		frame->n_colours * sizeof( GifColorType ) );
+	gif->n_global = frame->n_colours;
+	gif->global_transparent = frame->transparent;
+
+	if( !(map = vips_foreign_save_gif_map( gif->global, gif->n_global )) )
+		return( -1 );
+
+#ifdef HAVE_GIFLIB_5
+	EGifSetGifVersion( gif->file, TRUE );
+#else /*!HAVE_GIFLIB_5*/
+	EGifSetGifVersion( "89a" );
+#endif /*HAVE_GIFLIB_5*/
+
+	if( EGifPutScreenDesc( gif->file,
+		ready->Xsize, gif->page_height, 8, 0, map ) == GIF_ERROR ) {
+		vips_foreign_save_gif_map_free( map );
+		vips_foreign_save_gif_error( gif,
+			vips_foreign_save_gif_last_error( gif ) );
+		return( -1 );
+	}
+	vips_foreign_save_gif_map_free( map );
+
+	/* The NETSCAPE extension holds the number of times to repeat, so
+	 * loop = 1 (play once) means no extension.
+	 */
+	if( gif->n_pages > 1 &&
+		gif->loop != 1 ) {
+		static const char *app = "NETSCAPE2.0";
+		int repeat = gif->loop == 0 ? 0 : gif->loop - 1;
+		unsigned char data[3];
+
+		data[0] = 1;
+		data[1] = repeat & 0xff;
+		data[2] = (repeat >> 8) & 0xff;
+
+#ifdef HAVE_GIFLIB_5
+		if( EGifPutExtensionLeader( gif->file,
+				APPLICATION_EXT_FUNC_CODE ) == GIF_ERROR ||
+			EGifPutExtensionBlock( gif->file,
+				11, app ) == GIF_ERROR ||
+			EGifPutExtensionBlock( gif->file,
+				3, data ) == GIF_ERROR ||
+			EGifPutExtensionTrailer( gif->file ) == GIF_ERROR ) {
+#else /*!HAVE_GIFLIB_5*/
+		if( EGifPutExtensionFirst( gif->file,
+				APPLICATION_EXT_FUNC_CODE,
+				11, app ) == GIF_ERROR ||
+			EGifPutExtensionLast( gif->file,
+				APPLICATION_EXT_FUNC_CODE,
+				3, data ) == GIF_ERROR ) {
+#endif /*HAVE_GIFLIB_5*/
+			vips_foreign_save_gif_error( gif,
+				vips_foreign_save_gif_last_error( gif ) );
+			return( -1 );
+		}
+	}
+
+	if( !save->strip &&
+		vips_image_get_typeof( ready, "gif-comment" ) &&
+		!vips_image_get_string( ready, "gif-comment", &comment ) &&
+		EGifPutComment( gif->file, comment ) == GIF_ERROR ) {
+		vips_foreign_save_gif_error( gif,
+			vips_foreign_save_gif_last_error( gif ) );
+		return( -1 );
+	}
+
+	return( 0 );
+}
+
+/* Wait for a frame to be quantised, then LZW compress it to the file.
+ */
+static int
+vips_foreign_save_gif_write_frame( VipsForeignSaveGif *gif,
+	VipsForeignSaveGifFrame *frame )
+{
+	VipsImage *ready = gif->ready;
+	size_t n_pels = (size_t) ready->Xsize * gif->page_height;
+
+	ColorMapObject *map;
+	VipsPel lut[256];
+	int transparent;
+	int delay;
+	unsigned char gce[4];
+	int y;
+
+	VIPS_DEBUG_MSG( "vips_foreign_save_gif_write_frame: page %d\n",
+		frame->page );
+
+	if( frame->result )
+		return( -1 );
+
+	if( frame->page == 0 &&
+		vips_foreign_save_gif_write_header( gif, frame ) )
+		return( -1 );
+
+	/* Use the global palette if we can, a local one if we must.
+	 */
+	if( vips_foreign_save_gif_reuse( gif, frame, lut ) ) {
+		size_t i;
+
+		map = NULL;
+		transparent = gif->global_transparent;
+
+		if( frame->page > 0 )
+			for( i = 0; i < n_pels; i++ )
+				frame->index[i] = lut[frame->index[i]];
+	}
+	else {
+		if( !(map = vips_foreign_save_gif_map( frame->colours,
+			frame->n_colours )) )
+			return( -1 );
+		transparent = frame->transparent;
+	}
+
+	/* Delays are in ms, GIF uses centiseconds.
+	 */
+	delay = 4;
+	if( gif->delays &&
+		frame->page < gif->delays_length )
+		delay = VIPS_RINT( gif->delays[frame->page] / 10.0 );
+	else if( vips_image_get_typeof( ready, "gif-delay" ) )
+		vips_image_get_int( ready, "gif-delay", &delay );
+	delay = VIPS_CLIP( 0, delay, 0xffff );
+
+	/* libvips pages are independent, so clear to background after each
+	 * one.
+	 */
+	gce[0] = (DISPOSE_BACKGROUND << 2) | (transparent != -1 ? 1 : 0);
+	gce[1] = delay & 0xff;
+	gce[2] = (delay >> 8) & 0xff;
+	gce[3] = transparent != -1 ? transparent : 0;
+
+	if( (gif->n_pages > 1 ||
+		transparent != -1) &&
+		EGifPutExtension( gif->file,
+			GRAPHICS_EXT_FUNC_CODE, 4, gce ) == GIF_ERROR ) {
+		VIPS_FREEF( vips_foreign_save_gif_map_free, map );
+		vips_foreign_save_gif_error( gif,
+			vips_foreign_save_gif_last_error( gif ) );
+		return( -1 );
+	}
+
+	if( EGifPutImageDesc( gif->file,
+		0, 0, ready->Xsize, gif->page_height, FALSE, map ) ==
+			GIF_ERROR ) {
+		VIPS_FREEF( vips_foreign_save_gif_map_free, map );
+		vips_foreign_save_gif_error( gif,
+			vips_foreign_save_gif_last_error( gif ) );
+		return( -1 );
+	}
+	VIPS_FREEF( vips_foreign_save_gif_map_free, map );
+
+	for( y = 0; y < gif->page_height; y++ )
+		if( EGifPutLine( gif->file,
+			frame->index + (size_t) y * ready->Xsize,
+			ready->Xsize ) == GIF_ERROR ) {
+			vips_foreign_save_gif_error( gif,
+				vips_foreign_save_gif_last_error( gif ) );
+			return( -1 );
+		}
+
+	return( 0 );
+}
+
+/* Wait for the oldest queued frame to be quantised, then write it.
+ */
+static int
+vips_foreign_save_gif_write_oldest( VipsForeignSaveGif *gif )
+{
+	VipsForeignSaveGifFrame *frame;
+	int result;
+	int i;
+
+	g_assert( gif->n_queue > 0 );
+
+	g_mutex_lock( gif->lock );
+	frame = gif->queue[0];
+	while( !frame->done )
+		g_cond_wait( gif->cond, gif->lock );
+	for( i = 1; i < gif->n_queue; i++ )
+		gif->queue[i - 1] = gif->queue[i];
+	gif->n_queue -= 1;
+	g_mutex_unlock( gif->lock );
+
+	result = vips_foreign_save_gif_write_frame( gif, frame );
+	vips_foreign_save_gif_frame_free( frame );
+
+	return( result );
+}
+
+/* A page has been filled: start quantising it in the background.
+ */
+static int
+vips_foreign_save_gif_queue_frame( VipsForeignSaveGif *gif )
+{
+	VipsForeignSaveGifFrame *frame = gif->frame;
+
+	if( gif->n_queue >= gif->max_queue &&
+		vips_foreign_save_gif_write_oldest( gif ) )
+		return( -1 );
+
+	gif->frame = NULL;
+
+	g_mutex_lock( gif->lock );
+	gif->queue[gif->n_queue++] = frame;
+	g_cond_broadcast( gif->cond );
+	g_mutex_unlock( gif->lock );
+
+	return( 0 );
+}
+
+static int
+vips_foreign_save_gif_write_block( VipsRegion *region, VipsRect *area,
+	void *a )
+{
+	VipsForeignSaveGif *gif = (VipsForeignSaveGif *) a;
+	VipsImage *ready = gif->ready;
+	size_t sizeof_line = VIPS_IMAGE_SIZEOF_LINE( ready );
+
+	int y;
+
+	for( y = 0; y < area->height; y++ ) {
+		VipsPel *p = VIPS_REGION_ADDR( region, 0, area->top + y );
+
+		if( !gif->frame &&
+			!(gif->frame = vips_foreign_save_gif_frame_new( gif,
+				(area->top + y) / gif->page_height )) )
+			return( -1 );
+
+		memcpy( gif->frame->rgba + gif->frame->lines * sizeof_line,
+			p, sizeof_line );
+		gif->frame->lines += 1;
+
+		if( gif->frame->lines == gif->page_height &&
+			vips_foreign_save_gif_queue_frame( gif ) )
+			return( -1 );
+	}
+
+	return( 0 );
+}
+
+static int
+vips_giflib_write( GifFileType *file, const GifByteType *buf, int n )
+{
+	VipsForeignSaveGif *gif = (VipsForeignSaveGif *) file->UserData;
+
+	if( vips_target_write( gif->target, buf, n ) )
+		return( 0 );
+
+	return( n );
+}
+
+static int
+vips_foreign_save_gif_build( VipsObject *object )
+{
+	VipsForeignSave *save = (VipsForeignSave *) object;
+	VipsForeignSaveGif *gif = (VipsForeignSaveGif *) object;
+	VipsImage **t = (VipsImage **) vips_object_local_array( object, 1 );
+
+	VipsImage *ready;
+
+	if( VIPS_OBJECT_CLASS( vips_foreign_save_gif_parent_class )->
+		build( object ) )
+		return( -1 );
+
+	/* We always work in RGBA.
+	 */
+	ready = save->ready;
+	if( ready->Bands == 3 ) {
+		if( vips_bandjoin_const1( ready, &t[0], 255, NULL ) )
+			return( -1 );
+		ready = t[0];
+	}
+	if( vips_check_bands( "vips2gif", ready, 4 ) ||
+		vips_check_uncoded( "vips2gif", ready ) ||
+		vips_image_pio_input( ready ) )
+		return( -1 );
+	gif->ready = ready;
+
+	gif->page_height = vips_image_get_page_height( ready );
+	gif->n_pages = ready->Ysize / gif->page_height;
+
+	if( ready->Xsize > 65535 ||
+		gif->page_height > 65535 ) {
+		vips_error( "vips2gif", "%s", _( "image too large for gif" ) );
+		return( -1 );
+	}
+
+	if( vips_image_get_typeof( ready, "delay" ) )
+		vips_image_get_array_int( ready, "delay",
+			&gif->delays, &gif->delays_length );
+
+	/* As gifload, "loop" is the number of times to play, 0 for forever.
+	 */
+	if( vips_image_get_typeof( ready, "loop" ) )
+		vips_image_get_int( ready, "loop", &gif->loop );
+	else if( vips_image_get_typeof( ready, "gif-loop" ) ) {
+		/* DEPRECATED "gif-loop" is the number of repeats.
+		 */
+		int repeat;
+
+		if( !vips_image_get_int( ready, "gif-loop", &repeat ) )
+			gif->loop = repeat == 0 ? 0 : repeat + 1;
+	}
+
+	/* We quantise up to this many pages at once. Each one needs a copy
+	 * of the page, so don't go too high.
+	 */
+	gif->max_queue = VIPS_CLIP( 1, vips_concurrency_get(), GIF_MAX_QUEUE );
+
+	/* One worker per queue slot.
+	 */
+	for( gif->n_workers = 0; 
+		gif->n_workers < gif->max_queue; gif->n_workers++ ) 
+		if( !(gif->workers[gif->n_workers] = 
+			vips_g_thread_new( "gifsave",
+				vips_foreign_save_gif_worker, gif )) )
+			return( -1 );
+
+#ifdef HAVE_GIFLIB_5
+{
+	int error;
+
+	if( !(gif->file = EGifOpen( gif, vips_giflib_write, &error )) ) {
+		vips_foreign_save_gif_error( gif, error );
+		return( -1 );
+	}
+}
+#else /*!HAVE_GIFLIB_5*/
+	if( !(gif->file = EGifOpen( gif, vips_giflib_write )) ) {
+		vips_foreign_save_gif_error( gif, GifLastError() );
+		return( -1 );
+	}
+#endif /*HAVE_GIFLIB_5*/
+
+	if( vips_sink_disc( ready, vips_foreign_save_gif_write_block, gif ) )
+		return( -1 );
+
+	while( gif->n_queue > 0 )
+		if( vips_foreign_save_gif_write_oldest( gif ) )
+			return( -1 );
+
+	vips_foreign_save_gif_stop_workers( gif );
+
+#ifdef HAVE_GIFLIB_5
+{
+	int error;
+
+	if( EGifCloseFile( gif->file, &error ) == GIF_ERROR ) {
+		gif->file = NULL;
+		vips_foreign_save_gif_error( gif, error );
+		return( -1 );
+	}
+}
+#else /*!HAVE_GIFLIB_5*/
+	if( EGifCloseFile( gif->file ) == GIF_ERROR ) {
+		gif->file = NULL;
+		vips_foreign_save_gif_error( gif, GifLastError() );
+		return( -1 );
+	}
+#endif /*HAVE_GIFLIB_5*/
+	gif->file = NULL;
+
+	return( 0 );
+}
+
+#define UC VIPS_FORMAT_UCHAR
+
+/* Type promotion for save ... just always go to uchar.
+ */
+static int bandfmt_gif[10] = {
+/* UC  C   US  S   UI  I   F   X   D   DX */
+   UC, UC, UC, UC, UC, UC, UC, UC, UC, UC
+};
+
+static const char *vips__gif_suffs[] = { ".gif", NULL };
+
+static void
+vips_foreign_save_gif_class_init( VipsForeignSaveGifClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+	VipsForeignClass *foreign_class = (VipsForeignClass *) class;
+	VipsForeignSaveClass *save_class = (VipsForeignSaveClass *) class;
+
+	gobject_class->dispose = vips_foreign_save_gif_dispose;
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	object_class->nickname = "gifsave_base";
+	object_class->description = _( "save as gif" );
+	object_class->build = vips_foreign_save_gif_build;
+
+	foreign_class->suffs = vips__gif_suffs;
+
+	save_class->saveable = VIPS_SAVEABLE_RGBA_ONLY;
+	save_class->format_table = bandfmt_gif;
+
+	VIPS_ARG_INT( class, "colours", 14,
+		_( "Colours" ),
+		_( "Max number of palette colours" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsForeignSaveGif, colours ),
+		2, 256, 256 );
+
+	VIPS_ARG_INT( class, "Q", 15,
+		_( "Quality" ),
+		_( "Quantisation quality" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsForeignSaveGif, Q ),
+		0, 100, 100 );
+
+	VIPS_ARG_DOUBLE( class, "dither", 16,
+		_( "Dithering" ),
+		_( "Amount of dithering" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsForeignSaveGif, dither ),
+		0.0, 1.0, 1.0 );
+
+}
+
+static void
+vips_foreign_save_gif_init( VipsForeignSaveGif *gif )
+{
+	gif->colours = 256;
+	gif->Q = 100;
+	gif->dither = 1.0;
+	gif->loop = 0;
+	gif->global_transparent = -1;
+	gif->lock = vips_g_mutex_new();
+	gif->cond = vips_g_cond_new();
+}
+
+typedef struct _VipsForeignSaveGifTarget {
+	VipsForeignSaveGif parent_object;
+
+	VipsTarget *target;
+} VipsForeignSaveGifTarget;
+
+typedef VipsForeignSaveGifClass VipsForeignSaveGifTargetClass;
+
+G_DEFINE_TYPE( VipsForeignSaveGifTarget, vips_foreign_save_gif_target,
+	vips_foreign_save_gif_get_type() );
+
+static int
+vips_foreign_save_gif_target_build( VipsObject *object )
+{
+	VipsForeignSaveGif *gif = (VipsForeignSaveGif *) object;
+	VipsForeignSaveGifTarget *target =
+		(VipsForeignSaveGifTarget *) object;
+
+	if( target->target ) {
+		gif->target = target->target;
+		g_object_ref( gif->target );
+	}
+
+	return( VIPS_OBJECT_CLASS( vips_foreign_save_gif_target_parent_class )->
+		build( object ) );
+}
+
+static void
+vips_foreign_save_gif_target_class_init(
+	VipsForeignSaveGifTargetClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	object_class->nickname = "gifsave_target";
+	object_class->description = _( "save image to gif target" );
+	object_class->build = vips_foreign_save_gif_target_build;
+
+	VIPS_ARG_OBJECT( class, "target", 1,
+		_( "Target" ),
+		_( "Target to save to" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsForeignSaveGifTarget, target ),
+		VIPS_TYPE_TARGET );
+
+}
+
+static void
+vips_foreign_save_gif_target_init( VipsForeignSaveGifTarget *target )
+{
+}
+
+typedef struct _VipsForeignSaveGifFile {
+	VipsForeignSaveGif parent_object;
+
+	char *filename;
+} VipsForeignSaveGifFile;
+
+typedef VipsForeignSaveGifClass VipsForeignSaveGifFileClass;
+
+G_DEFINE_TYPE( VipsForeignSaveGifFile, vips_foreign_save_gif_file,
+	vips_foreign_save_gif_get_type() );
+
+static int
+vips_foreign_save_gif_file_build( VipsObject *object )
+{
+	VipsForeignSaveGif *gif = (VipsForeignSaveGif *) object;
+	VipsForeignSaveGifFile *file = (VipsForeignSaveGifFile *) object;
+
+	if( file->filename &&
+		!(gif->target = vips_target_new_to_file( file->filename )) )
+		return( -1 );
+
+	return( VIPS_OBJECT_CLASS( vips_foreign_save_gif_file_parent_class )->
+		build( object ) );
+}
+
+static void
+vips_foreign_save_gif_file_class_init( VipsForeignSaveGifFileClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	object_class->nickname = "gifsave";
+	object_class->description = _( "save image to gif file" );
+	object_class->build = vips_foreign_save_gif_file_build;
+
+	VIPS_ARG_STRING( class, "filename", 1,
+		_( "Filename" ),
+		_( "Filename to save to" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsForeignSaveGifFile, filename ),
+		NULL );
+
+}
+
+static void
+vips_foreign_save_gif_file_init( VipsForeignSaveGifFile *file )
+{
+}
+
+typedef struct _VipsForeignSaveGifBuffer {
+	VipsForeignSaveGif parent_object;
+
+	VipsArea *buf;
+} VipsForeignSaveGifBuffer;
+
+typedef VipsForeignSaveGifClass VipsForeignSaveGifBufferClass;
+
+G_DEFINE_TYPE( VipsForeignSaveGifBuffer, vips_foreign_save_gif_buffer,
+	vips_foreign_save_gif_get_type() );
+
+static int
+vips_foreign_save_gif_buffer_build( VipsObject *object )
+{
+	VipsForeignSaveGif *gif = (VipsForeignSaveGif *) object;
+
+	VipsBlob *blob;
+
+	if( !(gif->target = vips_target_new_to_memory()) )
+		return( -1 );
+
+	if( VIPS_OBJECT_CLASS( vips_foreign_save_gif_buffer_parent_class )->
+		build( object ) )
+		return( -1 );
+
+	vips_target_finish( gif->target );
+	g_object_get( gif->target, "blob", &blob, NULL );
+	g_object_set( object, "buffer", blob, NULL );
+	vips_area_unref( VIPS_AREA( blob ) );
+
+	return( 0 );
+}
+
+static void
+vips_foreign_save_gif_buffer_class_init(
+	VipsForeignSaveGifBufferClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	object_class->nickname = "gifsave_buffer";
+	object_class->description = _( "save image to gif buffer" );
+	object_class->build = vips_foreign_save_gif_buffer_build;
+
+	VIPS_ARG_BOXED( class, "buffer", 1,
+		_( "Buffer" ),
+		_( "Buffer to save to" ),
+		VIPS_ARGUMENT_REQUIRED_OUTPUT,
+		G_STRUCT_OFFSET( VipsForeignSaveGifBuffer, buf ),
+		VIPS_TYPE_BLOB );
+
+}
+
+static void
+vips_foreign_save_gif_buffer_init( VipsForeignSaveGifBuffer *buffer )
+{
+}
+
+#endif /*defined(HAVE_GIFLIB) && defined(HAVE_IMAGEQUANT)*/
+
+/**
+ * vips_gifsave: (method)
+ * @in: image to save
+ * @filename: file to write to
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Optional arguments:
+ *
+ * * @colours: %gint, max number of palette colours
+ * * @Q: %gint, quantisation quality
+ * * @dither: %gdouble, amount of dithering
+ *
+ * Write an image to a file in GIF format.
+ *
+ * Pages are palettised with libimagequant in background threads as they
+ * are computed, then LZW compressed in order, so the whole animation is
+ * never held in memory. Pages with no more than @colours distinct values
+ * are palettised exactly. Set @Q and @dither as for vips_pngsave().
+ *
+ * The first page's palette is written as the global colour table. Later
+ * pages are remapped to it if every colour they use is within a few levels 
+ * of a global colour, otherwise they get a local colour table. Pages with 
+ * few enough colours to palettise exactly only reuse the global table if
+ * it holds all their colours.
+ *
+ * Alpha is thresholded at 128, since GIF only supports one transparent
+ * colour.
+ *
+ * Use the metadata items `loop` and `delay` to set the number of loops for
+ * the animation and the frame delays. `gif-comment` is saved unless @strip
+ * is set.
+ *
+ * See also: vips_gifload(), vips_image_write_to_file().
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_gifsave( VipsImage *in, const char *filename, ... )
+{
+	va_list ap;
+	int result;
+
+	va_start( ap, filename );
+	result = vips_call_split( "gifsave", ap, in, filename );
+	va_end( ap );
+
+	return( result );
+}
+
+/**
+ * vips_gifsave_buffer: (method)
+ * @in: image to save
+ * @buf: (array length=len) (element-type guint8): return output buffer here
+ * @len: (type gsize): return output length here
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Optional arguments:
+ *
+ * * @colours: %gint, max number of palette colours
+ * * @Q: %gint, quantisation quality
+ * * @dither: %gdouble, amount of dithering
+ *
+ * As vips_gifsave(), but save to a memory buffer.
+ *
+ * The address of the buffer is returned in @buf, the length of the buffer in
+ * @len. You are responsible for freeing the buffer with g_free() when you
+ * are done with it.
+ *
+ * See also: vips_gifsave(), vips_image_write_to_file().
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_gifsave_buffer( VipsImage *in, void **buf, size_t *len, ... )
+{
+	va_list ap;
+	VipsArea *area;
+	int result;
+
+	area = NULL;
+
+	va_start( ap, len );
+	result = vips_call_split( "gifsave_buffer", ap, in, &area );
+	va_end( ap );
+
+	if( !result &&
+		area ) {
+		if( buf ) {
+			*buf = area->data;
+			area->free_fn = NULL;
+		}
+		if( len )
+			*len = area->length;
+
+		vips_area_unref( area );
+	}
+
+	return( result );
+}
+
+/**
+ * vips_gifsave_target: (method)
+ * @in: image to save
+ * @target: save image to this target
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Optional arguments:
+ *
+ * * @colours: %gint, max number of palette colours
+ * * @Q: %gint, quantisation quality
+ * * @dither: %gdouble, amount of dithering
+ *
+ * As vips_gifsave(), but save to a target.
+ *
+ * See also: vips_gifsave().
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_gifsave_target( VipsImage *in, VipsTarget *target, ... )
+{
+	va_list ap;
+	int result;
+
+	va_start( ap, target );
+	result = vips_call_split( "gifsave_target", ap, in, target );
+	va_end( ap );
+
+	return( result );
+}
@@ -225,6 +225,9 @@ gboolean vips_foreign_load_pdf_is_a( const char *filename );
 int vips__quantise_image( VipsImage *in, 
 	VipsImage **index_out, VipsImage **palette_out,
 	int colours, int Q, double dither );
+int vips__quantise_rgba( VipsPel *rgba, int width, int height,
+	int colours, int Q, double dither,
+	VipsPel *index, VipsPel *palette, int *n_palette );
 
 extern const char *vips__nifti_suffs[];
 
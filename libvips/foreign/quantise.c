@@ -2,6 +2,8 @@
  *
  * 20/6/18 
  * 	  - from vipspng.c
+ * 18/10/20
+ * 	- add vips__quantise_rgba() for raw buffers, for gifsave
  */
 
 /*
@@ -41,6 +43,8 @@
 #endif /*HAVE_CONFIG_H*/
 #include <vips/intl.h>
 
+#include <string.h>
+
 #include <vips/vips.h>
 
 #ifdef HAVE_IMAGEQUANT
@@ -59,9 +63,6 @@ typedef struct _Quantise {
        	int Q;
        	double dither;
 
-	liq_attr *attr;
-	liq_image *input_image;
-	liq_result *quantisation_result;
 	VipsImage *t[5];
 } Quantise;
 
@@ -70,10 +71,6 @@ vips__quantise_free( Quantise *quantise )
 {
 	int i;
 
-	VIPS_FREEF( liq_result_destroy, quantise->quantisation_result );
-	VIPS_FREEF( liq_image_destroy, quantise->input_image );
-	VIPS_FREEF( liq_attr_destroy, quantise->attr );
-
 	for( i = 0; i < VIPS_NUMBER( quantise->t ); i++ )
 		VIPS_UNREF( quantise->t[i] ); 
 
@@ -101,6 +98,66 @@ vips__quantise_new( VipsImage *in,
 	return( quantise ); 
 }
 
+/* Quantise a width * height RGBA buffer. Write one byte per pixel to 
+ * @index, and up to 256 RGBA entries to @palette, setting @n_palette. 
+ *
+ * This is safe to call from many threads at once, gifsave uses it to
+ * palettise several pages in parallel.
+ */
+int
+vips__quantise_rgba( VipsPel *rgba, int width, int height,
+	int colours, int Q, double dither,
+	VipsPel *index, VipsPel *palette, int *n_palette )
+{
+	liq_attr *attr;
+	liq_image *image;
+	liq_result *result;
+	const liq_palette *lp;
+	int i;
+
+	attr = liq_attr_create();
+	liq_set_max_colors( attr, colours );
+	liq_set_quality( attr, 0, Q );
+
+	image = liq_image_create_rgba( attr, rgba, width, height, 0 );
+
+	if( liq_image_quantize( image, attr, &result ) ) {
+		vips_error( "quantise", "%s", _( "quantisation failed" ) );
+		liq_image_destroy( image );
+		liq_attr_destroy( attr );
+		return( -1 );
+	}
+
+	liq_set_dithering_level( result, dither );
+
+	if( liq_write_remapped_image( result, image, 
+		index, (size_t) width * height ) ) {
+		vips_error( "quantise", "%s", _( "quantisation failed" ) );
+		liq_result_destroy( result );
+		liq_image_destroy( image );
+		liq_attr_destroy( attr );
+		return( -1 );
+	}
+
+	lp = liq_get_palette( result );
+
+	for( i = 0; i < lp->count; i++ ) {
+		VipsPel *p = palette + i * 4;
+
+		p[0] = lp->entries[i].r;
+		p[1] = lp->entries[i].g;
+		p[2] = lp->entries[i].b;
+		p[3] = lp->entries[i].a;
+	}
+	*n_palette = lp->count;
+
+	liq_result_destroy( result );
+	liq_image_destroy( image );
+	liq_attr_destroy( attr );
+
+	return( 0 );
+}
+
 int
 vips__quantise_image( VipsImage *in, 
 	VipsImage **index_out, VipsImage **palette_out,
@@ -109,8 +166,8 @@ vips__quantise_image( VipsImage *in,
 	Quantise *quantise;
 	VipsImage *index;
 	VipsImage *palette;
-	const liq_palette *lp;
-	int i;
+	VipsPel entries[256 * 4];
+	int n_entries;
 
 	quantise = vips__quantise_new( in, index_out, palette_out, 
 		colours, Q, dither );
@@ -142,44 +199,22 @@ vips__quantise_image( VipsImage *in,
 	}
 	in = quantise->t[2];
 
-	quantise->attr = liq_attr_create();
-	liq_set_max_colors( quantise->attr, colours );
-	liq_set_quality( quantise->attr, 0, Q );
-
-	quantise->input_image = liq_image_create_rgba( quantise->attr,
-		VIPS_IMAGE_ADDR( in, 0, 0 ), in->Xsize, in->Ysize, 0 );
-
-	if( liq_image_quantize( quantise->input_image, quantise->attr, 
-		&quantise->quantisation_result ) ) {
-		vips_error( "vips2png", "%s", _( "quantisation failed" ) );
-		vips__quantise_free( quantise ); 
-		return( -1 );
-	}
-
-	liq_set_dithering_level( quantise->quantisation_result, dither );
-
 	index = quantise->t[3] = vips_image_new_memory();
 	vips_image_init_fields( index, 
 		in->Xsize, in->Ysize, 1, VIPS_FORMAT_UCHAR,
 		VIPS_CODING_NONE, VIPS_INTERPRETATION_B_W, 1.0, 1.0 );
 
-	if( vips_image_write_prepare( index ) ) {
+	if( vips_image_write_prepare( index ) ||
+		vips__quantise_rgba( VIPS_IMAGE_ADDR( in, 0, 0 ), 
+			in->Xsize, in->Ysize, colours, Q, dither,
+			VIPS_IMAGE_ADDR( index, 0, 0 ), 
+			entries, &n_entries ) ) {
 		vips__quantise_free( quantise ); 
 		return( -1 );
 	}
 
-	if( liq_write_remapped_image( quantise->quantisation_result, 
-		quantise->input_image,
-		VIPS_IMAGE_ADDR( index, 0, 0 ), VIPS_IMAGE_N_PELS( index ) ) ) {
-		vips_error( "vips2png", "%s", _( "quantisation failed" ) );
-		vips__quantise_free( quantise ); 
-		return( -1 );
-	}
-
-	lp = liq_get_palette( quantise->quantisation_result );
-
 	palette = quantise->t[4] = vips_image_new_memory();
-	vips_image_init_fields( palette, lp->count, 1, 4,
+	vips_image_init_fields( palette, n_entries, 1, 4,
 		VIPS_FORMAT_UCHAR, VIPS_CODING_NONE, VIPS_INTERPRETATION_sRGB,
 		1.0, 1.0 );
 
@@ -188,14 +223,7 @@ vips__quantise_image( VipsImage *in,
 		return( -1 );
 	}
 
-	for( i = 0; i < lp->count; i++ ) {
-		unsigned char *p = VIPS_IMAGE_ADDR( palette, i, 0 );
-
-		p[0] = lp->entries[i].r;
-		p[1] = lp->entries[i].g;
-		p[2] = lp->entries[i].b;
-		p[3] = lp->entries[i].a;
-	}
+	memcpy( VIPS_IMAGE_ADDR( palette, 0, 0 ), entries, n_entries * 4 );
 
 	*index_out = index;
 	g_object_ref( index );
@@ -220,5 +248,16 @@ vips__quantise_image( VipsImage *in,
   return( -1 );
 }
 
+int
+vips__quantise_rgba( VipsPel *rgba, int width, int height,
+	int colours, int Q, double dither,
+	VipsPel *index, VipsPel *palette, int *n_palette )
+{
+	vips_error( "vips__quantise_rgba", 
+		"%s", _( "libvips not built with quantisation support" ) ); 
+
+	return( -1 );
+}
+
 #endif /*HAVE_IMAGEQUANT*/
 
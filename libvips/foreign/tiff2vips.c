@@ -197,6 +197,8 @@
  * 	- read logluv images as XYZ
  * 11/4/20 petoor 
  * 	- better handling of aligned reads in multipage tiffs
+ * 18/10/20
+ * 	- read 16-bit float images
  */
 
 /*
@@ -965,6 +967,93 @@ rtiff_parse_logluv( Rtiff *rtiff, VipsImage *out )
 	return( 0 );
 }
 
+/* Expand an IEEE 754 half to a float. Normals just need a rebias of the
+ * exponent, inf and nan keep their max exponent, and denormals are
+ * renormalised with a float subtract.
+ */
+static float
+rtiff_half_to_float( guint16 h )
+{
+	static const guint32 shifted_exp = 0x7c00 << 13;
+
+	union { guint32 u; float f; } o, magic;
+	guint32 exp;
+
+	magic.u = 113 << 23;
+	o.u = (h & 0x7fff) << 13;
+	exp = shifted_exp & o.u;
+	o.u += (127 - 15) << 23;
+
+	if( exp == shifted_exp ) 
+		o.u += (128 - 16) << 23;
+	else if( exp == 0 ) {
+		o.u += 1 << 23;
+		o.f -= magic.f;
+	}
+
+	o.u |= (guint32) (h & 0x8000) << 16;
+
+	return( o.f );
+}
+
+/* Per-scanline process function for 16-bit float images. We expand to 32-bit
+ * float, inverting the first band for MINISWHITE.
+ */
+static void
+rtiff_half_line( Rtiff *rtiff, VipsPel *q, VipsPel *p, int n, void *dummy )
+{
+	int samples_per_pixel = rtiff->header.samples_per_pixel;
+	gboolean invert = rtiff->header.photometric_interpretation == 
+		PHOTOMETRIC_MINISWHITE;
+	guint16 *p1 = (guint16 *) p;
+	float *q1 = (float *) q;
+
+	int x, i;
+
+	for( x = 0; x < n; x++ ) {
+		for( i = 0; i < samples_per_pixel; i++ ) 
+			q1[i] = rtiff_half_to_float( p1[i] );
+
+		if( invert )
+			q1[0] = 1.0 - q1[0];
+
+		q1 += samples_per_pixel;
+		p1 += samples_per_pixel;
+	}
+}
+
+/* 16-bit float images are expanded to float. 
+ */
+static int
+rtiff_parse_half( Rtiff *rtiff, VipsImage *out )
+{
+	int samples_per_pixel = rtiff->header.samples_per_pixel;
+	int photometric_interpretation = 
+		rtiff->header.photometric_interpretation;
+
+	if( rtiff_check_min_samples( rtiff, 1 ) ||
+		rtiff_check_bits( rtiff, 16 ) )
+		return( -1 );
+
+	out->Bands = samples_per_pixel; 
+	out->BandFmt = VIPS_FORMAT_FLOAT; 
+	out->Coding = VIPS_CODING_NONE; 
+
+	if( photometric_interpretation == PHOTOMETRIC_MINISWHITE ||
+		photometric_interpretation == PHOTOMETRIC_MINISBLACK ) 
+		out->Type = VIPS_INTERPRETATION_B_W; 
+	else if( samples_per_pixel >= 3 &&
+		(photometric_interpretation == PHOTOMETRIC_RGB ||
+		 photometric_interpretation == PHOTOMETRIC_YCBCR) ) 
+		out->Type = VIPS_INTERPRETATION_scRGB; 
+	else
+		out->Type = VIPS_INTERPRETATION_MULTIBAND;
+
+	rtiff->sfn = rtiff_half_line;
+
+	return( 0 );
+}
+
 /* Per-scanline process function for 1 bit images.
  */
 static void
@@ -1463,6 +1552,10 @@ rtiff_pick_reader( Rtiff *rtiff )
 	if( photometric_interpretation == PHOTOMETRIC_LOGLUV ) 
 		return( rtiff_parse_logluv );
 
+	if( bits_per_sample == 16 &&
+		rtiff->header.sample_format == SAMPLEFORMAT_IEEEFP )
+		return( rtiff_parse_half );
+
 	if( photometric_interpretation == PHOTOMETRIC_MINISWHITE ||
 		photometric_interpretation == PHOTOMETRIC_MINISBLACK ) {
 		if( bits_per_sample == 1 )
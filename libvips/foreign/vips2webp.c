@@ -18,6 +18,8 @@
  * 	- set loop even if we strip
  * 14/10/19
  * 	- revise for target IO
+ * 18/10/20
+ * 	- write animations a frame at a time from vips_sink_disc()
  */
 
 /*
@@ -100,6 +102,21 @@ typedef struct {
 	 */
 	WebPAnimEncoder *enc;
 
+	/* Animations are built a frame at a time. sink_disc fills this
+	 * buffer, and we add it to the encoder when we have a whole page.
+	 */
+	int page_height;
+	VipsPel *frame_bytes;
+	int frame_lines;
+	int page_index;
+	int timestamp_ms;
+
+	/* Frame delays, from metadata.
+	 */
+	int gif_delay;
+	int *delay;
+	int delay_length;
+
 	/* Add metadata with this.
 	 */
 	WebPMux *mux;
@@ -136,6 +153,7 @@ vips_webp_write_unset( VipsWebPWrite *write )
 {
 	WebPMemoryWriterClear( &write->memory_writer );
 	VIPS_FREEF( WebPAnimEncoderDelete, write->enc );
+	VIPS_FREEF( vips_tracked_free, write->frame_bytes );
 	VIPS_FREEF( WebPMuxDelete, write->mux );
 	VIPS_UNREF( write->image );
 }
@@ -162,6 +180,14 @@ vips_webp_write_init( VipsWebPWrite *write, VipsImage *image,
 	write->strip = strip;
 	WebPMemoryWriterInit( &write->memory_writer );
 	write->enc = NULL;
+	write->page_height = 0;
+	write->frame_bytes = NULL;
+	write->frame_lines = 0;
+	write->page_index = 0;
+	write->timestamp_ms = 0;
+	write->gif_delay = 4;
+	write->delay = NULL;
+	write->delay_length = 0;
 	write->mux = NULL;
 
 	/* Rebuild exif on image. We must do this on a copy. 
@@ -230,38 +256,50 @@ vips_webp_pic_init( VipsWebPWrite *write, WebPPicture *pic )
 	return( TRUE );
 }
 
-/* Write a VipsImage into an unintialised pic.
+/* Import a memory buffer of RGB or RGBA pixels into an unintialised pic.
  */
 static int
-write_webp_image( VipsWebPWrite *write, VipsImage *image, WebPPicture *pic ) 
+write_webp_pixels( VipsWebPWrite *write, WebPPicture *pic, 
+	VipsPel *pixels, int width, int height, int bands )
 {
-	VipsImage *memory;
 	webp_import import;
 
 	if( !vips_webp_pic_init( write, pic ) ) 
 		return( -1 );
 
-	if( !(memory = vips_image_copy_memory( image )) ) {
-		WebPPictureFree( pic );
-		return( -1 );
-	}
+	pic->width = width;
+	pic->height = height;
 
-	pic->width = memory->Xsize;
-	pic->height = memory->Ysize;
-
-	if( memory->Bands == 4 )
+	if( bands == 4 )
 		import = WebPPictureImportRGBA;
 	else
 		import = WebPPictureImportRGB;
 
-	if( !import( pic, VIPS_IMAGE_ADDR( memory, 0, 0 ),
-		VIPS_IMAGE_SIZEOF_LINE( memory ) ) ) {
-		VIPS_UNREF( memory );
+	if( !import( pic, pixels, width * bands ) ) {
 		WebPPictureFree( pic );
 		vips_error( "vips2webp", "%s", _( "picture memory error" ) );
 		return( -1 );
 	}
 
+	return( 0 );
+}
+
+/* Write a VipsImage into an unintialised pic.
+ */
+static int
+write_webp_image( VipsWebPWrite *write, VipsImage *image, WebPPicture *pic ) 
+{
+	VipsImage *memory;
+
+	if( !(memory = vips_image_copy_memory( image )) ) 
+		return( -1 );
+
+	if( write_webp_pixels( write, pic, VIPS_IMAGE_ADDR( memory, 0, 0 ),
+		memory->Xsize, memory->Ysize, memory->Bands ) ) {
+		VIPS_UNREF( memory );
+		return( -1 );
+	}
+
 	VIPS_UNREF( memory );
 
 	return( 0 );
@@ -290,18 +328,78 @@ write_webp_single( VipsWebPWrite *write, VipsImage *image )
 	return( 0 );
 }
 
-/* Write a set of animated frames into write->memory_writer.
+/* We have a complete page in frame_bytes: add it to the animation.
+ */
+static int
+write_webp_frame( VipsWebPWrite *write )
+{
+	VipsImage *image = write->image;
+
+	WebPPicture pic;
+
+	if( write_webp_pixels( write, &pic, write->frame_bytes,
+		image->Xsize, write->page_height, image->Bands ) )
+		return( -1 );
+
+	/* The encoder does its own frame differencing, and will merge
+	 * unchanged frames into the previous one.
+	 */
+	if( !WebPAnimEncoderAdd( write->enc, 
+		&pic, write->timestamp_ms, &write->config ) ) {
+		WebPPictureFree( &pic );
+		vips_error( "vips2webp",
+			"%s", _( "anim add error" ) );
+		return( -1 );
+	}
+
+	WebPPictureFree( &pic );
+
+	if( write->delay &&
+		write->page_index < write->delay_length )
+		write->timestamp_ms += write->delay[write->page_index];
+	else 
+		write->timestamp_ms += write->gif_delay * 10;
+
+	write->page_index += 1;
+	write->frame_lines = 0;
+
+	return( 0 );
+}
+
+/* sink_disc callback. Strips don't line up with pages, so copy lines
+ * into frame_bytes and send each page off as it fills.
+ */
+static int
+write_webp_anim_block( VipsRegion *region, VipsRect *area, void *a )
+{
+	VipsWebPWrite *write = (VipsWebPWrite *) a;
+	size_t sizeof_line = VIPS_IMAGE_SIZEOF_LINE( region->im );
+
+	int y;
+
+	for( y = 0; y < area->height; y++ ) {
+		memcpy( write->frame_bytes + write->frame_lines * sizeof_line,
+			VIPS_REGION_ADDR( region, 0, area->top + y ),
+			sizeof_line );
+		write->frame_lines += 1;
+
+		if( write->frame_lines == write->page_height &&
+			write_webp_frame( write ) )
+			return( -1 );
+	}
+
+	return( 0 );
+}
+
+/* Write a set of animated frames into write->memory_writer. We only keep one
+ * uncompressed frame, plus the encoder's own state, so memory use does not
+ * grow with the number of uncompressed pages.
  */
 static int
 write_webp_anim( VipsWebPWrite *write, VipsImage *image, int page_height )
 {
 	WebPAnimEncoderOptions anim_config;
 	WebPData webp_data;
-	int gif_delay;
-	int *delay;
-	int delay_length;
-	int top;
-	int timestamp_ms;
 
 	if( !WebPAnimEncoderOptionsInit( &anim_config ) ) {
 		vips_error( "vips2webp",
@@ -323,58 +421,33 @@ write_webp_anim( VipsWebPWrite *write, VipsImage *image, int page_height )
 
 	/* There might just be the old gif-delay field. This is centiseconds.
 	 */
-	gif_delay = 4;
 	if( vips_image_get_typeof( image, "gif-delay" ) &&
-		vips_image_get_int( image, "gif-delay", &gif_delay ) )
+		vips_image_get_int( image, "gif-delay", &write->gif_delay ) )
 		return( -1 );
 
 	/* New images have an array of ints instead.
 	 */
-	delay = NULL;
 	if( vips_image_get_typeof( image, "delay" ) &&
 		vips_image_get_array_int( image, "delay", 
-			&delay, &delay_length ) )
+			&write->delay, &write->delay_length ) )
 		return( -1 );
 
-	timestamp_ms = 0;
-	for( top = 0; top < image->Ysize; top += page_height ) {
-		VipsImage *x;
-		WebPPicture pic;
-		int page_index;
-
-		if( vips_crop( image, &x, 
-			0, top, image->Xsize, page_height, NULL ) )
-			return( -1 );
-
-		if( write_webp_image( write, x, &pic ) ) {
-			VIPS_UNREF( x ); 
-			return( -1 );
-		}
-
-		VIPS_UNREF( x ); 
-
-		if( !WebPAnimEncoderAdd( write->enc, 
-			&pic, timestamp_ms, &write->config ) ) {
-			WebPPictureFree( &pic );
-			vips_error( "vips2webp",
-				"%s", _( "anim add error" ) );
-			return( -1 );
-		}
+	write->page_height = page_height;
+	if( !(write->frame_bytes = vips_tracked_malloc( 
+		VIPS_IMAGE_SIZEOF_LINE( image ) * page_height )) )
+		return( -1 );
 
-		WebPPictureFree( &pic );
+	if( vips_sink_disc( image, write_webp_anim_block, write ) )
+		return( -1 );
 
-		page_index = top / page_height;
-		if( delay &&
-			page_index < delay_length )
-			timestamp_ms += delay[page_index];
-		else 
-			timestamp_ms += gif_delay * 10;
-	}
+	/* Don't need the frame any more.
+	 */
+	VIPS_FREEF( vips_tracked_free, write->frame_bytes );
 
 	/* Closes encoder and adds last frame delay.
 	 */
 	if( !WebPAnimEncoderAdd( write->enc, 
-		NULL, timestamp_ms, NULL ) ) {
+		NULL, write->timestamp_ms, NULL ) ) {
 		vips_error( "vips2webp",
 			"%s", _( "anim close error" ) );
 		return( -1 );
@@ -17,6 +17,8 @@
  * 	- redone as a class
  * 19/6/17
  * 	- make output format always == input format, thanks Simon
+ * 18/10/20
+ * 	- only compute @in once
  */
 
 /*
@@ -54,6 +56,7 @@
 #include <stdio.h>
 
 #include <vips/vips.h>
+#include <vips/internal.h>
 
 typedef struct _VipsHistEqual { 
 	VipsOperation parent_instance;
@@ -74,23 +77,27 @@ static int
 vips_hist_equal_build( VipsObject *object )
 {
 	VipsHistEqual *equal = (VipsHistEqual *) object; 
-	VipsImage **t = (VipsImage **) vips_object_local_array( object, 5 );
+	VipsImage **t = (VipsImage **) vips_object_local_array( object, 6 );
 
 	g_object_set( equal, "out", vips_image_new(), NULL ); 
 
 	if( VIPS_OBJECT_CLASS( vips_hist_equal_parent_class )->build( object ) )
 		return( -1 );
 
-	/* norm can return a uchar output for a ushort input if the range is
+	/* We scan @in twice, see vips__image_two_pass(). A partial @in is
+	 * rendered now, during build, as vips_hist_find() would anyway.
+	 *
+	 * norm can return a uchar output for a ushort input if the range is
 	 * small, so make sure we cast back to the input type again.
 	 */
-	if( vips_hist_find( equal->in, &t[0], 
+	if( vips__image_two_pass( equal->in, &t[5] ) ||
+		vips_hist_find( t[5], &t[0], 
 			"band", equal->which,
 			NULL ) ||
 		vips_hist_cum( t[0], &t[1], NULL ) ||
 		vips_hist_norm( t[1], &t[2], NULL ) ||
 		vips_cast( t[2], &t[3], equal->in->BandFmt, NULL ) ||
-		vips_maplut( equal->in, &t[4], t[3], NULL ) ||
+		vips_maplut( t[5], &t[4], t[3], NULL ) ||
 		vips_image_write( t[4], equal->out ) )
 		return( -1 );
 
@@ -22,6 +22,8 @@
  * 	- small cleanups
  * 12/8/13	
  * 	- redone im_histnorm() as a class, vips_hist_norm()
+ * 18/10/20
+ * 	- only compute @in once
  */
 
 /*
@@ -59,6 +61,7 @@
 #include <stdio.h>
 
 #include <vips/vips.h>
+#include <vips/internal.h>
 
 typedef struct _VipsHistNorm {
 	VipsOperation parent_instance;
@@ -75,7 +78,7 @@ static int
 vips_hist_norm_build( VipsObject *object )
 {
 	VipsHistNorm *norm = (VipsHistNorm *) object;
-	VipsImage **t = (VipsImage **) vips_object_local_array( object, 3 );
+	VipsImage **t = (VipsImage **) vips_object_local_array( object, 4 );
 
 	guint64 new_max;
 	int bands; 
@@ -88,9 +91,12 @@ vips_hist_norm_build( VipsObject *object )
 	if( VIPS_OBJECT_CLASS( vips_hist_norm_parent_class )->build( object ) )
 		return( -1 );
 
-	/* Need max for each channel.
+	/* Need max for each channel. We scan @in twice, see 
+	 * vips__image_two_pass(). A partial @in is rendered now, during
+	 * build, as vips_stats() would anyway.
 	 */
-	if( vips_stats( norm->in, &t[0], NULL ) )
+	if( vips__image_two_pass( norm->in, &t[3] ) ||
+		vips_stats( t[3], &t[0], NULL ) )
 		return( -1 ); 
 
 	/* Scale each channel by px / channel max
@@ -105,7 +111,7 @@ vips_hist_norm_build( VipsObject *object )
 		b[y] = 0;
 	}
 
-	if( vips_linear( norm->in, &t[1], a, b, bands, NULL ) )
+	if( vips_linear( t[3], &t[1], a, b, bands, NULL ) )
 		return( -1 );
 
 	/* Make output format as small as we can.
@@ -33,6 +33,9 @@
  * 	- convert to a class
  * 2/10/13
  * 	- add --band arg, replacing im_tone_map()
+ * 18/10/20
+ * 	- map many-band images a pixel at a time
+ * 	- fold chains of one-band maplut into a single LUT
  */
 
 /*
@@ -95,6 +98,33 @@ typedef VipsOperationClass VipsMaplutClass;
 
 G_DEFINE_TYPE( VipsMaplut, vips_maplut, VIPS_TYPE_OPERATION );
 
+/* Images made by a simple maplut (one-band, non-complex LUT applied to all
+ * bands) get one of these attached, so a following maplut can map the source
+ * image through a composed LUT instead.
+ */
+typedef struct _VipsMaplutSource {
+	VipsImage *in;
+	VipsImage *lut;
+} VipsMaplutSource;
+
+static GQuark vips_maplut_source_quark = 0;
+
+static void
+vips_maplut_source_free( VipsMaplutSource *source )
+{
+	VIPS_UNREF( source->in );
+	VIPS_UNREF( source->lut );
+	g_free( source );
+}
+
+static gboolean
+vips_maplut_is_simple( VipsMaplut *maplut, VipsImage *lut )
+{
+	return( maplut->band < 0 &&
+		lut->Bands == 1 &&
+		!vips_band_format_iscomplex( lut->BandFmt ) );
+}
+
 static void
 vips_maplut_preeval( VipsImage *image, VipsProgress *progress, 
 	VipsMaplut *maplut )
@@ -139,20 +169,33 @@ vips_maplut_start( VipsImage *out, void *a, void *b )
 	return( seq );
 }
 
-/* Map through n non-complex luts.
+/* Map through n non-complex luts. Go a pixel at a time, so we only make
+ * one pass over each line. Three bands is common enough to be worth a
+ * special case.
  */
 #define loop( OUT ) { \
 	int b = maplut->nb; \
+	OUT **tlut = (OUT **) maplut->table; \
 	\
 	for( y = to; y < bo; y++ ) { \
-		for( z = 0; z < b; z++ ) { \
-			VipsPel *p = VIPS_REGION_ADDR( ir, le, y ); \
-			OUT *q = (OUT *) VIPS_REGION_ADDR( or, le, y ); \
-			OUT *tlut = (OUT *) maplut->table[z]; \
+		VipsPel *p = VIPS_REGION_ADDR( ir, le, y ); \
+		OUT *q = (OUT *) VIPS_REGION_ADDR( or, le, y ); \
+		\
+		if( b == 3 ) { \
+			OUT *t0 = tlut[0]; \
+			OUT *t1 = tlut[1]; \
+			OUT *t2 = tlut[2]; \
 			\
-			for( x = z; x < ne; x += b ) \
-				q[x] = tlut[p[x]]; \
+			for( x = 0; x < ne; x += 3 ) { \
+				q[x] = t0[p[x]]; \
+				q[x + 1] = t1[p[x + 1]]; \
+				q[x + 2] = t2[p[x + 2]]; \
+			} \
 		} \
+		else \
+			for( x = 0; x < ne; x += b ) \
+				for( z = 0; z < b; z++ ) \
+					q[x + z] = tlut[z][p[x + z]]; \
 	} \
 }
 
@@ -180,24 +223,24 @@ vips_maplut_start( VipsImage *out, void *a, void *b )
 
 #define loopg( IN, OUT ) { \
 	int b = maplut->nb; \
+	int clp = maplut->clp; \
+	OUT **tlut = (OUT **) maplut->table; \
 	\
 	for( y = to; y < bo; y++ ) { \
-		for( z = 0; z < b; z++ ) { \
-			IN *p = (IN *) VIPS_REGION_ADDR( ir, le, y ); \
-			OUT *q = (OUT *) VIPS_REGION_ADDR( or, le, y ); \
-			OUT *tlut = (OUT *) maplut->table[z]; \
-			\
-			for( x = z; x < ne; x += b ) { \
-				int index = p[x]; \
+		IN *p = (IN *) VIPS_REGION_ADDR( ir, le, y ); \
+		OUT *q = (OUT *) VIPS_REGION_ADDR( or, le, y ); \
+		\
+		for( x = 0; x < ne; x += b ) \
+			for( z = 0; z < b; z++ ) { \
+				int index = p[x + z]; \
 				\
-				if( index > maplut->clp ) { \
-					index = maplut->clp; \
+				if( index > clp ) { \
+					index = clp; \
 					seq->overflow++; \
 				} \
 				\
-				q[x] = tlut[index]; \
+				q[x + z] = tlut[z][index]; \
 			} \
-		} \
 	} \
 }
 
@@ -558,10 +601,12 @@ vips_maplut_build( VipsObject *object )
 {
 	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( object );
 	VipsMaplut *maplut = (VipsMaplut *) object;
-	VipsImage **t = (VipsImage **) vips_object_local_array( object, 2 );
+	VipsImage **t = (VipsImage **) vips_object_local_array( object, 3 );
 
 	VipsImage *in;
 	VipsImage *lut;
+	VipsImage *source_in;
+	VipsMaplutSource *source;
 	int i;
 
 	g_object_set( object, "out", vips_image_new(), NULL ); 
@@ -576,6 +621,21 @@ vips_maplut_build( VipsObject *object )
 		vips_check_uncoded( class->nickname, lut ) )
 		return( -1 );
 
+	/* If @in was made by a simple maplut and we are one too, map our 
+	 * LUT through the previous one and run that on the previous input. 
+	 * The previous LUT is cast to make an index in exactly the way the 
+	 * previous output would have been, so the result is the same.
+	 */
+	if( vips_maplut_is_simple( maplut, lut ) &&
+		(source = g_object_get_qdata( G_OBJECT( in ), 
+			vips_maplut_source_quark )) ) {
+		if( vips_maplut( source->lut, &t[2], lut, NULL ) )
+			return( -1 );
+		in = source->in;
+		lut = t[2];
+	}
+	source_in = in;
+
 	/* Cast @in to u8/u16/u32 to make the index image.
 	 */
 	if( vips_cast( in, &t[0], bandfmt_maplut[in->BandFmt], NULL ) )
@@ -671,6 +731,17 @@ vips_maplut_build( VipsObject *object )
 		in, maplut ) )
 		return( -1 );
 
+	if( vips_maplut_is_simple( maplut, lut ) ) {
+		source = g_new( VipsMaplutSource, 1 );
+		source->in = source_in;
+		source->lut = lut;
+		g_object_ref( source->in );
+		g_object_ref( source->lut );
+		g_object_set_qdata_full( G_OBJECT( maplut->out ), 
+			vips_maplut_source_quark, source, 
+			(GDestroyNotify) vips_maplut_source_free );
+	}
+
 	return( 0 );
 }
 
@@ -715,6 +786,8 @@ vips_maplut_class_init( VipsMaplutClass *class )
 		G_STRUCT_OFFSET( VipsMaplut, band ),
 		-1, 10000, -1 ); 
 
+	vips_maplut_source_quark = 
+		g_quark_from_static_string( "vips-maplut-source" ); 
 }
 
 static void
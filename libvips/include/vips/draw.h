@@ -88,6 +88,11 @@ int vips_draw_smudge( VipsImage *image,
 	int left, int top, int width, int height, ... ) 
 	__attribute__((sentinel));
 
+int vips_draw_batch( VipsImage *image, double *ink, int n, ... )
+	__attribute__((sentinel));
+int vips_draw_batch1( VipsImage *image, double ink, ... )
+	__attribute__((sentinel));
+
 #ifdef __cplusplus
 }
 #endif /*__cplusplus*/
@@ -53,6 +53,7 @@ int vips_sink_screen( VipsImage *in, VipsImage *out, VipsImage *mask,
 	int tile_width, int tile_height, int max_tiles,
 	int priority,
 	VipsSinkNotify notify_fn, void *a );
+int vips_sink_screen_set_viewport( VipsImage *out, VipsRect *viewport );
 
 int vips_sink_memory( VipsImage *im );
 
@@ -467,6 +467,7 @@ VipsImage *vips_image_new_temp_file( const char *format );
 int vips_image_write( VipsImage *image, VipsImage *out );
 int vips_image_write_to_file( VipsImage *image, const char *name, ... )
 	__attribute__((sentinel));
+int vips_image_write_to_files( VipsImage **image, const char **name, int n );
 int vips_image_write_to_buffer( VipsImage *in, 
 	const char *suffix, void **buf, size_t *size, ... )
 	__attribute__((sentinel));
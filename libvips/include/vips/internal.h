@@ -111,10 +111,17 @@ extern gboolean vips__cache_trace;
 extern int vips__n_active_threads;
 
 void vips__threadpool_init( void );
+void vips__concurrency_set_thread( int concurrency );
 
 void vips__cache_init( void );
+void vips__icc_cache_shutdown( void );
 
 void vips__sink_screen_init( void );
+void vips__init_packages( void );
+void vips__init_package( const char *name );
+gboolean vips__init_next_package( void );
+int vips__init_packages_n_done( void );
+void *vips__class_map_registered( GType type, VipsClassMapFn fn, void *a );
 void vips__print_renders( void );
 
 void vips__type_leak( void );
@@ -264,11 +271,14 @@ int vips_foreign_save( VipsImage *in, const char *filename, ... )
 	__attribute__((sentinel));
 
 int vips__image_intize( VipsImage *in, VipsImage **out );
+int vips__image_two_pass( VipsImage *in, VipsImage **out );
 
 void vips__reorder_init( void );
 int vips__reorder_set_input( VipsImage *image, VipsImage **in );
 void vips__reorder_clear( VipsImage *image );
 
+int vips__call_argv_build( VipsOperation *operation, int argc, char **argv );
+
 /* Window manager API.
  */
 VipsWindow *vips_window_take( VipsWindow *window, 
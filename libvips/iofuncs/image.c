@@ -20,6 +20,10 @@
  * 	- fix up vips_image_dump(), it was still using ints not enums
  * 10/12/19
  * 	- add vips_image_new_from_source() / vips_image_write_to_target()
+ * 18/10/20
+ * 	- add vips__image_two_pass()
+ * 	- add vips_image_write_to_files()
+ * 	- vips_image_write_to_files() shares the workers between the saves
  */
 
 /*
@@ -920,6 +924,7 @@ vips_image_build( VipsObject *object )
 		/* Make sure the vips saver is there ... strange things will
 		 * happen if this type is renamed or removed.
 		 */
+		vips__init_package( "foreign" );
 		g_assert( g_type_from_name( "VipsForeignSaveVips" ) );
 
 		if( !(file_op = vips_foreign_find_save( filename )) )
@@ -2706,6 +2711,110 @@ vips_image_write_to_file( VipsImage *image, const char *name, ... )
 	return( result );
 }
 
+/* One save in vips_image_write_to_files().
+ */
+typedef struct _VipsWriteToFiles {
+	VipsImage *image;
+	const char *name;
+	int concurrency;
+	int result;
+} VipsWriteToFiles;
+
+static void *
+vips_image_write_to_files_thread( void *a )
+{
+	VipsWriteToFiles *write = (VipsWriteToFiles *) a;
+
+	vips__concurrency_set_thread( write->concurrency );
+
+	write->result = vips_image_write_to_file( write->image, 
+		write->name, NULL );
+
+	return( NULL );
+}
+
+/**
+ * vips_image_write_to_files: 
+ * @image: (array length=n): images to write
+ * @name: (array length=n): write each image to this file
+ * @n: number of images
+ *
+ * Write each of @image to the corresponding @name, as 
+ * vips_image_write_to_file(), with all the saves running at the same time. 
+ *
+ * The images will usually share a pipeline, for example several resizes of 
+ * one decode. Load the source with #VIPS_ACCESS_SEQUENTIAL and the savers
+ * share a single decode, with the pixels they all need held in cache. 
+ * Memory use depends on the distance between the fastest and slowest saver.
+ *
+ * The workers set by vips_concurrency_set() are shared between the saves, 
+ * so each save runs with a fraction of the usual number of threads. 
+ *
+ * Save options may be appended to each @name as "[name=value,...]".
+ *
+ * See also: vips_image_write_to_file(), vips_sequential().
+ *
+ * Returns: 0 on success, or -1 on error.
+ */
+int
+vips_image_write_to_files( VipsImage **image, const char **name, int n )
+{
+	VipsWriteToFiles *write;
+	GThread **thread;
+	int concurrency;
+	int result;
+	int i;
+
+	write = VIPS_ARRAY( NULL, n, VipsWriteToFiles );
+	thread = VIPS_ARRAY( NULL, n, GThread * );
+	if( !write ||
+		!thread ) {
+		VIPS_FREE( write );
+		VIPS_FREE( thread );
+		return( -1 );
+	}
+
+	/* Each save needs its own image to sink from, since progress and
+	 * the eval signals are per-image.
+	 *
+	 * Share the workers between the saves, so we run about as many
+	 * threads as a single save would.
+	 */
+	concurrency = vips_concurrency_get();
+	result = 0;
+	for( i = 0; i < n; i++ ) {
+		write[i].image = NULL;
+		write[i].name = name[i];
+		write[i].concurrency = VIPS_MAX( 1, 
+			concurrency / n + (i < concurrency % n ? 1 : 0) );
+		write[i].result = 0;
+		thread[i] = NULL;
+
+		if( vips_copy( image[i], &write[i].image, NULL ) )
+			result = -1;
+	}
+
+	for( i = 0; i < n && !result; i++ ) 
+		if( !(thread[i] = vips_g_thread_new( "write_to_files", 
+			vips_image_write_to_files_thread, &write[i] )) )
+			result = -1;
+
+	for( i = 0; i < n; i++ ) {
+		if( thread[i] ) {
+			(void) vips_g_thread_join( thread[i] );
+			if( write[i].result )
+				result = -1;
+		}
+
+		VIPS_UNREF( write[i].image );
+	}
+
+	VIPS_FREE( write );
+	VIPS_FREE( thread );
+
+	return( result );
+}
+
 /**
  * vips_image_write_to_buffer: (method)
  * @in: image to write
@@ -3351,6 +3460,55 @@ vips_image_copy_memory( VipsImage *image )
 	return( new );
 }
 
+/* Operations like hist_equal() and scale() scan their input for a statistic
+ * and then process it again. If the input is a partial image, the whole
+ * upstream pipeline (decode, resize, ...) is computed twice, and sequential
+ * sources can't be read twice at all. 
+ *
+ * Random access images are cheap to reread, so we stream them twice, as 
+ * before. Only small ones, under the disc threshold, are kept in memory to 
+ * save the second computation. Sequential images must be rendered once, to 
+ * memory or to a temporary file if they are large, the same rule the 
+ * loaders use.
+ *
+ * The render happens here, when the caller is built, and not on first 
+ * generate. Every caller computes its statistic during build anyway, so 
+ * this adds no time, but the copy (up to the disc threshold in memory) is 
+ * held until the caller's output is freed.
+ */
+int
+vips__image_two_pass( VipsImage *in, VipsImage **out )
+{
+	gboolean small = 
+		VIPS_IMAGE_SIZEOF_IMAGE( in ) <= vips_get_disc_threshold();
+
+	VipsImage *new;
+
+	if( in->dtype != VIPS_IMAGE_PARTIAL ||
+		(!small && !vips_image_is_sequential( in )) ) {
+		g_object_ref( in );
+		*out = in;
+
+		return( 0 );
+	}
+
+	if( !small ) {
+		if( !(new = vips_image_new_temp_file( "%s.v" )) )
+			return( -1 );
+	}
+	else
+		new = vips_image_new_memory();
+
+	if( vips_image_write( in, new ) ) {
+		g_object_unref( new );
+		return( -1 );
+	}
+
+	*out = new;
+
+	return( 0 );
+}
+
 /**
  * vips_image_wio_input: (method)
  * @image: image to transform
@@ -30,6 +30,8 @@
  * 	- hide warnings is VIPS_WARNING is set
  * 20/4/19
  * 	- set the min stack, if we can
+ * 18/10/20
+ * 	- register each operation package on first use
  */
 
 /*
@@ -312,6 +314,122 @@ set_stacksize( guint64 size )
 #endif /*HAVE_PTHREAD_DEFAULT_NP*/
 }
 
+static void
+vips_system_init( void )
+{
+	extern GType vips_system_get_type( void );
+
+	(void) vips_system_get_type();
+}
+
+/* The operation packages. Registering hundreds of types is a large part of 
+ * startup, and many short-lived programs use only a few operations, so each
+ * package is registered on first use. 
+ *
+ * vips_type_find() registers packages in this order until it finds the
+ * nickname it wants, so put the most commonly used first.
+ */
+typedef struct _VipsPackageInit {
+	const char *name;
+	void (*init)( void );
+	GOnce once;
+	int done;
+} VipsPackageInit;
+
+static VipsPackageInit vips_packages[] = {
+	{ "foreign", vips_foreign_operation_init, G_ONCE_INIT, 0 },
+	{ "conversion", vips_conversion_operation_init, G_ONCE_INIT, 0 },
+	{ "resample", vips_resample_operation_init, G_ONCE_INIT, 0 },
+	{ "arithmetic", vips_arithmetic_operation_init, G_ONCE_INIT, 0 },
+	{ "colour", vips_colour_operation_init, G_ONCE_INIT, 0 },
+	{ "create", vips_create_operation_init, G_ONCE_INIT, 0 },
+	{ "histogram", vips_histogram_operation_init, G_ONCE_INIT, 0 },
+	{ "convolution", vips_convolution_operation_init, G_ONCE_INIT, 0 },
+	{ "morphology", vips_morphology_operation_init, G_ONCE_INIT, 0 },
+	{ "freqfilt", vips_freqfilt_operation_init, G_ONCE_INIT, 0 },
+	{ "draw", vips_draw_operation_init, G_ONCE_INIT, 0 },
+	{ "mosaicing", vips_mosaicing_operation_init, G_ONCE_INIT, 0 },
+	{ "system", vips_system_init, G_ONCE_INIT, 0 }
+};
+
+/* The number of packages registered so far.
+ */
+static int vips_packages_n_done = 0;
+
+static void *
+vips_package_init_cb( void *client )
+{
+	VipsPackageInit *package = (VipsPackageInit *) client;
+
+	package->init();
+	g_atomic_int_set( &package->done, 1 );
+	g_atomic_int_inc( &vips_packages_n_done );
+
+	return( NULL );
+}
+
+static void
+vips_package_init( VipsPackageInit *package )
+{
+	VIPS_ONCE( &package->once, vips_package_init_cb, package );
+}
+
+/* Register the named package, eg. "foreign".
+ */
+void
+vips__init_package( const char *name )
+{
+	int i;
+
+	for( i = 0; i < VIPS_NUMBER( vips_packages ); i++ )
+		if( strcmp( vips_packages[i].name, name ) == 0 ) {
+			vips_package_init( &vips_packages[i] );
+			break;
+		}
+}
+
+/* Register the next package that has not been registered yet. FALSE if 
+ * there are no more.
+ */
+gboolean
+vips__init_next_package( void )
+{
+	int i;
+
+	for( i = 0; i < VIPS_NUMBER( vips_packages ); i++ )
+		if( !g_atomic_int_get( &vips_packages[i].done ) ) {
+			vips_package_init( &vips_packages[i] );
+			return( TRUE );
+		}
+
+	return( FALSE );
+}
+
+/* How many packages have been registered. vips_type_find() uses this to spot
+ * new types.
+ */
+int
+vips__init_packages_n_done( void )
+{
+	return( g_atomic_int_get( &vips_packages_n_done ) );
+}
+
+/* Register all the packages, for example before we list every operation, see 
+ * vips_type_map() and vips_class_find().
+ */
+void
+vips__init_packages( void )
+{
+	int i;
+
+	if( g_atomic_int_get( &vips_packages_n_done ) == 
+		VIPS_NUMBER( vips_packages ) )
+		return;
+
+	for( i = 0; i < VIPS_NUMBER( vips_packages ); i++ )
+		vips_package_init( &vips_packages[i] );
+}
+
 /**
  * vips_init:
  * @argv0: name of application
@@ -328,7 +446,6 @@ set_stacksize( guint64 size )
 int
 vips_init( const char *argv0 )
 {
-	extern GType vips_system_get_type( void );
 	extern GType write_thread_state_get_type( void );
 	extern GType sink_memory_thread_state_get_type( void ); 
 	extern GType render_thread_state_get_type( void ); 
@@ -472,21 +589,9 @@ vips_init( const char *argv0 )
 	 */
 	vips__reorder_init();
 
-	/* Start up packages.
+	/* Operation packages are registered on first use, see 
+	 * vips__init_package() and vips_type_find().
 	 */
-	(void) vips_system_get_type();
-	vips_arithmetic_operation_init();
-	vips_conversion_operation_init();
-	vips_create_operation_init();
-	vips_foreign_operation_init();
-	vips_resample_operation_init();
-	vips_colour_operation_init();
-	vips_histogram_operation_init();
-	vips_convolution_operation_init();
-	vips_freqfilt_operation_init();
-	vips_morphology_operation_init();
-	vips_draw_operation_init();
-	vips_mosaicing_operation_init();
 	vips_g_input_stream_get_type(); 
 
 	/* Load any vips8 plugins from the vips libdir. Keep going, even if
@@ -513,7 +618,7 @@ vips_init( const char *argv0 )
 		vips_error_clear();
 	}
 
-	/* Get the run-time compiler going.
+	/* Get the run-time compiler going. orc itself starts on first use.
 	 */
 	vips_vector_init();
 
@@ -651,6 +756,11 @@ vips_shutdown( void )
 
 	vips_cache_drop_all();
 
+	/* After the operation cache, so no cached icc_transform still holds a
+	 * shared transform.
+	 */
+	vips__icc_cache_shutdown();
+
 	im_close_plugins();
 
 	/* Mustn't run this more than once. Don't use the VIPS_GATE macro,
@@ -2756,6 +2756,51 @@ vips_object_map( VipsSListMap2Fn fn, void *a, void *b )
 	return( args.result );
 }
 
+/* Map over the children of base which have been registered so far, see
+ * vips__init_package(). 
+ */
+static void *
+vips_type_map_registered( GType base, VipsTypeMap2Fn fn, void *a, void *b )
+{
+	GType *child;
+	guint n_children;
+	unsigned int i;
+	void *result;
+
+	child = g_type_children( base, &n_children );
+	result = NULL;
+	for( i = 0; i < n_children && !result; i++ )
+		result = fn( child[i], a, b );
+	g_free( child );
+
+	return( result );
+}
+
+/* As vips_class_map_all(), but don't register any more packages.
+ */
+void *
+vips__class_map_registered( GType type, VipsClassMapFn fn, void *a )
+{
+	void *result;
+
+	/* Avoid abstract classes. Use type_map_all for them.
+	 */
+	if( !G_TYPE_IS_ABSTRACT( type ) ) {
+		/* We never unref this ref, but we never unload classes
+		 * anyway, so so what.
+		 */
+		if( (result = fn( 
+			VIPS_OBJECT_CLASS( g_type_class_ref( type ) ), a )) )
+			return( result );
+	}
+
+	if( (result = vips_type_map_registered( type, 
+		(VipsTypeMap2Fn) vips__class_map_registered, fn, a )) )
+		return( result );
+
+	return( NULL );
+}
+
 /**
  * vips_type_map: (skip)
  * @base: base type
@@ -2772,18 +2817,11 @@ vips_object_map( VipsSListMap2Fn fn, void *a, void *b )
 void *
 vips_type_map( GType base, VipsTypeMap2Fn fn, void *a, void *b )
 {
-	GType *child;
-	guint n_children;
-	unsigned int i;
-	void *result;
-
-	child = g_type_children( base, &n_children );
-	result = NULL;
-	for( i = 0; i < n_children && !result; i++ )
-		result = fn( child[i], a, b );
-	g_free( child );
+	/* We want to see every type, so register all the packages.
+	 */
+	vips__init_packages();
 
-	return( result );
+	return( vips_type_map_registered( base, fn, a, b ) );
 }
 
 /**
@@ -2826,24 +2864,9 @@ vips_type_map_all( GType base, VipsTypeMapFn fn, void *a )
 void *
 vips_class_map_all( GType type, VipsClassMapFn fn, void *a )
 {
-	void *result;
-
-	/* Avoid abstract classes. Use type_map_all for them.
-	 */
-	if( !G_TYPE_IS_ABSTRACT( type ) ) {
-		/* We never unref this ref, but we never unload classes
-		 * anyway, so so what.
-		 */
-		if( (result = fn( 
-			VIPS_OBJECT_CLASS( g_type_class_ref( type ) ), a )) )
-			return( result );
-	}
-
-	if( (result = vips_type_map( type, 
-		(VipsTypeMap2Fn) vips_class_map_all, fn, a )) )
-		return( result );
+	vips__init_packages();
 
-	return( NULL );
+	return( vips__class_map_registered( type, fn, a ) );
 }
 
 /* How deeply nested is a class ... used to indent class lists.
@@ -2895,6 +2918,8 @@ vips_class_find( const char *basename, const char *nickname )
 	VipsObjectClass *class;
 	GType base;
 
+	vips__init_packages();
+
 	if( !(base = g_type_from_name( classname )) )
 		return( NULL );
 	class = vips_class_map_all( base, 
@@ -2937,22 +2962,61 @@ vips_class_add_hash( VipsObjectClass *class, GHashTable *table )
 	return( NULL ); 
 }
 
+/* Lock the nickname table with this, it's rebuilt as packages are 
+ * registered.
+ */
+static GMutex *vips__object_nickname_lock = NULL;
+
+/* The number of registered packages when we last built the table.
+ */
+static int vips__object_nickname_n_packages = -1;
+
 static void *
 vips_class_build_hash_cb( void *dummy )
 {
+	vips__object_nickname_lock = vips_g_mutex_new();
+
+	return( NULL );
+}
+
+/* Rebuild the nickname table if more packages have been registered. 
+ *
+ * Making the table refs every class, and a class_init might call 
+ * vips_type_find(), so we build outside the lock and just swap it in.
+ */
+static void
+vips_class_update_hash( void )
+{
+	int n_packages = vips__init_packages_n_done();
+
+	gboolean current;
+	GHashTable *table;
 	GType base;
 
-	vips__object_nickname_table = 
-		g_hash_table_new( g_str_hash, g_str_equal );
+	g_mutex_lock( vips__object_nickname_lock );
+	current = n_packages <= vips__object_nickname_n_packages;
+	g_mutex_unlock( vips__object_nickname_lock );
+	if( current )
+		return;
+
+	table = g_hash_table_new_full( g_str_hash, g_str_equal, NULL, g_free );
 
 	base = g_type_from_name( "VipsObject" );
 	g_assert( base ); 
 
-	vips_class_map_all( base, 
-		(VipsClassMapFn) vips_class_add_hash, 
-		(void *) vips__object_nickname_table );
+	vips__class_map_registered( base, 
+		(VipsClassMapFn) vips_class_add_hash, (void *) table );
 
-	return( NULL );
+	/* Another thread may have beaten us to it.
+	 */
+	g_mutex_lock( vips__object_nickname_lock );
+	if( n_packages > vips__object_nickname_n_packages ) {
+		VIPS_SWAP( GHashTable *, table, vips__object_nickname_table );
+		vips__object_nickname_n_packages = n_packages;
+	}
+	g_mutex_unlock( vips__object_nickname_lock );
+
+	VIPS_FREEF( g_hash_table_destroy, table ); 
 }
 
 /**
@@ -2977,26 +3041,67 @@ vips_type_find( const char *basename, const char *nickname )
 
 	const char *classname = basename ? basename : "VipsObject";
 
-	NicknameGType *hit;
-	GType base;
 	GType type;
+	gboolean all;
+	gboolean partial;
 
 	VIPS_ONCE( &once, vips_class_build_hash_cb, NULL ); 
 
-	hit = (NicknameGType *) 
-		g_hash_table_lookup( vips__object_nickname_table, 
-			(void *) nickname );
+	/* Look in the packages we have, and if it's not there, register the
+	 * next package and try again. 
+	 *
+	 * Operation nicknames are unique, so an operation hit can't become a
+	 * duplicate as more packages arrive. Anything else could, so we only 
+	 * trust it once every package is in.
+	 *
+	 * We must register outside the lock, since a class_init might call 
+	 * us.
+	 */
+	type = 0;
+	all = FALSE;
+	for(;;) {
+		NicknameGType *hit;
+		GType base;
+
+		vips_class_update_hash();
 
-	/* We must only search below basename ... check that the cache hit is
-	 * in the right part of the tree.
+		g_mutex_lock( vips__object_nickname_lock );
+		hit = (NicknameGType *) 
+			g_hash_table_lookup( vips__object_nickname_table, 
+				(void *) nickname );
+
+		/* We must only search below basename ... check that the 
+		 * cache hit is in the right part of the tree.
+		 */
+		partial = FALSE;
+		if( hit &&
+			!hit->duplicate &&
+			(base = g_type_from_name( classname )) &&
+			g_type_is_a( hit->type, base ) ) {
+			if( all ||
+				g_type_is_a( hit->type, VIPS_TYPE_OPERATION ) )
+				type = hit->type;
+			else
+				partial = TRUE;
+		}
+		g_mutex_unlock( vips__object_nickname_lock );
+
+		if( type ||
+			all )
+			break;
+
+		if( partial ) {
+			vips__init_packages();
+			all = TRUE;
+		}
+		else if( !vips__init_next_package() ) 
+			break;
+	}
+
+	/* Not a unique nickname, or not a nickname at all, so search the 
+	 * whole tree. 
 	 */
-	if( !(base = g_type_from_name( classname )) )
-		return( 0 );
-	if( hit &&
-		!hit->duplicate &&
-		g_type_is_a( hit->type, base ) ) 
-		type = hit->type;
-	else {
+	if( !type ) {
 		const VipsObjectClass *class;
 
 		if( !(class = vips_class_find( basename, nickname )) )
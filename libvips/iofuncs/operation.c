@@ -1328,15 +1328,11 @@ vips_call_argv_output( VipsObject *object,
 	return( NULL );
 }
 
-/* Our main command-line entry point. Optional args should have been set by
- * the GOption parser already, see above.
- *
- * We don't create the operation, so we must not unref it. The caller must
- * unref on error too. The caller must also call vips_object_unref_outputs() on
- * all code paths.
+/* Set the required inputs from argv and build. vips_call_argv() then writes
+ * the outputs, the server in tools/vips.c writes them itself.
  */
 int
-vips_call_argv( VipsOperation *operation, int argc, char **argv )
+vips__call_argv_build( VipsOperation *operation, int argc, char **argv )
 {
 	VipsCall call;
 
@@ -1386,6 +1382,28 @@ vips_call_argv( VipsOperation *operation, int argc, char **argv )
 		vips_object_print_summary( VIPS_OBJECT( operation ) );
 	}
 
+	return( 0 );
+}
+
+/* Our main command-line entry point. Optional args should have been set by
+ * the GOption parser already, see above.
+ *
+ * We don't create the operation, so we must not unref it. The caller must
+ * unref on error too. The caller must also call vips_object_unref_outputs() on
+ * all code paths.
+ */
+int
+vips_call_argv( VipsOperation *operation, int argc, char **argv )
+{
+	VipsCall call;
+
+	if( vips__call_argv_build( operation, argc, argv ) )
+		return( -1 );
+
+	call.operation = operation;
+	call.argc = argc;
+	call.argv = argv;
+
 	call.i = 0;
 	if( vips_argument_map( VIPS_OBJECT( operation ),
 		vips_call_argv_output, &call, NULL ) ) 
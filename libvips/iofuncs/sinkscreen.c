@@ -10,6 +10,14 @@
  * 1/12/15
  * 	- don't do anything to out or mask after they have closed
  * 	- only run the bg render thread when there's work to do
+ * 18/10/20
+ * 	- several bg render threads, so more than one render can progress
+ * 	- add vips_sink_screen_set_viewport(): dirty tiles are painted
+ * 	  nearest the viewport centre first, and tiles which leave the
+ * 	  viewport are dropped from the dirty list
+ * 	- start the bg render threads on first use
+ * 	- only one bg thread works on a render at once, and reschedule is
+ * 	  per render
  */
 
 /*
@@ -94,6 +102,11 @@ typedef struct {
 	 */
 	gboolean dirty;
 
+	/* The tile left the viewport before it was painted, so we took it
+	 * off the dirty list. It must be queued again if it's asked for.
+	 */
+	gboolean cancelled;
+
 	/* Time of last use, for LRU flush 
 	 */
 	int ticks;
@@ -139,10 +152,28 @@ typedef struct _Render {
 	 */
 	GHashTable *tiles;
 
+	/* The area the client is looking at, if they've told us. Dirty 
+	 * tiles are painted nearest the centre of this first.
+	 */
+	gboolean have_viewport;
+	VipsRect viewport;
+
 	/* A shutdown flag. If ->out or ->mask close, we must no longer do
 	 * anything to them until we shut down too.
 	 */
 	gboolean shutdown;
+
+	/* Set when a bg thread has taken this render and is running a
+	 * threadpool on it. It's not put back on the dirty list until the
+	 * threadpool returns, so only one bg thread ever works on a render. 
+	 * Protected by render_dirty_lock.
+	 */
+	gboolean working;
+
+	/* Set this to make the threadpool on this render stop, for example 
+	 * when ->out closes. 
+	 */
+	int reschedule;
 } Render;
 
 /* Our per-thread state.
@@ -162,10 +193,16 @@ typedef struct _RenderThreadStateClass {
 
 G_DEFINE_TYPE( RenderThreadState, render_thread_state, VIPS_TYPE_THREAD_STATE );
 
-/* The BG thread which sits waiting to do some calculations, and the semaphore
- * it waits on holding the number of renders with dirty tiles. 
+/* The number of BG threads. Each takes a render with dirty tiles and runs a
+ * threadpool on it, so this many renders can progress at once. A render is
+ * only ever worked on by one of them.
  */
-static GThread *render_thread = NULL;
+#define RENDER_THREADS (2)
+
+/* The BG threads which sit waiting to do some calculations, and the semaphore
+ * they wait on holding the number of renders with dirty tiles. 
+ */
+static GThread *render_thread[RENDER_THREADS] = { NULL };
 
 /* Set this to ask the render thread to quit.
  */
@@ -178,9 +215,9 @@ static GMutex *render_dirty_lock = NULL;
 static GSList *render_dirty_all = NULL;
 static VipsSemaphore n_render_dirty_sem; 
 
-/* Set this to make the bg thread stop and reschedule.
+/* Find the Render for an output image with this.
  */
-static gboolean render_reschedule = FALSE;
+static GQuark render_quark = 0;
 
 static void
 render_thread_state_class_init( RenderThreadStateClass *class )
@@ -284,7 +321,23 @@ render_unref( Render *render )
 	return( 0 );
 }
 
-/* Get the next tile to paint off the dirty list.
+/* Squared distance from the centre of a tile to the centre of the viewport.
+ */
+static gint64
+tile_viewport_distance( Tile *tile )
+{
+	Render *render = tile->render;
+	gint64 dx = (gint64) 2 * tile->area.left + tile->area.width - 
+		(2 * render->viewport.left + render->viewport.width);
+	gint64 dy = (gint64) 2 * tile->area.top + tile->area.height - 
+		(2 * render->viewport.top + render->viewport.height);
+
+	return( dx * dx + dy * dy );
+}
+
+/* Get the next tile to paint off the dirty list. If we have a viewport, 
+ * that's the tile nearest the centre, otherwise it's the most recently
+ * requested.
  */
 static Tile *
 render_tile_dirty_get( Render *render )
@@ -295,6 +348,22 @@ render_tile_dirty_get( Render *render )
 		tile = NULL;
 	else {
 		tile = (Tile *) render->dirty->data;
+
+		if( render->have_viewport ) {
+			gint64 best = tile_viewport_distance( tile ); 
+			GSList *p;
+
+			for( p = render->dirty->next; p; p = p->next ) {
+				Tile *this = (Tile *) p->data;
+				gint64 d = tile_viewport_distance( this );
+
+				if( d < best ) {
+					best = d;
+					tile = this;
+				}
+			}
+		}
+
 		g_assert( tile->dirty );
 		render->dirty = g_slist_remove( render->dirty, tile );
 		tile->dirty = FALSE;
@@ -339,6 +408,7 @@ tile_dirty_set( Tile *tile )
 		render->dirty = g_slist_prepend( render->dirty, tile );
 		tile->dirty = TRUE;
 		tile->painted = FALSE;
+		tile->cancelled = FALSE;
 	}
 	else
 		g_assert( g_slist_find( render->dirty, tile ) );
@@ -370,7 +440,8 @@ render_allocate( VipsThreadState *state, void *a, gboolean *stop )
 
 	g_mutex_lock( render->lock );
 
-	if( render_reschedule || 
+	if( render_kill ||
+		g_atomic_int_get( &render->reschedule ) || 
 		!(tile = render_tile_dirty_get( render )) ) {
 		VIPS_DEBUG_MSG_GREEN( "render_allocate: stopping\n" );
 		*stop = TRUE;
@@ -433,23 +504,28 @@ vips__render_shutdown( void )
 	/* We may come here without having inited.
 	 */
 	if( render_dirty_lock ) {
-		g_mutex_lock( render_dirty_lock );
+		GThread *thread[RENDER_THREADS];
+		int i;
 
-		if( render_thread ) { 
-			GThread *thread;
+		g_mutex_lock( render_dirty_lock );
 
-			thread = render_thread;
-			render_reschedule = TRUE;
-			render_kill = TRUE;
+		for( i = 0; i < RENDER_THREADS; i++ ) {
+			thread[i] = render_thread[i];
+			render_thread[i] = NULL;
+		}
+		render_kill = TRUE;
 
-			g_mutex_unlock( render_dirty_lock );
+		g_mutex_unlock( render_dirty_lock );
 
-			vips_semaphore_up( &n_render_dirty_sem ); 
+		/* Wake everyone, then wait for them all to exit.
+		 */
+		for( i = 0; i < RENDER_THREADS; i++ ) 
+			if( thread[i] ) 
+				vips_semaphore_up( &n_render_dirty_sem ); 
 
-			(void) vips_g_thread_join( thread );
-		}
-		else
-			g_mutex_unlock( render_dirty_lock );
+		for( i = 0; i < RENDER_THREADS; i++ ) 
+			if( thread[i] ) 
+				(void) vips_g_thread_join( thread[i] );
 	}
 }
 
@@ -459,14 +535,17 @@ render_dirty_sort( Render *a, Render *b )
 	return( b->priority - a->priority );
 }
 
-/* Add to the jobs list, if it has work to be done.
+/* Add to the jobs list, if it has work to be done. A render which a bg
+ * thread is working on is added back when that thread is done with it.
  */
 static void
 render_dirty_put( Render *render )
 {
 	g_mutex_lock( render_dirty_lock );
 
-	if( render->dirty ) {
+	if( render->dirty &&
+		!render->working &&
+		!render->shutdown ) {
 		if( !g_slist_find( render_dirty_all, render ) ) {
 			render_dirty_all = g_slist_prepend( render_dirty_all, 
 				render );
@@ -516,13 +595,17 @@ render_close_cb( VipsImage *image, Render *render )
 	 */
 	render->shutdown = TRUE;
 
-	render_unref( render );
+	if( image == render->out )
+		g_object_set_qdata( G_OBJECT( image ), render_quark, NULL );
 
 	/* If this render is being worked on, we want to jog the bg thread, 
-	 * make it drop it's ref and think again.
+	 * make it drop it's ref and think again. Do this before the unref,
+	 * which can free the render.
 	 */
 	VIPS_DEBUG_MSG_GREEN( "render_close_cb: reschedule\n" );
-	render_reschedule = TRUE;
+	g_atomic_int_set( &render->reschedule, TRUE );
+
+	render_unref( render );
 
 	return( 0 );
 }
@@ -569,7 +652,13 @@ render_new( VipsImage *in, VipsImage *out, VipsImage *mask,
 
 	render->dirty = NULL;
 
+	render->have_viewport = FALSE;
+
 	render->shutdown = FALSE;
+	render->working = FALSE;
+	render->reschedule = FALSE;
+
+	g_object_set_qdata( G_OBJECT( out ), render_quark, render );
 
 	/* Both out and mask must close before we can free the render.
 	 */
@@ -614,6 +703,7 @@ tile_new( Render *render )
 	tile->region = NULL;
 	tile->painted = FALSE;
 	tile->dirty = FALSE;
+	tile->cancelled = FALSE;
 	tile->ticks = render->ticks;
 
 	if( !(tile->region = vips_region_new( render->in )) ) {
@@ -698,6 +788,7 @@ tile_queue( Tile *tile, VipsRegion *reg )
 		tile, tile->area.left, tile->area.top );
 
 	tile->painted = FALSE;
+	tile->cancelled = FALSE;
 	tile_touch( tile );
 
 	if( render->notify ) {
@@ -736,12 +827,13 @@ tile_queue( Tile *tile, VipsRegion *reg )
 static void 
 tile_test_clean_ticks( VipsRect *key, Tile *value, Tile **best )
 {
-	if( value->painted )
+	if( value->painted ||
+		value->cancelled )
 		if( !*best || value->ticks < (*best)->ticks )
 			*best = value;
 }
 
-/* Pick a painted tile to reuse. Search for LRU (slow!).
+/* Pick a painted or cancelled tile to reuse. Search for LRU (slow!).
  */
 static Tile *
 render_tile_get_painted( Render *render )
@@ -773,9 +865,11 @@ render_tile_request( Render *render, VipsRegion *reg, VipsRect *area )
 
 	if( (tile = render_tile_lookup( render, area )) ) {
 		/* We already have a tile at this position. If it's invalid,
-		 * ask for a repaint.
+		 * or it was cancelled before it was painted, ask for a 
+		 * repaint.
 		 */
-		if( tile->region->invalid ) 
+		if( tile->region->invalid ||
+			tile->cancelled ) 
 			tile_queue( tile, reg );
 		else
 			tile_touch( tile );
@@ -977,6 +1071,7 @@ render_dirty_get( void )
 		render_ref( render );
 
 		render_dirty_all = g_slist_remove( render_dirty_all, render );
+		render->working = TRUE;
 	}
 
 	g_mutex_unlock( render_dirty_lock );
@@ -995,8 +1090,6 @@ render_thread_main( void *client )
 		VIPS_DEBUG_MSG_GREEN( "render_thread_main: "
 			"threadpool start\n" );
 
-		render_reschedule = FALSE;
-
 		if( (render = render_dirty_get()) ) {
 			if( vips_threadpool_run( render->in,
 				render_thread_state_new,
@@ -1012,6 +1105,9 @@ render_thread_main( void *client )
 
 			/* Add back to the jobs list, if we need to.
 			 */
+			g_mutex_lock( render_dirty_lock );
+			render->working = FALSE;
+			g_mutex_unlock( render_dirty_lock );
 			render_dirty_put( render );
 
 			/* _get() does a ref to make sure we keep the render
@@ -1022,23 +1118,50 @@ render_thread_main( void *client )
 		}
 	}
 
-	/* We are exiting, so render_thread must now be NULL.
+	return( NULL );
+}
+
+static void *
+render_thread_start_cb( void *client )
+{
+	int i;
+
+	g_mutex_lock( render_dirty_lock );
+
+	/* No point starting if we're shutting down.
 	 */
-	render_thread = NULL; 
+	if( !render_kill ) 
+		for( i = 0; i < RENDER_THREADS; i++ ) {
+			g_assert( !render_thread[i] ); 
+
+			render_thread[i] = vips_g_thread_new( "sink_screen",
+				render_thread_main, NULL );
+		}
+
+	g_mutex_unlock( render_dirty_lock );
 
 	return( NULL );
 }
 
+/* Most programs never use vips_sink_screen(), so we start the bg threads on 
+ * first use.
+ */
+static void
+render_thread_start( void )
+{
+	static GOnce once = G_ONCE_INIT;
+
+	VIPS_ONCE( &once, render_thread_start_cb, NULL );
+}
+
 void
 vips__sink_screen_init( void )
 {
-	g_assert( !render_thread ); 
 	g_assert( !render_dirty_lock ); 
 
+	render_quark = g_quark_from_static_string( "vips-sink-screen-render" );
 	render_dirty_lock = vips_g_mutex_new();
 	vips_semaphore_init( &n_render_dirty_sem, 0, "n_render_dirty" );
-	render_thread = vips_g_thread_new( "sink_screen",
-		render_thread_main, NULL );
 }
 
 /**
@@ -1063,12 +1186,16 @@ vips__sink_screen_init( void )
  * The @mask image is a one-band uchar image and has 255 for pixels which are 
  * currently in cache and 0 for uncalculated pixels.
  *
- * Only a single sink is calculated at any one time, though many may be
+ * A small number of sinks are calculated at any one time, though many may be
  * alive. Use @priority to indicate which renders are more important:  
  * zero means normal
  * priority, negative numbers are low priority, positive numbers high
  * priority.
  *
+ * Use vips_sink_screen_set_viewport() to tell the render which part of @out
+ * is on screen. Tiles nearest the centre of the viewport are calculated 
+ * first, and queued tiles which leave the viewport are dropped.
+ *
  * Calls to vips_region_prepare() on @out return immediately and hold 
  * whatever is
  * currently in cache for that #VipsRect (check @mask to see which parts of the
@@ -1122,6 +1249,11 @@ vips_sink_screen( VipsImage *in, VipsImage *out, VipsImage *mask,
 		mask->Coding = VIPS_CODING_NONE;
 	}
 
+	/* Only async renders need the bg threads.
+	 */
+	if( notify_fn )
+		render_thread_start();
+
 	if( !(render = render_new( in, out, mask, 
 		tile_width, tile_height, max_tiles, priority, notify_fn, a )) )
 		return( -1 );
@@ -1139,6 +1271,61 @@ vips_sink_screen( VipsImage *in, VipsImage *out, VipsImage *mask,
 	return( 0 );
 }
 
+/**
+ * vips_sink_screen_set_viewport: (method)
+ * @out: output image from vips_sink_screen()
+ * @viewport: the area of @out currently on screen
+ *
+ * Tell a background render which part of @out the user can see. Queued
+ * tiles nearest the centre of @viewport are calculated first, and queued 
+ * tiles which don't touch @viewport are taken off the queue. They will be
+ * queued again if they are requested.
+ *
+ * Call this every time the view scrolls or zooms.
+ *
+ * See also: vips_sink_screen().
+ *
+ * Returns: 0 on sucess, -1 on error.
+ */
+int
+vips_sink_screen_set_viewport( VipsImage *out, VipsRect *viewport )
+{
+	Render *render;
+	GSList *p;
+
+	if( !render_quark ||
+		!(render = g_object_get_qdata( G_OBJECT( out ), 
+			render_quark )) ) {
+		vips_error( "vips_sink_screen_set_viewport", 
+			"%s", _( "not a vips_sink_screen() image" ) );
+		return( -1 );
+	}
+
+	g_mutex_lock( render->lock );
+
+	render->viewport = *viewport;
+	render->have_viewport = TRUE;
+
+	/* Anything that's scrolled out of view can come off the dirty list.
+	 */
+	p = render->dirty;
+	while( p ) {
+		Tile *tile = (Tile *) p->data;
+
+		p = p->next;
+
+		if( !vips_rect_overlapsrect( &tile->area, viewport ) ) {
+			render->dirty = g_slist_remove( render->dirty, tile );
+			tile->dirty = FALSE;
+			tile->cancelled = TRUE;
+		}
+	}
+
+	g_mutex_unlock( render->lock );
+
+	return( 0 );
+}
+
 void
 vips__print_renders( void )
 {
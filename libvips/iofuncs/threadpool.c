@@ -117,6 +117,11 @@ int vips__n_active_threads = 0;
  */
 static GPrivate *is_worker_key = NULL;
 
+/* Set this GPrivate to limit the threadpools started from this thread, see
+ * vips__concurrency_set_thread().
+ */
+static GPrivate *concurrency_key = NULL;
+
 /* Set to stall threads for debugging.
  */
 static gboolean vips__stall = FALSE;
@@ -446,6 +451,29 @@ vips_concurrency_get( void )
 	return( nthr );
 }
 
+/* Limit the threadpools started from this thread to @concurrency workers, 
+ * or 0 to use vips_concurrency_get() again. vips_image_write_to_files() uses 
+ * this to share the workers between several saves.
+ */
+void
+vips__concurrency_set_thread( int concurrency )
+{
+	g_private_set( concurrency_key, GINT_TO_POINTER( concurrency ) );
+}
+
+/* The number of workers a threadpool started from this thread should use.
+ */
+static int
+vips_concurrency_get_thread( void )
+{
+	int nthr;
+
+	if( (nthr = GPOINTER_TO_INT( g_private_get( concurrency_key ) )) > 0 )
+		return( VIPS_MIN( nthr, vips_concurrency_get() ) );
+
+	return( vips_concurrency_get() );
+}
+
 G_DEFINE_TYPE( VipsThreadState, vips_thread_state, VIPS_TYPE_OBJECT );
 
 static void
@@ -793,7 +821,7 @@ vips_threadpool_new( VipsImage *im )
 	pool->allocate = NULL;
 	pool->work = NULL;
 	pool->allocate_lock = vips_g_mutex_new();
-	pool->nthr = vips_concurrency_get();
+	pool->nthr = vips_concurrency_get_thread();
 	pool->thr = NULL;
 	vips_semaphore_init( &pool->finish, 0, "finish" );
 	vips_semaphore_init( &pool->tick, 0, "tick" );
@@ -1015,11 +1043,15 @@ vips__threadpool_init( void )
 	 */
 #ifdef HAVE_PRIVATE_INIT
 	static GPrivate private = { 0 }; 
+	static GPrivate concurrency_private = { 0 }; 
 
 	is_worker_key = &private;
+	concurrency_key = &concurrency_private;
 #else
 	if( !is_worker_key ) 
 		is_worker_key = g_private_new( NULL ); 
+	if( !concurrency_key ) 
+		concurrency_key = g_private_new( NULL ); 
 #endif
 
 	if( g_getenv( "VIPS_STALL" ) )
@@ -1045,7 +1077,7 @@ void
 vips_get_tile_size( VipsImage *im, 
 	int *tile_width, int *tile_height, int *n_lines )
 {
-	const int nthr = vips_concurrency_get();
+	const int nthr = vips_concurrency_get_thread();
 	const int typical_image_width = 1000;
 
 	/* Compiler warnings.
@@ -2,6 +2,8 @@
  *
  * 29/10/10
  * 	- from morph hacking
+ * 18/10/20
+ * 	- defer orc_init() until first use
  */
 
 /*
@@ -81,10 +83,10 @@ vips_vector_error( VipsVector *vector )
 #endif /*HAVE_ORC*/
 }
 
-void 
-vips_vector_init( void )
-{
 #ifdef HAVE_ORC
+static void *
+vips_vector_orc_init_cb( void *client )
+{
 #ifdef DEBUG_TRACE
 	printf( "orc_init();\n" );
 #endif /*DEBUG_TRACE*/
@@ -99,6 +101,25 @@ vips_vector_init( void )
 	orc_debug_set_level( 99 );
 #endif /*DEBUG_ORC*/
 
+	return( NULL );
+}
+
+/* orc_init() is slow, and many programs never use orc, so we start it on 
+ * first use.
+ */
+static void
+vips_vector_orc_init( void )
+{
+	static GOnce once = G_ONCE_INIT;
+
+	VIPS_ONCE( &once, vips_vector_orc_init_cb, NULL );
+}
+#endif /*HAVE_ORC*/
+
+void 
+vips_vector_init( void )
+{
+#ifdef HAVE_ORC
 	/* Look for the environment variable IM_NOVECTOR and use that to turn
 	 * off as well.
 	 */
@@ -113,6 +134,9 @@ gboolean
 vips_vector_isenabled( void )
 {
 #ifdef HAVE_ORC
+	if( vips__vector_enabled )
+		vips_vector_orc_init();
+
 	return( vips__vector_enabled );
 #else /*!HAVE_ORC*/
 	return( FALSE );
@@ -155,6 +179,10 @@ vips_vector_new( const char *name, int dsize )
 	VipsVector *vector;
 	int i;
 
+#ifdef HAVE_ORC
+	vips_vector_orc_init();
+#endif /*HAVE_ORC*/
+
 	if( !(vector = VIPS_NEW( NULL, VipsVector )) )
 		return( NULL );
 	vector->name = name;
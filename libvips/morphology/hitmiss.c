@@ -21,6 +21,8 @@
  * 	- do (!=0) to make uchar, if we're not given uchar
  * 28/6/13
  * 	- oops, fix !=0 code
+ * 18/10/20
+ * 	- add a packed bit path for masks we can't vectorise
  */
 
 /*
@@ -370,6 +372,14 @@ typedef struct {
 	 */
 	void *t1;
 	void *t2;
+
+	/* In bit mode we pack each input line to one bit per element, 64 to
+	 * a word, plus an accumulator for one output line.
+	 */
+	guint64 *bits;
+	guint64 *acc;
+	int n_bits;		/* Size of bits, in words */
+	int n_acc;		/* Size of acc, in words */
 } MorphSequence;
 
 /* Free a sequence value.
@@ -382,6 +392,8 @@ morph_stop( void *vseq, void *a, void *b )
 	IM_FREEF( im_region_free, seq->ir );
 	IM_FREE( seq->t1 );
 	IM_FREE( seq->t2 );
+	IM_FREE( seq->bits );
+	IM_FREE( seq->acc );
 
 	return( 0 );
 }
@@ -412,6 +424,10 @@ morph_start( IMAGE *out, void *a, void *b )
 	seq->last_bpl = -1;
 	seq->t1 = NULL;
 	seq->t2 = NULL;
+	seq->bits = NULL;
+	seq->acc = NULL;
+	seq->n_bits = 0;
+	seq->n_acc = 0;
 
 	/* Attach region and arrays.
 	 */
@@ -648,6 +664,141 @@ erode_gen( REGION *or, void *vseq, void *a, void *b )
 	return( 0 );
 }
 
+/* Pack n elements of p to one bit each, LSB first, into nw words. Words
+ * past the end of the line are zeroed.
+ */
+static void
+morph_bits_pack( guint64 *bits, VipsPel *p, int n, int nw )
+{
+	int i, j;
+
+	for( i = 0; i < nw; i++ ) {
+		int m = VIPS_CLIP( 0, n - i * 64, 64 );
+		VipsPel *q = p + i * 64;
+		guint64 word;
+
+		word = 0;
+		for( j = 0; j < m; j++ )
+			if( q[j] )
+				word |= (guint64) 1 << j;
+
+		bits[i] = word;
+	}
+}
+
+/* Word w of bits shifted down by k elements.
+ */
+#define MORPH_BITS_SHIFT( BITS, W, K ) \
+	(((K) & 63) ? \
+		(BITS)[(W) + ((K) >> 6)] >> ((K) & 63) | \
+			(BITS)[(W) + ((K) >> 6) + 1] << (64 - ((K) & 63)) : \
+		(BITS)[(W) + ((K) >> 6)])
+
+/* The packed bit codepath. Each input line is packed once, then each mask
+ * element is a shift plus an and / or over 64 elements at a time. This is
+ * much quicker than the C path for large masks which orc can't handle.
+ *
+ * The packing is private to this kernel. Images are still one byte per 
+ * element on either side of it, so this saves time, not memory.
+ */
+static int
+morph_bits_gen( REGION *or, void *vseq, void *a, void *b )
+{
+	MorphSequence *seq = (MorphSequence *) vseq;
+	Morph *morph = (Morph *) b;
+	INTMASK *mask = morph->mask;
+	REGION *ir = seq->ir;
+	Rect *r = &or->valid;
+	int sz = IM_REGION_N_ELEMENTS( or );
+	int bands = morph->in->Bands;
+
+	/* Words in an output line, words in a packed input line. The extra
+	 * input words are read by the shift on the last output word.
+	 */
+	int nw_out = (sz + 63) / 64;
+	int nw_in = nw_out + ((mask->xsize - 1) * bands) / 64 + 2;
+
+	Rect s;
+	int x, y, i, j, w;
+
+	/* A line too narrow to fill a word: the byte paths are quicker.
+	 */
+	if( sz < 64 ) {
+		if( morph->op == DILATE )
+			return( dilate_gen( or, vseq, a, b ) );
+		else
+			return( erode_gen( or, vseq, a, b ) );
+	}
+
+	s = *r;
+	s.width += mask->xsize - 1;
+	s.height += mask->ysize - 1;
+	if( im_prepare( ir, &s ) )
+		return( -1 );
+
+#ifdef DEBUG_VERBOSE
+	printf( "morph_bits_gen: preparing %dx%d@%dx%d pixels\n", 
+		s.width, s.height, s.left, s.top );
+#endif /*DEBUG_VERBOSE*/
+
+	if( seq->n_bits < nw_in * s.height ) {
+		IM_FREE( seq->bits );
+		seq->n_bits = 0;
+		if( !(seq->bits = IM_ARRAY( NULL, nw_in * s.height, guint64 )) )
+			return( -1 );
+		seq->n_bits = nw_in * s.height;
+	}
+	if( seq->n_acc < nw_out ) {
+		IM_FREE( seq->acc );
+		seq->n_acc = 0;
+		if( !(seq->acc = IM_ARRAY( NULL, nw_out, guint64 )) )
+			return( -1 );
+		seq->n_acc = nw_out;
+	}
+
+	for( y = 0; y < s.height; y++ ) 
+		morph_bits_pack( seq->bits + y * nw_in, 
+			IM_REGION_ADDR( ir, s.left, s.top + y ), 
+			s.width * bands, nw_in );
+
+	for( y = 0; y < r->height; y++ ) { 
+		guint64 *acc = seq->acc;
+		VipsPel *q = IM_REGION_ADDR( or, r->left, r->top + y );
+
+		for( w = 0; w < nw_out; w++ )
+			acc[w] = morph->op == DILATE ? 0 : ~((guint64) 0);
+
+		for( j = 0; j < mask->ysize; j++ ) {
+			guint64 *line = seq->bits + (y + j) * nw_in;
+
+			for( i = 0; i < mask->xsize; i++ ) {
+				int coeff = mask->coeff[i + j * mask->xsize];
+				int k = i * bands;
+				guint64 invert = coeff ? 0 : ~((guint64) 0);
+
+				if( coeff == 128 )
+					continue;
+
+				if( morph->op == DILATE )
+					for( w = 0; w < nw_out; w++ )
+						acc[w] |= invert ^
+							MORPH_BITS_SHIFT( 
+								line, w, k );
+				else
+					for( w = 0; w < nw_out; w++ )
+						acc[w] &= invert ^
+							MORPH_BITS_SHIFT( 
+								line, w, k );
+			}
+		}
+
+		for( x = 0; x < sz; x++ )
+			q[x] = (acc[x >> 6] >> (x & 63)) & 1 ? 255 : 0;
+	}
+
+	return( 0 );
+}
+
 /* The vector codepath.
  */
 static int
@@ -741,10 +892,8 @@ morphology( IMAGE *in, IMAGE *out, INTMASK *mask, MorphOp op )
 		printf( "morph_vector_gen: %d passes\n", morph->n_pass );
 #endif /*DEBUG*/
 	}
-	else if( morph->op == DILATE )
-		generate = dilate_gen;
 	else
-		generate = erode_gen;
+		generate = morph_bits_gen;
 
 	if( im_demand_hint( morph->out, IM_SMALLTILE, morph->in, NULL ) ||
 		im_generate( morph->out, 
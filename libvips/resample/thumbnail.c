@@ -28,6 +28,8 @@
  * 	- smarter heif thumbnail selection
  * 12/10/19
  * 	- add thumbnail_source
+ * 18/10/20
+ * 	- unpremultiply and cast in one pass
  */
 
 /*
@@ -692,10 +694,11 @@ vips_thumbnail_build( VipsObject *object )
 
 	if( have_premultiplied ) {
 		g_info( "unpremultiplying alpha" ); 
-		if( vips_unpremultiply( in, &t[5], NULL ) || 
-			vips_cast( t[5], &t[6], unpremultiplied_format, NULL ) )
+		if( vips_unpremultiply( in, &t[5], 
+			"format", unpremultiplied_format,
+			NULL ) )
 			return( -1 );
-		in = t[6];
+		in = t[5];
 	}
 
 	/* Colour management.
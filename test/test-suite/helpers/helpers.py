@@ -14,6 +14,7 @@ SRGB_FILE = os.path.join(IMAGES, "sRGB.icm")
 MATLAB_FILE = os.path.join(IMAGES, "sample.mat")
 PNG_FILE = os.path.join(IMAGES, "sample.png")
 TIF_FILE = os.path.join(IMAGES, "sample.tif")
+HALF_TIF_FILE = os.path.join(IMAGES, "half.tif")
 OME_FILE = os.path.join(IMAGES, "multi-channel-z-series.ome.tif")
 ANALYZE_FILE = os.path.join(IMAGES, "t00740_tr1_segm.hdr")
 GIF_FILE = os.path.join(IMAGES, "cramps.gif")
@@ -595,6 +595,19 @@ class TestArithmetic:
             assert width == 50
             assert height == 60
 
+            # entirely background
+            left, top, width, height = (test * 0 + 255).find_trim()
+            assert width == 0
+            assert height == 0
+
+            # margins large enough that the edge scan gives up
+            test = im.embed(130, 220, 200, 300, extend="white")
+            left, top, width, height = test.find_trim()
+            assert left == 130
+            assert top == 220
+            assert width == 50
+            assert height == 60
+
     def test_profile(self):
         test = pyvips.Image.black(100, 100).draw_rect(100, 40, 50, 1, 1)
 
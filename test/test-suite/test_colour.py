@@ -83,6 +83,24 @@ class TestColour:
 
             assert_almost_equal_objects(before, after, threshold=10)
 
+    def test_colourspace_fused(self):
+        # multi-step routes run as a single pass, they should match the
+        # chain of separate operations exactly
+        im = pyvips.Image.new_from_file(JPEG_FILE)
+        im = im.bandjoin(128).cast("float")
+        im = im.copy(interpretation=pyvips.Interpretation.SCRGB)
+
+        fused = im.colourspace(pyvips.Interpretation.CMC)
+        chain = im.scRGB2XYZ().XYZ2Lab().Lab2LCh().LCh2CMC()
+        assert fused.interpretation == pyvips.Interpretation.CMC
+        assert fused.bands == 4
+        assert (fused - chain).abs().max() == 0
+
+        fused = fused.colourspace(pyvips.Interpretation.SCRGB)
+        chain = chain.CMC2LCh().LCh2Lab().Lab2XYZ().XYZ2scRGB()
+        assert fused.interpretation == pyvips.Interpretation.SCRGB
+        assert (fused - chain).abs().max() == 0
+
     # test results from Bruce Lindbloom's calculator:
     # http://www.brucelindbloom.com
     def test_dE00(self):
@@ -97,6 +115,10 @@ class TestColour:
         assert pytest.approx(result, 0.001) == 30.238
         assert pytest.approx(alpha, 0.001) == 42.0
 
+        # identical images should have zero difference everywhere
+        im = pyvips.Image.new_from_file(JPEG_FILE)
+        assert im.dE00(im).max() == 0
+
     def test_dE76(self):
         # put 42 in the extra band, it should be copied unmodified
         reference = pyvips.Image.black(100, 100) + [50, 10, 20, 42]
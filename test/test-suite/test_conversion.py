@@ -136,6 +136,30 @@ class TestConversion:
 
         self.run_unary(self.all_images, cache)
 
+    def test_sequential(self):
+        # a sequential source read twice, at two very different offsets
+        im = pyvips.Image.new_from_file(JPEG_FILE, access="sequential")
+        h = im.height // 2
+        top = im.crop(0, 0, im.width, h)
+        bottom = im.crop(0, h, im.width, h)
+        seq = (top + bottom).avg()
+
+        im = self.image
+        top = im.crop(0, 0, im.width, h)
+        bottom = im.crop(0, h, im.width, h)
+        assert seq == (top + bottom).avg()
+
+        # a vertical join of two halves of a tall sequential source: the
+        # reader on the top half goes idle, and must not hold the cache
+        im = pyvips.Image.xyz(16, 10000)[1].cast("uchar")
+        buf = im.write_to_buffer(".png")
+        seq = pyvips.Image.new_from_buffer(buf, "", access="sequential")
+        h = im.height // 2
+        top = seq.crop(0, 0, im.width, h)
+        bottom = seq.crop(0, h, im.width, h)
+        joined = pyvips.Image.arrayjoin([top, bottom], across=1)
+        assert (joined - im).abs().max() == 0
+
     def test_copy(self):
         x = self.colour.copy(interpretation=pyvips.Interpretation.LAB)
         assert x.interpretation == pyvips.Interpretation.LAB
@@ -305,6 +329,26 @@ class TestConversion:
         assert test.width == 100
         assert test.height == 100
 
+        # detail on the right should pull the crop over to the right
+        detail = pyvips.Image.gaussnoise(60, 60, mean=128, sigma=60, seed=1)
+        im = pyvips.Image.black(300, 100).insert(detail, 220, 20)
+        im = im.cast("uchar").colourspace("srgb")
+        for interesting in ["entropy", "attention"]:
+            test = im.smartcrop(100, 100, interesting=interesting)
+            assert test.width == 100
+            assert test.height == 100
+            assert -test.xoffset > 150
+
+        # 16-bit with alpha is premultiplied to float before scoring
+        im16 = (im.cast("ushort") * 256).cast("ushort")
+        im16 = im16.bandjoin(65535).copy(interpretation="rgb16")
+        for interesting in ["entropy", "attention"]:
+            test = im16.smartcrop(100, 100, interesting=interesting)
+            assert test.width == 100
+            assert test.height == 100
+            assert test.bands == 4
+            assert -test.xoffset > 150
+
     def test_falsecolour(self):
         for fmt in all_formats:
             test = self.colour.cast(fmt)
@@ -349,6 +393,13 @@ class TestConversion:
             for x, y in zip(pixel, predict):
                 assert abs(x - y) < 2
 
+        # 16-bit images default to max_alpha 65535
+        test = (self.colour * 256).bandjoin(32768) \
+            .cast("ushort").copy(interpretation="rgb16")
+        pixel = test(30, 30)
+        predict = [int(x * 32768 / 65535) for x in pixel[:-1]]
+        assert test.flatten()(30, 30) == predict
+
     def test_premultiply(self):
         for fmt in unsigned_formats + [pyvips.BandFormat.SHORT,
                                        pyvips.BandFormat.INT] + float_formats:
@@ -368,6 +419,36 @@ class TestConversion:
                 # differs ... don't require huge accuracy
                 assert abs(x - y) < 2
 
+        # same-format fixed point rounds to nearest
+        test = self.image.bandjoin(self.image[1])
+        im = test.premultiply(format="uchar")
+        assert im.format == "uchar"
+        predict = (test.premultiply() + 0.5).cast("uchar")
+        assert (im - predict).abs().max() == 0
+
+        # any other format, or a non-standard max_alpha, is premultiply then
+        # cast
+        for fmt in ["uchar", "char", "ushort", "double"]:
+            for src in ["uchar", "ushort"]:
+                # uchar to uchar is the fixed point path, tested above
+                if src == fmt == "uchar":
+                    continue
+
+                im = test.cast(src).premultiply(format=fmt)
+                assert im.format == fmt
+                assert im.bands == test.bands
+                predict = test.cast(src).premultiply().cast(fmt)
+                assert (im - predict).abs().max() == 0
+
+        im = test.premultiply(max_alpha=128, format="uchar")
+        predict = test.premultiply(max_alpha=128).cast("uchar")
+        assert (im - predict).abs().max() == 0
+
+        # one band images are just cast
+        im = self.image[1].premultiply(format="ushort")
+        assert im.format == "ushort"
+        assert (im - self.image[1]).abs().max() == 0
+
     @pytest.mark.skipif(pyvips.type_find("VipsConversion", "composite") == 0,
                         reason="no composite support, skipping test")
     def test_composite(self):
@@ -398,6 +479,21 @@ class TestConversion:
                 # differs ... don't require huge accuracy
                 assert abs(x - y) < 2
 
+        # a fused unpremultiply and cast must match the two steps exactly
+        pre = self.image.bandjoin(self.image[1]).premultiply()
+        for fmt in ["uchar", "ushort", "short"]:
+            im = pre.unpremultiply(format=fmt)
+            assert im.format == fmt
+            predict = pre.unpremultiply().cast(fmt)
+            assert (im - predict).abs().max() == 0
+
+        # same-format fixed point is close to the float path
+        pre = pre.cast("uchar")
+        im = pre.unpremultiply(format="uchar")
+        assert im.format == "uchar"
+        predict = pre.unpremultiply()
+        assert (im - predict).abs().max() <= 1
+
     def test_flip(self):
         for fmt in all_formats:
             test = self.colour.cast(fmt)
@@ -124,6 +124,11 @@ class TestCreate:
         assert sigma == pytest.approx(10, abs=0.4)
         assert mean == pytest.approx(100, abs=0.4)
 
+        # pixels depend only on seed and position
+        a = pyvips.Image.gaussnoise(100, 90, seed=42)
+        b = pyvips.Image.gaussnoise(200, 200, seed=42)
+        assert (a - b.crop(0, 0, 100, 90)).abs().max() == 0
+
     def test_grey(self):
         im = pyvips.Image.grey(100, 90)
         assert im.width == 100
@@ -431,6 +436,10 @@ class TestCreate:
         assert im.bands == 1
         assert im.format == pyvips.BandFormat.FLOAT
 
+        a = pyvips.Image.worley(512, 512, seed=42)
+        b = pyvips.Image.worley(512, 512, seed=42)
+        assert (a - b).abs().max() == 0
+
     @pytest.mark.skipif(pyvips.type_find("VipsOperation", "perlin") == 0,
                         reason="no perlin, skipping test")
     def test_perlin(self):
@@ -440,6 +449,10 @@ class TestCreate:
         assert im.bands == 1
         assert im.format == pyvips.BandFormat.FLOAT
 
+        a = pyvips.Image.perlin(512, 512, seed=42)
+        b = pyvips.Image.perlin(512, 512, seed=42)
+        assert (a - b).abs().max() == 0
+
 
 if __name__ == '__main__':
     pytest.main()
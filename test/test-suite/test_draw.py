@@ -5,6 +5,30 @@ import pyvips
 
 
 class TestDraw:
+    def test_draw_batch(self):
+        im = pyvips.Image.black(100, 100)
+        im = im.draw_batch(100,
+                           rects=[10, 10, 20, 20, 60, 60, 30, 30],
+                           lines=[0, 99, 99, 99],
+                           circles=[50, 50, 10])
+
+        im2 = pyvips.Image.black(100, 100)
+        im2 = im2.draw_rect(100, 10, 10, 20, 20)
+        im2 = im2.draw_rect(100, 60, 60, 30, 30)
+        im2 = im2.draw_line(100, 0, 99, 99, 99)
+        im2 = im2.draw_circle(100, 50, 50, 10)
+
+        diff = (im - im2).abs().max()
+        assert diff == 0
+
+        im = pyvips.Image.black(100, 100)
+        im = im.draw_batch(100, rects=[-10, -10, 30, 30], fill=True)
+        im2 = pyvips.Image.black(100, 100)
+        im2 = im2.draw_rect(100, -10, -10, 30, 30, fill=True)
+
+        diff = (im - im2).abs().max()
+        assert diff == 0
+
     def test_draw_circle(self):
         im = pyvips.Image.black(100, 100)
         im = im.draw_circle(100, 50, 50, 25)
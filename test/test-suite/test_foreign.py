@@ -12,6 +12,7 @@ from helpers import \
     ANALYZE_FILE, GIF_FILE, WEBP_FILE, EXR_FILE, FITS_FILE, OPENSLIDE_FILE, \
     PDF_FILE, SVG_FILE, SVGZ_FILE, SVG_GZ_FILE, GIF_ANIM_FILE, DICOM_FILE, \
     BMP_FILE, NIFTI_FILE, ICO_FILE, HEIC_FILE, TRUNCATED_FILE, \
+    HALF_TIF_FILE, \
     GIF_ANIM_EXPECTED_PNG_FILE, \
     GIF_ANIM_DISPOSE_BACKGROUND_FILE, GIF_ANIM_DISPOSE_BACKGROUND_EXPECTED_PNG_FILE, \
     GIF_ANIM_DISPOSE_PREVIOUS_FILE, GIF_ANIM_DISPOSE_PREVIOUS_EXPECTED_PNG_FILE, \
@@ -458,6 +459,26 @@ class TestForeign:
         buf = x.tiffsave_buffer(tile=True, pyramid=True,
                                 region_shrink="nearest")
 
+    @skip_if_no("tiffload")
+    def test_tiff_half(self):
+        # 16-bit float RGB, expanded to float on load
+        x = pyvips.Image.new_from_file(HALF_TIF_FILE)
+        assert x.width == 4
+        assert x.height == 2
+        assert x.bands == 3
+        assert x.format == "float"
+        assert x.interpretation == "scrgb"
+
+        assert_almost_equal_objects(x(0, 0), [0.0, 0.5, 1.0])
+        # negative, largest normal, smallest denormal
+        assert_almost_equal_objects(x(1, 0), [-2.0, 65504.0, 2 ** -24],
+                                    threshold=0)
+        assert_almost_equal_objects(x(2, 0), [0.25, 0.125, 3.0])
+        # smallest normal
+        assert_almost_equal_objects(x(2, 1), [2 ** -14, 0.75, -0.5],
+                                    threshold=0)
+        assert_almost_equal_objects(x(1, 1), [10.0, 100.0, 1000.0])
+
     @skip_if_no("magickload")
     def test_magickload(self):
         def bmp_valid(im):
@@ -615,6 +636,17 @@ class TestForeign:
             assert x1.get("page-height") == x2.get("page-height")
             assert x1.get("gif-loop") == x2.get("gif-loop")
 
+        # animations are written a page at a time ... check pages which
+        # don't line up with strips survive a lossless round trip
+        frames = [self.colour.crop(0, i * 10, 100, 33) for i in range(3)]
+        anim = pyvips.Image.arrayjoin(frames, across=1).copy()
+        anim.set_type(pyvips.GValue.gint_type, "page-height", 33)
+        buf = anim.webpsave_buffer(lossless=True)
+        x = pyvips.Image.new_from_buffer(buf, "", n=-1)
+        assert x.width == anim.width
+        assert x.height == anim.height
+        assert (x.extract_band(0, n=3) - anim).abs().max() == 0
+
     @skip_if_no("analyzeload")
     def test_analyzeload(self):
         def analyze_valid(im):
@@ -768,6 +800,74 @@ class TestForeign:
 
         assert filecmp.cmp(GIF_ANIM_DISPOSE_PREVIOUS_EXPECTED_PNG_FILE, filename, shallow=False)
 
+    @skip_if_no("gifload")
+    def test_gifload_page_seek(self):
+        # loading a single page must match that page of the whole animation
+        for name in [GIF_ANIM_FILE,
+                     GIF_ANIM_DISPOSE_BACKGROUND_FILE,
+                     GIF_ANIM_DISPOSE_PREVIOUS_FILE]:
+            animation = pyvips.Image.new_from_file(name, n=-1)
+            n_pages = animation.get("n-pages")
+            page_height = animation.height // n_pages
+            for page in range(n_pages):
+                im = pyvips.Image.new_from_file(name, page=page)
+                frame = animation.crop(0, page * page_height,
+                                       animation.width, page_height)
+                assert (im - frame).abs().max() == 0
+
+    @skip_if_no("gifload")
+    @skip_if_no("gifsave")
+    def test_gifload_page_order(self):
+        # more pages than the keyframe interval, read out of order from one
+        # loader: backwards seeks, keyframe restores and restarts from
+        # independent frames must all match a load of just that page
+        n_pages = 40
+        x = pyvips.Image.xyz(32, 32)[0]
+        rgb = [x * 4 + i for i in range(n_pages)]
+        rgb = [page.bandjoin([i * 6, 128]).cast("uchar")
+               for i, page in enumerate(rgb)]
+
+        # with alpha no page is independent, so we need keyframes
+        alpha = (x > 0).ifthenelse(255, 0).cast("uchar")
+        rgba = [page.bandjoin(alpha) for page in rgb]
+
+        for pages in [rgb, rgba]:
+            animation = pyvips.Image.arrayjoin(pages, across=1)
+            animation = animation.copy()
+            animation.set_type(pyvips.GValue.gint_type, "page-height", 32)
+            buf = animation.gifsave_buffer()
+
+            animation = pyvips.Image.new_from_buffer(buf, "", n=-1,
+                                                     access="sequential")
+            assert animation.get("n-pages") == n_pages
+            for page in [35, 2, 33, 20, 39, 0, 17]:
+                frame = animation.crop(0, page * 32, 32, 32)
+                im = pyvips.Image.new_from_buffer(buf, "", page=page)
+                assert (im - frame).abs().max() == 0
+
+    @skip_if_no("gifsave")
+    def test_gifsave(self):
+        # mono has few enough colours to save exactly
+        self.save_load_buffer("gifsave_buffer", "gifload_buffer", self.mono)
+
+        # colour must be quantised
+        buf = self.colour.gifsave_buffer()
+        x = pyvips.Image.new_from_buffer(buf, "")
+        assert x.width == self.colour.width
+        assert x.height == self.colour.height
+        assert x.bands == 3
+        assert (self.colour - x).abs().avg() < 10
+
+        # animations keep their pages, delays and loop
+        x1 = pyvips.Image.new_from_file(GIF_ANIM_FILE, n=-1)
+        buf = x1.gifsave_buffer()
+        x2 = pyvips.Image.new_from_buffer(buf, "", n=-1)
+        assert x2.width == x1.width
+        assert x2.height == x1.height
+        assert x2.get("n-pages") == x1.get("n-pages")
+        assert x2.get("delay") == x1.get("delay")
+        assert x2.get("loop") == x1.get("loop")
+
     @skip_if_no("svgload")
     def test_svgload(self):
         def svg_valid(im):
@@ -27,6 +27,12 @@ class TestHistogram:
         assert im.avg() < im2.avg()
         assert im.deviate() < im2.deviate()
 
+        # the input is only computed once, so sequential sources work
+        im3 = pyvips.Image.new_from_file(JPEG_FILE, access="sequential")
+        im3 = im3.hist_equal()
+
+        assert (im2 - im3).abs().max() == 0
+
     def test_hist_ismonotonic(self):
         im = pyvips.Image.identity()
         assert im.hist_ismonotonic()
@@ -80,6 +86,17 @@ class TestHistogram:
 
         assert (im - im2).abs().max() == 0.0
 
+        # chains of maplut are folded into one LUT, results should match
+        # the separate steps exactly
+        im = pyvips.Image.new_from_file(JPEG_FILE)
+        invert = 255 - pyvips.Image.identity()
+        halve = (pyvips.Image.identity() / 2).cast("uchar")
+        chain = im.maplut(invert).maplut(halve)
+        separate = im.maplut(invert).copy_memory().maplut(halve)
+        assert chain.format == pyvips.BandFormat.UCHAR
+        assert chain.bands == im.bands
+        assert (chain - separate).abs().max() == 0.0
+
     def test_percent(self):
         im = pyvips.Image.new_from_file(JPEG_FILE).extract_band(1)
 
@@ -96,3 +96,74 @@ test_thumbnail "100x100<" 290 442
 test_thumbnail "2000<" 1312 2000
 test_thumbnail "100x100>" 66 100
 test_thumbnail "2000>" 290 442
+
+# several files with --jobs, some from --input-list, one name per line
+printf "testing thumbnail --jobs --input-list ... "
+for i in a b c d; do
+	cp $image $tmp/$i.jpg
+done
+printf "$tmp/b.jpg\n\n$tmp/c.jpg\n" > $tmp/list.txt
+$vipsthumbnail $tmp/a.jpg --input-list $tmp/list.txt --jobs 2 \
+	-s 100 -o tn_%s.jpg
+echo "$tmp/d.jpg" | $vipsthumbnail --input-list - --jobs 2 -s 100 -o tn_%s.jpg
+for i in a b c d; do
+	width=$($vipsheader -f width $tmp/tn_$i.jpg)
+	if [ $width -ne 66 ]; then
+		echo width of tn_$i.jpg is $width, not 66
+		exit 1
+	fi
+done
+echo "ok"
+
+# a failing file must be named in the error, and set the exit code
+printf "testing thumbnail --jobs error ... "
+if $vipsthumbnail $tmp/a.jpg $tmp/missing.jpg --jobs 2 \
+	-s 100 -o tn_%s.jpg 2> $tmp/error.txt; then
+	echo "missing file did not fail"
+	exit 1
+fi
+if ! grep -q "unable to thumbnail $tmp/missing.jpg" $tmp/error.txt; then
+	echo "missing file not reported"
+	exit 1
+fi
+echo "ok"
+
+# server mode: values come back as "result:" lines, then a status line, and a
+# file rewritten by one command is reloaded by the next
+printf "testing server ... "
+printf "copy $image $tmp/s.v\navg $tmp/s.v\n# comment\n\ninvert $image $tmp/s.v\navg $tmp/s.v\nnosuchop x\n" | \
+	$vips server > $tmp/server.txt
+if [ $(wc -l < $tmp/server.txt) -ne 6 ]; then
+	echo "wrong number of server lines"
+	cat $tmp/server.txt
+	exit 1
+fi
+if [ "$(sed -n 1p $tmp/server.txt)" != "ok" ] ||
+	[ "$(sed -n 3p $tmp/server.txt)" != "ok" ] ||
+	[ "$(sed -n 4p $tmp/server.txt)" != "ok" ]; then
+	echo "bad server status"
+	cat $tmp/server.txt
+	exit 1
+fi
+if ! sed -n 6p $tmp/server.txt | grep -q "^error: "; then
+	echo "server did not report an error"
+	exit 1
+fi
+avg=$(sed -n 2p $tmp/server.txt | sed 's/^result: //')
+avg_invert=$(sed -n 5p $tmp/server.txt | sed 's/^result: //')
+dif=$(echo "x = $avg + $avg_invert - 255; if (x < 0) x = -x; x" | bc -l)
+if break_threshold $dif 0.001; then
+	echo "server results $avg and $avg_invert, stale cache?"
+	exit 1
+fi
+
+# a command longer than any fixed line buffer must run as one command
+padding=$(printf "%20000s" "")
+printf "avg$padding$tmp/s.v\n" | $vips server > $tmp/server.txt
+if [ $(wc -l < $tmp/server.txt) -ne 2 ] ||
+	[ "$(sed -n 2p $tmp/server.txt)" != "ok" ]; then
+	echo "long server command was split"
+	cat $tmp/server.txt
+	exit 1
+fi
+echo "ok"
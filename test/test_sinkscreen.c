@@ -0,0 +1,184 @@
+/* Test vips_sink_screen() viewport scheduling and tile cancellation.
+ */
+
+#include <stdio.h>
+#include <vips/vips.h>
+
+#define SIZE (512)
+#define TILE (64)
+
+/* The source blocks until we open the gate, so we can queue tiles and set
+ * the viewport before anything is calculated.
+ */
+static GMutex gate_lock;
+static GCond gate_cond;
+static gboolean gate_open = FALSE;
+
+/* Tiles the render has painted, in order.
+ */
+static GMutex paint_lock;
+static GCond paint_cond;
+static VipsRect painted[SIZE];
+static int n_painted = 0;
+
+static int
+gate_gen( VipsRegion *or, void *seq, void *a, void *b, gboolean *stop )
+{
+	g_mutex_lock( &gate_lock );
+	while( !gate_open )
+		g_cond_wait( &gate_cond, &gate_lock );
+	g_mutex_unlock( &gate_lock );
+
+	vips_region_paint( or, &or->valid, 128 );
+
+	return( 0 );
+}
+
+static void
+notify_cb( VipsImage *image, VipsRect *rect, void *a )
+{
+	g_mutex_lock( &paint_lock );
+	if( n_painted < SIZE )
+		painted[n_painted++] = *rect;
+	g_cond_broadcast( &paint_cond );
+	g_mutex_unlock( &paint_lock );
+}
+
+/* Wait for the tile at left, top to be painted. FALSE on timeout.
+ */
+static gboolean
+wait_for_tile( int left, int top )
+{
+	gint64 end_time = g_get_monotonic_time() + 10 * G_TIME_SPAN_SECOND;
+	gboolean found;
+
+	g_mutex_lock( &paint_lock );
+	for(;;) {
+		int i;
+
+		found = FALSE;
+		for( i = 0; i < n_painted; i++ )
+			if( painted[i].left == left &&
+				painted[i].top == top )
+				found = TRUE;
+
+		if( found ||
+			!g_cond_wait_until( &paint_cond, &paint_lock,
+				end_time ) )
+			break;
+	}
+	g_mutex_unlock( &paint_lock );
+
+	return( found );
+}
+
+/* Ask for an area of out, queueing any tiles we don't have.
+ */
+static int
+request( VipsImage *out, int left, int top, int width, int height )
+{
+	VipsRegion *region;
+	VipsRect rect = { left, top, width, height };
+
+	if( !(region = vips_region_new( out )) )
+		return( -1 );
+	if( vips_region_prepare( region, &rect ) ) {
+		g_object_unref( region );
+		return( -1 );
+	}
+	g_object_unref( region );
+
+	return( 0 );
+}
+
+int
+main( int argc, char **argv )
+{
+	VipsImage *in, *out, *mask;
+	VipsRect viewport = { 0, 0, TILE, TILE };
+	double average;
+	int n;
+
+        if( VIPS_INIT( argv[0] ) )
+                vips_error_exit( "unable to start" );
+
+	/* One worker, so only one tile can be in progress.
+	 */
+	vips_concurrency_set( 1 );
+
+	in = vips_image_new();
+	vips_image_init_fields( in, SIZE, SIZE, 1,
+		VIPS_FORMAT_UCHAR, VIPS_CODING_NONE,
+		VIPS_INTERPRETATION_B_W, 1.0, 1.0 );
+	if( vips_image_pipelinev( in, VIPS_DEMAND_STYLE_ANY, NULL ) ||
+		vips_image_generate( in,
+			NULL, gate_gen, NULL, NULL, NULL ) )
+		vips_error_exit( NULL );
+
+	out = vips_image_new();
+	mask = vips_image_new();
+	if( vips_sink_screen( in, out, mask, TILE, TILE,
+		(SIZE / TILE) * (SIZE / TILE), 0, notify_cb, NULL ) )
+		vips_error_exit( NULL );
+
+	/* Only sink_screen images have a viewport.
+	 */
+	if( !vips_sink_screen_set_viewport( in, &viewport ) )
+		vips_error_exit( "set_viewport on a plain image succeeded" );
+	vips_error_clear();
+
+	/* Queue every tile, then look at just the top-left one. All the
+	 * other queued tiles should be cancelled.
+	 */
+	printf( "** queue all, set viewport ..\n" );
+	if( request( out, 0, 0, SIZE, SIZE ) ||
+		vips_sink_screen_set_viewport( out, &viewport ) )
+		vips_error_exit( NULL );
+
+	g_mutex_lock( &gate_lock );
+	gate_open = TRUE;
+	g_cond_broadcast( &gate_cond );
+	g_mutex_unlock( &gate_lock );
+
+	if( !wait_for_tile( 0, 0 ) )
+		vips_error_exit( "viewport tile not painted" );
+
+	/* Give the render a chance to paint anything else it thinks is
+	 * queued.
+	 */
+	g_usleep( 200000 );
+
+	/* We can have painted the tile that was in progress when we set the
+	 * viewport, plus the viewport tile, and nothing else.
+	 */
+	g_mutex_lock( &paint_lock );
+	n = n_painted;
+	g_mutex_unlock( &paint_lock );
+	printf( "** %d tiles painted\n", n );
+	if( n > 2 )
+		vips_error_exit( "cancelled tiles were painted" );
+
+	if( vips_avg( mask, &average, NULL ) )
+		vips_error_exit( NULL );
+	if( average * (SIZE / TILE) * (SIZE / TILE) / 255 > 2.5 )
+		vips_error_exit( "mask shows cancelled tiles as painted" );
+
+	/* A cancelled tile is queued again if it's asked for.
+	 */
+	printf( "** request cancelled tile ..\n" );
+	viewport.left = SIZE / 2;
+	viewport.top = SIZE / 2;
+	if( vips_sink_screen_set_viewport( out, &viewport ) ||
+		request( out, SIZE / 2, SIZE / 2, TILE, TILE ) )
+		vips_error_exit( NULL );
+	if( !wait_for_tile( SIZE / 2, SIZE / 2 ) )
+		vips_error_exit( "cancelled tile not repainted" );
+
+	g_object_unref( out );
+	g_object_unref( mask );
+	g_object_unref( in );
+
+	vips_shutdown();
+
+	return( 0 );
+}
@@ -0,0 +1,10 @@
+#!/bin/sh
+
+# test vips_sink_screen() viewport scheduling and tile cancellation
+
+# set -x
+set -e
+
+. ./variables.sh
+
+./test_sinkscreen
@@ -0,0 +1,162 @@
+/* Test vips_image_write_to_files() on two branches of one sequential load,
+ * and on a fast and a slow branch of a tall image.
+ */
+
+#include <stdio.h>
+#include <vips/vips.h>
+
+/* 0 if a and b have the same pixels.
+ */
+static int
+same( VipsImage *a, VipsImage *b )
+{
+	VipsImage *t1, *t2;
+	double max;
+
+	if( vips_subtract( a, b, &t1, NULL ) )
+		return( -1 );
+	if( vips_abs( t1, &t2, NULL ) ) {
+		g_object_unref( t1 );
+		return( -1 );
+	}
+	g_object_unref( t1 );
+	if( vips_max( t2, &max, NULL ) ) {
+		g_object_unref( t2 );
+		return( -1 );
+	}
+	g_object_unref( t2 );
+
+	return( max == 0 ? 0 : -1 );
+}
+
+/* Pass pixels through, but slowly.
+ */
+static int
+slow_gen( VipsRegion *or, void *seq, void *a, void *b, gboolean *stop )
+{
+	VipsRegion *ir = (VipsRegion *) seq;
+	VipsRect *r = &or->valid;
+
+	g_usleep( 2000 );
+
+	if( vips_region_prepare( ir, r ) ||
+		vips_region_region( or, ir, r, r->left, r->top ) )
+		return( -1 );
+
+	return( 0 );
+}
+
+/* Save a tall image through a fast and a slow branch. The fast save must
+ * wait for the slow one rather than run far enough ahead that the slow 
+ * reader is dropped.
+ */
+static void
+test_slow_branch( const char *tmpdir )
+{
+	VipsImage *t, *in, *branch[2], *ref, *out;
+	char *source;
+	char *name[2];
+	int i;
+
+	printf( "** saving a fast and a slow branch ..\n" );
+
+	source = g_build_filename( tmpdir, "write_to_files_tall.png", NULL );
+	if( vips_xyz( 64, 6000, &t, NULL ) ||
+		vips_cast( t, &ref, VIPS_FORMAT_USHORT, NULL ) ||
+		vips_image_write_to_file( ref, source, NULL ) )
+		vips_error_exit( NULL );
+	g_object_unref( t );
+	g_object_unref( ref );
+
+	if( !(in = vips_image_new_from_file( source, 
+		"access", VIPS_ACCESS_SEQUENTIAL, NULL )) )
+		vips_error_exit( NULL );
+	branch[0] = in;
+	branch[1] = vips_image_new();
+	if( vips_image_pipelinev( branch[1], 
+		VIPS_DEMAND_STYLE_THINSTRIP, in, NULL ) ||
+		vips_image_generate( branch[1], 
+			vips_start_one, slow_gen, vips_stop_one, in, NULL ) )
+		vips_error_exit( NULL );
+
+	name[0] = g_build_filename( tmpdir, "write_to_files_fast.v", NULL );
+	name[1] = g_build_filename( tmpdir, "write_to_files_slow.v", NULL );
+	if( vips_image_write_to_files( branch, (const char **) name, 2 ) )
+		vips_error_exit( NULL );
+	g_object_unref( branch[1] );
+	g_object_unref( in );
+
+	if( !(ref = vips_image_new_from_file( source, NULL )) )
+		vips_error_exit( NULL );
+	for( i = 0; i < 2; i++ ) {
+		if( !(out = vips_image_new_from_file( name[i], NULL )) )
+			vips_error_exit( NULL );
+		if( same( out, ref ) )
+			vips_error_exit( "output %d is wrong", i + 1 );
+		g_object_unref( out );
+		g_free( name[i] );
+	}
+	g_object_unref( ref );
+	g_free( source );
+}
+
+int
+main( int argc, char **argv )
+{
+	VipsImage *in, *branch[2], *ref, *ref_invert, *out;
+	char *name[2];
+
+        if( VIPS_INIT( argv[0] ) )
+                vips_error_exit( "unable to start" );
+
+	if( argc != 3 )
+		vips_error_exit( "usage: %s image tmpdir", argv[0] );
+
+	/* Two branches of one sequential decode.
+	 */
+	if( !(in = vips_image_new_from_file( argv[1], 
+		"access", VIPS_ACCESS_SEQUENTIAL, NULL )) )
+		vips_error_exit( NULL );
+	branch[0] = in;
+	if( vips_invert( in, &branch[1], NULL ) )
+		vips_error_exit( NULL );
+
+	name[0] = g_build_filename( argv[2], "write_to_files1.v", NULL );
+	name[1] = g_build_filename( argv[2], "write_to_files2.v", NULL );
+
+	printf( "** saving two branches ..\n" );
+	if( vips_image_write_to_files( branch, (const char **) name, 2 ) )
+		vips_error_exit( NULL );
+	g_object_unref( branch[1] );
+	g_object_unref( in );
+
+	/* Both outputs must match a plain random-access load.
+	 */
+	printf( "** checking output ..\n" );
+	if( !(ref = vips_image_new_from_file( argv[1], NULL )) ||
+		vips_invert( ref, &ref_invert, NULL ) )
+		vips_error_exit( NULL );
+
+	if( !(out = vips_image_new_from_file( name[0], NULL )) )
+		vips_error_exit( NULL );
+	if( same( out, ref ) )
+		vips_error_exit( "first output is wrong" );
+	g_object_unref( out );
+
+	if( !(out = vips_image_new_from_file( name[1], NULL )) )
+		vips_error_exit( NULL );
+	if( same( out, ref_invert ) )
+		vips_error_exit( "second output is wrong" );
+	g_object_unref( out );
+
+	g_object_unref( ref_invert );
+	g_object_unref( ref );
+	g_free( name[0] );
+	g_free( name[1] );
+
+	test_slow_branch( argv[2] );
+
+	vips_shutdown();
+
+	return( 0 );
+}
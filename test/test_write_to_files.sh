@@ -0,0 +1,11 @@
+#!/bin/sh
+
+# test vips_image_write_to_files() on two branches of one sequential load,
+# and on a fast and a slow branch of a tall image
+
+# set -x
+set -e
+
+. ./variables.sh
+
+./test_write_to_files $image $tmp
@@ -42,6 +42,10 @@
  * 	- parse options in two passes (thanks Haida)
  * 26/11/17
  * 	- remove throw() decls, they are now deprecated everywhere
+ * 18/10/20
+ * 	- add "server" action
+ * 	- server drops the cache between commands, and prefixes output values
+ * 	  with "result:"
  */
 
 /*
@@ -983,6 +987,232 @@ print_help( int argc, char **argv )
 	return( 0 );
 }
 
+/* Set by --keep-cache: don't drop the operation cache between server 
+ * commands.
+ */
+static gboolean server_keep_cache = FALSE;
+
+static GOptionEntry server_options[] = {
+	{ "keep-cache", 'k', 0, G_OPTION_ARG_NONE, &server_keep_cache, 
+		N_( "keep the operation cache between commands" ), NULL },
+	{ NULL }
+};
+
+/* Walk the required args of a server command, as vips_call_argv().
+ */
+typedef struct _ServerCall {
+	int argc;
+	char **argv;
+	int i;
+} ServerCall;
+
+/* Write the outputs of a server command. Images are written to their 
+ * filenames, and other values are printed to stdout as a "result:" line.
+ */
+static void *
+server_write_output( VipsObject *object,
+	GParamSpec *pspec,
+	VipsArgumentClass *argument_class,
+	VipsArgumentInstance *argument_instance,
+	void *a, void *b )
+{
+	ServerCall *call = (ServerCall *) a;
+	const char *name = g_param_spec_get_name( pspec );
+
+	if( !(argument_class->flags & VIPS_ARGUMENT_REQUIRED) ||
+		!(argument_class->flags & VIPS_ARGUMENT_CONSTRUCT) ||
+		(argument_class->flags & VIPS_ARGUMENT_DEPRECATED) ) 
+		return( NULL );
+
+	if( argument_class->flags & VIPS_ARGUMENT_INPUT ) 
+		call->i += 1;
+	else if( vips_object_argument_needsstring( object, name ) ) {
+		const char *arg = call->argv[call->i];
+
+		call->i += 1;
+
+		/* Stdout is for status lines.
+		 */
+		if( vips_isprefix( ".", arg ) ) {
+			vips_error( "server", 
+				"%s", _( "can't write images to stdout" ) );
+			return( pspec );
+		}
+
+		if( vips_object_get_argument_to_string( object, name, arg ) ) 
+			return( pspec );
+	}
+	else {
+		GValue value = { 0, };
+		char *str;
+
+		g_value_init( &value, G_PARAM_SPEC_VALUE_TYPE( pspec ) );
+		g_object_get_property( G_OBJECT( object ), name, &value );
+		str = g_strdup_value_contents( &value );
+		printf( "result: %s\n", str );
+		g_free( str );
+		g_value_unset( &value );
+	}
+
+	return( NULL );
+}
+
+/* Read a line of any length from fp, or NULL at the end of the file. Free 
+ * with g_free().
+ */
+static char *
+server_read_line( FILE *fp )
+{
+	GString *line;
+	char buf[256];
+
+	line = g_string_new( NULL );
+	while( fgets( buf, sizeof( buf ), fp ) ) {
+		g_string_append( line, buf );
+		if( line->str[line->len - 1] == '\n' )
+			break;
+	}
+
+	if( line->len == 0 ) {
+		g_string_free( line, TRUE );
+		return( NULL );
+	}
+
+	return( g_string_free( line, FALSE ) );
+}
+
+/* Run a single vips8 operation from a server command line, eg. 
+ * "invert a.jpg b.jpg".
+ */
+static int
+server_run_line( const char *line )
+{
+	char **argv;
+	char **args;
+	int argc;
+	VipsOperation *operation;
+	GOptionContext *context;
+	GOptionGroup *group;
+	GError *error = NULL;
+	int i, j;
+	int result;
+	ServerCall call;
+
+	if( !g_shell_parse_argv( line, &argc, &argv, &error ) ) {
+		vips_g_error( &error );
+		return( -1 );
+	}
+
+	if( !(operation = vips_operation_new( argv[0] )) ) {
+		g_strfreev( argv );
+		return( -1 );
+	}
+
+	/* The parse will remove options from args, so parse a shallow copy
+	 * and free the original strings.
+	 */
+	args = g_new( char *, argc + 1 );
+	for( i = 0; i <= argc; i++ )
+		args[i] = argv[i];
+
+	context = g_option_context_new( NULL );
+	g_option_context_set_help_enabled( context, FALSE );
+	group = g_option_group_new( "operation", 
+		_( "Operation" ), _( "Operation help" ), operation, NULL );
+	g_option_context_add_group( context, group );
+	vips_call_options( group, operation );
+
+	result = 0;
+	if( !g_option_context_parse( context, &argc, &args, &error ) ) {
+		vips_g_error( &error );
+		result = -1;
+	}
+
+	if( !result ) {
+		/* Remove any "--" argument, as parse_options().
+		 */
+		for( i = 1; i < argc; i++ )
+			if( strcmp( args[i], "--" ) == 0 ) {
+				for( j = i; j < argc; j++ )
+					args[j] = args[j + 1];
+
+				argc -= 1;
+			}
+
+		call.argc = argc - 1;
+		call.argv = args + 1;
+		call.i = 0;
+		if( vips__call_argv_build( operation, argc - 1, args + 1 ) ||
+			vips_argument_map( VIPS_OBJECT( operation ),
+				server_write_output, &call, NULL ) )
+			result = -1;
+	}
+
+	vips_object_unref_outputs( VIPS_OBJECT( operation ) );
+	g_object_unref( operation );
+	g_option_context_free( context );
+	g_free( args );
+	g_strfreev( argv );
+
+	return( result );
+}
+
+/* Read operations from stdin, one per line, and run them. Each command 
+ * writes any "result: " lines for its output values, then a status line, 
+ * either "ok" or "error: " followed by the error message on a single line. 
+ * Blank lines and lines starting with '#' are skipped.
+ *
+ * This saves the cost of starting vips for every command. The operation 
+ * cache is dropped after each command, since a command can change a file
+ * that an earlier one loaded, unless --keep-cache is set.
+ */
+static int
+run_server( int argc, char **argv )
+{
+	char *line;
+
+	while( (line = server_read_line( stdin )) ) {
+		g_strstrip( line );
+		if( !line[0] ||
+			line[0] == '#' ) {
+			g_free( line );
+			continue;
+		}
+
+		if( server_run_line( line ) ) {
+			char *message = g_strdup( vips_error_buffer() );
+			char *p;
+
+			vips_error_clear();
+			g_strstrip( message );
+			for( p = message; *p; p++ )
+				if( *p == '\n' )
+					*p = ' ';
+
+			printf( "error: %s\n", message );
+			g_free( message );
+		}
+		else
+			printf( "ok\n" );
+
+		fflush( stdout );
+
+		/* vips_cache_drop_all() is for shutdown, so empty the 
+		 * cache by trimming it to nothing.
+		 */
+		if( !server_keep_cache ) {
+			int max = vips_cache_get_max();
+
+			vips_cache_set_max( 0 );
+			vips_cache_set_max( max );
+		}
+
+		g_free( line );
+	}
+
+	return( 0 );
+}
+
 /* All our built-in actions.
  */
 
@@ -1008,6 +1238,8 @@ static ActionEntry actions[] = {
 		&empty_options[0], print_cppdefs },
 	{ "links", N_( "generate links for vips/bin" ),
 		&empty_options[0], print_links },
+	{ "server", N_( "run operations read from stdin, one per line" ),
+		&server_options[0], run_server },
 	{ "help", N_( "list possible actions" ),
 		&empty_options[0], print_help },
 };
@@ -102,6 +102,9 @@
  * 	- back to -o for output
  * 29/2/20
  * 	- deprecate --delete
+ * 18/10/20
+ * 	- add --jobs to thumbnail several images at once
+ * 	- add --input-list to read filenames from a file or stdin
  */
 
 #ifdef HAVE_CONFIG_H
@@ -135,6 +138,8 @@ static gboolean crop_image = FALSE;
 static gboolean no_rotate_image = FALSE;
 static char *smartcrop_image = NULL;
 static char *thumbnail_intent = NULL;
+static int thumbnail_jobs = 1;
+static char *input_list = NULL;
 
 /* Deprecated and unused.
  */
@@ -180,6 +185,14 @@ static GOptionEntry options[] = {
 	{ "no-rotate", 0, 0, 
 		G_OPTION_ARG_NONE, &no_rotate_image, 
 		N_( "don't auto-rotate" ), NULL },
+	{ "jobs", 'j', 0, 
+		G_OPTION_ARG_INT, &thumbnail_jobs, 
+		N_( "thumbnail N images at once, 0 for one per core" ), 
+		N_( "N" ) },
+	{ "input-list", 0, 0, 
+		G_OPTION_ARG_FILENAME, &input_list, 
+		N_( "read filenames from FILE, one per line, - for stdin" ), 
+		N_( "FILE" ) },
 
 	{ "format", 'f', G_OPTION_FLAG_HIDDEN, 
 		G_OPTION_ARG_STRING, &output_format, 
@@ -317,6 +330,122 @@ thumbnail_process( VipsObject *process, const char *filename )
 	return( 0 );
 }
 
+/* The files we have left to process, shared between the batch workers. Files
+ * are taken one at a time, so we only ever have thumbnail_jobs images in 
+ * flight, however long the list is.
+ */
+typedef struct _ThumbnailBatch {
+	GMutex *lock;
+
+	/* Take filenames from here, then from list, if set.
+	 */
+	char **argv;
+	int next;
+	FILE *list;
+
+	/* Set if any conversion fails.
+	 */
+	int result;
+} ThumbnailBatch;
+
+/* Read a line of any length from fp, or NULL at the end of the file. Free 
+ * with g_free().
+ */
+static char *
+thumbnail_read_line( FILE *fp )
+{
+	GString *line;
+	char buf[256];
+
+	line = g_string_new( NULL );
+	while( fgets( buf, sizeof( buf ), fp ) ) {
+		g_string_append( line, buf );
+		if( line->str[line->len - 1] == '\n' )
+			break;
+	}
+
+	if( line->len == 0 ) {
+		g_string_free( line, TRUE );
+		return( NULL );
+	}
+
+	return( g_string_free( line, FALSE ) );
+}
+
+/* The next file to process, or NULL for no more files. Free with g_free().
+ */
+static char *
+thumbnail_batch_next( ThumbnailBatch *batch )
+{
+	char *filename;
+
+	g_mutex_lock( batch->lock );
+
+	filename = NULL;
+	if( batch->argv[batch->next] ) {
+		filename = g_strdup( batch->argv[batch->next] );
+		batch->next += 1;
+	}
+	else if( batch->list ) {
+		char *line;
+
+		while( (line = thumbnail_read_line( batch->list )) ) {
+			g_strchomp( line );
+			if( line[0] ) {
+				filename = line;
+				break;
+			}
+			g_free( line );
+		}
+	}
+
+	g_mutex_unlock( batch->lock );
+
+	return( filename );
+}
+
+static void *
+thumbnail_batch_worker( void *a )
+{
+	ThumbnailBatch *batch = (ThumbnailBatch *) a;
+
+	char *filename;
+
+	while( (filename = thumbnail_batch_next( batch )) ) {
+		/* Hang resources for processing this thumbnail off @process.
+		 */
+		VipsObject *process = VIPS_OBJECT( vips_image_new() ); 
+
+		if( thumbnail_process( process, filename ) ) {
+			/* The vips error buffer is shared by all jobs, so 
+			 * take our message as soon as we fail. If two jobs
+			 * fail at the same moment, the messages can still 
+			 * be reported against the wrong file.
+			 */
+			char *msg = vips_error_buffer_copy();
+
+			g_mutex_lock( batch->lock );
+
+			fprintf( stderr, "%s: unable to thumbnail %s\n", 
+				g_get_prgname(), filename );
+			fprintf( stderr, "%s", msg );
+			g_free( msg );
+
+			/* We had a conversion failure: return an error code
+			 * when we finally exit.
+			 */
+			batch->result = -1;
+
+			g_mutex_unlock( batch->lock );
+		}
+
+		g_object_unref( process );
+		g_free( filename );
+	}
+
+	return( NULL );
+}
+
 /* Parse a geometry string and set thumbnail_width and thumbnail_height.
  */
 static int
@@ -428,8 +557,8 @@ main( int argc, char **argv )
 	GOptionContext *context;
 	GOptionGroup *main_group;
 	GError *error = NULL;
+	ThumbnailBatch batch;
 	int i;
-	int result;
 
 	if( VIPS_INIT( argv[0] ) )
 	        vips_error_exit( "unable to start VIPS" );
@@ -482,28 +611,59 @@ main( int argc, char **argv )
 			      "libvips built without exif support" ) );
 #endif /*!HAVE_EXIF*/
 
-	result = 0;
+	batch.lock = vips_g_mutex_new();
+	batch.argv = argv + 1;
+	batch.next = 0;
+	batch.list = NULL;
+	batch.result = 0;
+
+	if( input_list ) {
+		if( strcmp( input_list, "-" ) == 0 )
+			batch.list = stdin;
+		else if( !(batch.list = vips__file_open_read( input_list, 
+			NULL, TRUE )) )
+			vips_error_exit( NULL ); 
+	}
 
-	for( i = 1; argv[i]; i++ ) {
-		/* Hang resources for processing this thumbnail off @process.
-		 */
-		VipsObject *process = VIPS_OBJECT( vips_image_new() ); 
+	/* Several jobs share the machine, so each image gets a fair part of
+	 * the threads we would have used.
+	 */
+	if( thumbnail_jobs <= 0 )
+		thumbnail_jobs = vips_concurrency_get();
+	if( thumbnail_jobs > 1 )
+		vips_concurrency_set( 
+			VIPS_MAX( 1, vips_concurrency_get() / thumbnail_jobs ) );
+
+	if( thumbnail_jobs == 1 )
+		thumbnail_batch_worker( &batch );
+	else {
+		GThread **workers = g_new0( GThread *, thumbnail_jobs ); 
 
-		if( thumbnail_process( process, argv[i] ) ) {
-			fprintf( stderr, "%s: unable to thumbnail %s\n", 
-				argv[0], argv[i] );
-			fprintf( stderr, "%s", vips_error_buffer() );
-			vips_error_clear();
+		for( i = 0; i < thumbnail_jobs; i++ ) 
+			if( !(workers[i] = vips_g_thread_new( "vipsthumbnail", 
+				thumbnail_batch_worker, &batch )) ) {
+				fprintf( stderr, "%s", vips_error_buffer() );
+				vips_error_clear();
+				break;
+			}
 
-			/* We had a conversion failure: return an error code
-			 * when we finally exit.
-			 */
-			result = -1;
-		}
+		/* If we couldn't start any threads, run in this one.
+		 */
+		if( !workers[0] ) 
+			thumbnail_batch_worker( &batch );
 
-		g_object_unref( process );
+		for( i = 0; i < thumbnail_jobs; i++ ) 
+			if( workers[i] )
+				(void) vips_g_thread_join( workers[i] );
+
+		g_free( workers );
 	}
 
+	if( batch.list &&
+		batch.list != stdin )
+		fclose( batch.list );
+	vips_g_mutex_free( batch.lock );
+
 	/* We don't free this on error exit, sadly.
 	 */
 #ifdef HAVE_G_WIN32_GET_COMMAND_LINE
@@ -512,5 +672,5 @@ main( int argc, char **argv )
 
 	vips_shutdown();
 
-	return( result );
+	return( batch.result );
 }